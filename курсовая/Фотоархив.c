@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <locale.h>
+#include <time.h>
+#include <float.h>
 
  /* Константы для размеров массивов */
 #define MAX_PHOTOS 100          /* Максимальное количество фотографий */
@@ -21,28 +23,552 @@
 #define MAX_FORMAT_LEN 10       /* Максимальная длина формата файла */
 #define FILENAME "photo_archive.txt"  /* Имя файла для сохранения данных */
 
+/* Константы кэша результатов запросов */
+#define QUERY_CACHE_BUCKETS 64              /* Количество корзин хеш-таблицы кэша */
+#define QUERY_CACHE_BUDGET_BYTES (64 * 1024)/* Лимит памяти кэша в байтах */
+#define MAX_QUERY_KEY_LEN 128               /* Максимальная длина ключа запроса */
+#define QUERY_KIND_LOCATION 'L'             /* Запрос по месту съемки */
+#define QUERY_KIND_DATE_AND_TAG 'D'         /* Запрос по дате и тегу */
+
+/* Поля сортировки для постраничного просмотра */
+#define DEFAULT_PAGE_SIZE 10        /* Размер страницы по умолчанию */
+#define MAX_PAGE_SIZE 100           /* Максимальный размер страницы */
+
+/* Поля группировки для статистики архива */
+#define GROUP_BY_CATEGORY 1         /* Категория */
+#define GROUP_BY_FORMAT 2           /* Формат файла */
+#define GROUP_BY_PLACE 3            /* Место съемки */
+#define GROUP_BY_YEAR 4             /* Год съемки */
+#define GROUP_BY_MONTH 5            /* Год и месяц съемки */
+#define GROUP_BY_DATE 6             /* Дата съемки */
+#define GROUP_BY_RESOLUTION 7       /* Диапазон разрешения в мегапикселях */
+#define GROUP_BY_FIELD_COUNT 8      /* Граница допустимых полей группировки */
+
+/* Агрегируемые показатели */
+#define MEASURE_SIZE 1              /* Размер файла, МБ */
+#define MEASURE_WIDTH 2             /* Ширина, пиксели */
+#define MEASURE_HEIGHT 3            /* Высота, пиксели */
+#define MEASURE_MEGAPIXELS 4        /* Разрешение, мегапиксели */
+#define MEASURE_COUNT 5             /* Граница допустимых показателей */
+
+#define RESOLUTION_BUCKET_COUNT 7   /* Количество диапазонов гистограммы разрешений */
+#define INITIAL_COLUMN_CAPACITY 64  /* Начальная емкость столбцов */
+
+/* Константы буферизованного вывода и экспорта */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)  /* Размер буфера вывода таблиц и экспорта */
+#define SMALL_OUTPUT_BUFFER_SIZE 1024   /* Размер буфера вывода одной записи */
+#define SEPARATOR_WIDTH 50              /* Ширина разделительной линии */
+#define EXPORT_FORMAT_TABLE 1           /* Таблица, как при просмотре */
+#define EXPORT_FORMAT_CSV 2             /* CSV с заголовком */
+#define EXPORT_FORMAT_JSON_LINES 3      /* Один JSON-объект на строку */
+
+/* Константы индексов поиска */
+#define TRIGRAM_LENGTH 3                /* Длина n-граммы индекса подстрок */
+#define INITIAL_TRIGRAM_SLOTS 256       /* Начальный размер хеш-таблицы триграмм */
+#define TAG_SEPARATORS ","              /* Разделители тегов в поле tags */
+
+/* Константы нечеткого поиска */
+#define MYERS_MAX_PATTERN 64            /* Максимальная длина образца (бит в слове) */
+#define FUZZY_DEFAULT_DISTANCE 2        /* Допустимое число опечаток по умолчанию */
+#define FUZZY_MAX_DISTANCE 5            /* Наибольшее допустимое число опечаток */
+#define FUZZY_SUGGESTION_LIMIT 5        /* Количество подсказок при пустом результате */
+
+/* Константы многомерного индекса размеров */
+#define KD_DIMENSIONS 4                 /* Ширина, высота, размер, соотношение сторон */
+#define KD_AXIS_WIDTH 0                 /* Ось ширины, пиксели */
+#define KD_AXIS_HEIGHT 1                /* Ось высоты, пиксели */
+#define KD_AXIS_SIZE 2                  /* Ось размера файла, МБ */
+#define KD_AXIS_ASPECT 3                /* Ось соотношения сторон (ширина / высота) */
+#define KD_REBUILD_PERCENT 50           /* Доля изменений после сборки для перестройки, % */
+#define KD_REBUILD_MIN_CHANGES 16       /* Минимум изменений для перестройки */
+#define KD_UNBOUNDED 1e300              /* Граница диапазона, которая не ограничивает */
+#define KD_SQUARE_TOLERANCE 0.01        /* Допуск соотношения сторон квадратного кадра */
+#define KD_NEAREST_DEFAULT 5            /* Количество ближайших записей по умолчанию */
+#define KD_NEAREST_MAX 20               /* Наибольшее количество ближайших записей */
+
+/* Константы автодополнения */
+#define COMPLETION_DEFAULT_LIMIT 5      /* Количество подсказок при вводе */
+#define COMPLETION_MAX_LIMIT 20         /* Наибольшее количество подсказок */
+#define COMPLETION_REQUEST_MARK '?'     /* Знак в конце ввода, по которому выводятся подсказки */
+
+/* Подсистемы учета памяти */
+#define MEMORY_TEMPORARY 0              /* Рабочие массивы запросов и сортировки */
+#define MEMORY_RECORDS 1                /* Записи и служебные списки архива */
+#define MEMORY_STRINGS 2                /* Словари строк */
+#define MEMORY_QUERY_CACHE 3            /* Кэш результатов запросов */
+#define MEMORY_COLUMNS 4                /* Столбцовое представление */
+#define MEMORY_ROLLUPS 5                /* Инкрементальные сводки */
+#define MEMORY_TRIGRAMS 6               /* Индекс триграмм места */
+#define MEMORY_PARTITIONS 7             /* Разделы по месяцам с индексами тегов */
+#define MEMORY_FUZZY 8                  /* Индексы нечеткого поиска */
+#define MEMORY_DIMENSIONS 9             /* Индекс размеров */
+#define MEMORY_IO 10                    /* Буферы ввода-вывода и блоков */
+#define MEMORY_COMPLETIONS 11           /* Деревья автодополнения */
+#define MEMORY_SUBSYSTEM_COUNT 12       /* Количество подсистем */
+#define MEMORY_BUDGET_BYTES (8 * 1024 * 1024)       /* Лимит памяти по умолчанию */
+#define MEMORY_BUDGET_VARIABLE "PHOTO_ARCHIVE_MEMORY_KB" /* Переменная окружения с лимитом, КБ */
+
+/* Индексы поиска (биты ArchiveIndexes.suspended_indexes и pending_indexes);
+ * пока индекс недоступен, запросы обходятся без него */
+#define SEARCH_INDEX_TRIGRAMS 1         /* Поиск по месту - полным просмотром */
+#define SEARCH_INDEX_FUZZY 2            /* Нечеткий поиск - по временному индексу */
+#define SEARCH_INDEX_DIMENSIONS 4       /* Поиск по размерам - по временному дереву */
+#define SEARCH_INDEX_PARTITIONS 8       /* Поиск по дате и тегу - полным просмотром */
+#define SEARCH_INDEX_PERSISTED (SEARCH_INDEX_TRIGRAMS | SEARCH_INDEX_FUZZY | SEARCH_INDEX_PARTITIONS)
+
+/* Константы файла индексов поиска */
+#define INDEX_FILENAME "photo_archive.idx"  /* Индексы поиска рядом с файлом архива */
+#define INDEX_MAGIC "PHIX"              /* Сигнатура файла индексов */
+#define INDEX_FORMAT_VERSION 2          /* Версия формата файла индексов */
+#define INDEX_HEADER_SIZE 25            /* Размер заголовка в байтах */
+#define INDEX_REBUILD_BATCH 32          /* Записей за одну паузу фоновой перестройки */
+
+/* Константы уплотнения архива */
+#define COMPACTION_DEAD_PERCENT 25      /* Доля удаленных записей для уплотнения, % */
+#define COMPACTION_MIN_DEAD 8           /* Минимум удаленных записей для уплотнения */
+
+/* Константы разделов архива по времени */
+#define SEGMENT_FILENAME_FORMAT "photo_archive_%04d.txt"    /* Файл запечатанного года */
+#define SEGMENT_MANIFEST_FILENAME "photo_archive_segments.txt" /* Перечень запечатанных годов */
+#define MAX_SEGMENT_FILENAME_LEN 64     /* Максимальная длина имени файла раздела */
+#define SEAL_AGE_YEARS 2                /* Через сколько лет год запечатывается */
+#define ALL_YEARS_FIRST 0               /* Нижняя граница диапазона "все годы" */
+#define ALL_YEARS_LAST 9999             /* Верхняя граница диапазона "все годы" */
+
+/* Константы сжатого блочного формата запечатанных годов */
+#define BLOCK_FILENAME_FORMAT "photo_archive_%04d.pab"  /* Сжатый блок года */
+#define BLOCK_MAGIC "PHAB"              /* Сигнатура файла блока */
+#define BLOCK_FORMAT_VERSION 1          /* Версия формата блока */
+#define BLOCK_HEADER_SIZE 22            /* Размер заголовка блока в байтах */
+#define BLOCK_FLAG_COMPRESSED 1         /* Данные блока сжаты LZ-кодеком */
+#define MAX_BLOCK_PAYLOAD_LEN ((unsigned long)MAX_PHOTOS * PHOTO_RECORD_LINE_LEN) /* Предел распакованного блока */
+#define LZ_MIN_MATCH 4                  /* Минимальная длина совпадения */
+#define LZ_HASH_BITS 12                 /* Разрядность хеш-таблицы поиска совпадений */
+#define LZ_MAX_OFFSET 65535             /* Максимальное расстояние до совпадения */
+
+/* Константы слияния и сравнения файлов архива */
+#define MERGE_RUN_RECORDS 256           /* Записей в одной отсортированной серии в памяти */
+#define MERGE_FAN_IN 8                  /* Серий, сливаемых за один проход */
+#define MERGE_MODE_UNION 1              /* Записи хотя бы одного файла */
+#define MERGE_MODE_INTERSECTION 2       /* Записи, которые есть в обоих файлах */
+#define MERGE_MODE_DELTA 3              /* Записи только одного из файлов */
+
+/* Схема записи о фотографии: каждое сохраняемое поле описано один раз.
+ * По схеме генерируются объявления полей, чтение и запись файла архива,
+ * подробный вывод, экспорт в CSV и JSON и ключи сортировки.
+ *   TEXT(поле, длина, подпись) - строка фиксированной длины
+ *   REAL(поле, подпись, вывод, окончание) - вещественное число (2 знака в файле)
+ *   INTEGER(поле, подпись, вывод, окончание) - целое число
+ * Для чисел "вывод" - подпись строки подробного вывода (пустая - значение
+ * продолжает предыдущую строку), "окончание" - текст после значения.
+ * Порядок полей совпадает с порядком в файле архива. */
+#define PHOTO_SCHEMA(TEXT, REAL, INTEGER) \
+    TEXT(name, MAX_NAME_LEN, "Название") \
+    TEXT(date, 11, "Дата съемки") \
+    TEXT(place, MAX_PLACE_LEN, "Место съемки") \
+    TEXT(category, MAX_CATEGORY_LEN, "Категория") \
+    TEXT(tags, MAX_TAGS_LEN, "Теги") \
+    REAL(size, "Размер файла", "Размер файла", " МБ") \
+    INTEGER(width, "Ширина", "Разрешение", " x ") \
+    INTEGER(height, "Высота", "", " пикселей") \
+    TEXT(format, MAX_FORMAT_LEN, "Формат файла")
+
+/* Номера полей схемы (PHOTO_FIELD_name, PHOTO_FIELD_date, ...) */
+#define SCHEMA_ENUM_TEXT(field, length, label) PHOTO_FIELD_##field,
+#define SCHEMA_ENUM_NUMBER(field, label, view_label, view_suffix) PHOTO_FIELD_##field,
+enum {
+    PHOTO_SCHEMA(SCHEMA_ENUM_TEXT, SCHEMA_ENUM_NUMBER, SCHEMA_ENUM_NUMBER)
+    PHOTO_FIELD_COUNT
+};
+
+/* Длина ключа сортировки по всем полям и длина строки файла архива */
+#define SCHEMA_KEY_LEN_TEXT(field, length, label) + (length)
+#define SCHEMA_KEY_LEN_REAL(field, label, view_label, view_suffix) + 8
+#define SCHEMA_KEY_LEN_INTEGER(field, label, view_label, view_suffix) + 4
+#define PHOTO_SORT_KEY_LEN (0 PHOTO_SCHEMA(SCHEMA_KEY_LEN_TEXT, SCHEMA_KEY_LEN_REAL, SCHEMA_KEY_LEN_INTEGER))
+#define PHOTO_RECORD_LINE_LEN (PHOTO_SORT_KEY_LEN + 32 * PHOTO_FIELD_COUNT)
+
 /* Структура для хранения данных о фотографии */
+#define SCHEMA_DECLARE_TEXT(field, length, label) char field[length];
+#define SCHEMA_DECLARE_REAL(field, label, view_label, view_suffix) double field;
+#define SCHEMA_DECLARE_INTEGER(field, label, view_label, view_suffix) int field;
 typedef struct {
-    char name[MAX_NAME_LEN];        /* Название фотографии */
-    char date[11];                  /* Дата съемки в формате ГГГГ-ММ-ДД */
-    char place[MAX_PLACE_LEN];      /* Место съемки */
-    char category[MAX_CATEGORY_LEN];/* Категория */
-    char tags[MAX_TAGS_LEN];        /* Теги (через запятую) */
-    double size;                    /* Размер в МБ */
-    int width;                      /* Ширина в пикселях */
-    int height;                     /* Высота в пикселях */
-    char format[MAX_FORMAT_LEN];    /* Формат файла (JPG, PNG и т.д.) */
+    /* Сохраняемые поля (см. PHOTO_SCHEMA) */
+    PHOTO_SCHEMA(SCHEMA_DECLARE_TEXT, SCHEMA_DECLARE_REAL, SCHEMA_DECLARE_INTEGER)
+
+    /* Ключи поиска без учета регистра (вычисляются, в файл не сохраняются) */
+    char name_key[MAX_NAME_LEN];    /* Свернутое название */
+    char place_key[MAX_PLACE_LEN];  /* Свернутое место съемки */
+    char tags_key[MAX_TAGS_LEN];    /* Свернутые теги */
+
+    /* Служебные поля (в файл не сохраняются) */
+    int is_deleted;                 /* Признак удаленной записи (надгробие) */
+    unsigned int version;           /* Номер версии, растет при каждом изменении */
+    int segment_year;               /* Год запечатанного раздела, 0 - активный файл */
 } Photo;
 
+/* Элемент кэша: результат одного нормализованного запроса */
+typedef struct CachedQuery {
+    char key[MAX_QUERY_KEY_LEN];    /* Нормализованный ключ запроса */
+    int query_kind;                 /* Вид запроса (QUERY_KIND_...) */
+    char date[11];                  /* Дата из запроса (для поиска по дате) */
+    char text[MAX_TAGS_LEN];        /* Место или тег из запроса */
+    int* record_indices;            /* Индексы найденных записей */
+    int result_count;               /* Количество найденных записей */
+    size_t memory_used;             /* Память, занимаемая элементом */
+    struct CachedQuery* lru_prev;   /* Более свежий элемент в списке LRU */
+    struct CachedQuery* lru_next;   /* Более старый элемент в списке LRU */
+    struct CachedQuery* bucket_next;/* Следующий элемент в корзине */
+} CachedQuery;
+
+/* LRU-кэш результатов запросов с ограничением по памяти */
+typedef struct {
+    CachedQuery* buckets[QUERY_CACHE_BUCKETS]; /* Хеш-таблица по ключу */
+    CachedQuery* lru_head;          /* Последний использованный элемент */
+    CachedQuery* lru_tail;          /* Давно не использованный элемент */
+    size_t memory_budget;           /* Лимит памяти в байтах */
+    size_t memory_used;             /* Занятая память в байтах */
+    int entry_count;                /* Количество элементов */
+    long hit_count;                 /* Количество попаданий */
+    long miss_count;                /* Количество промахов */
+    long invalidation_count;        /* Количество сброшенных элементов */
+    long eviction_count;            /* Количество вытесненных элементов */
+    int* overflow_indices;          /* Результат, не поместившийся в лимит */
+} QueryCache;
+
+/* Словарь строк: сопоставляет каждой различной строке номер */
+typedef struct {
+    char** values;                  /* Строки по номерам */
+    int value_count;                /* Количество различных строк */
+    int value_capacity;             /* Емкость массива строк */
+    int* hash_slots;                /* Открытая адресация: номер строки или -1 */
+    int hash_capacity;              /* Размер хеш-таблицы (степень двойки) */
+} StringDictionary;
+
+/* Столбцовое представление записей для агрегации за один проход */
+typedef struct {
+    int row_count;                  /* Количество строк (равно числу записей) */
+    int row_capacity;               /* Емкость столбцов */
+    int* date_keys;                 /* Дата в виде ГГГГММДД */
+    double* sizes;                  /* Размер файла, МБ */
+    int* widths;                    /* Ширина, пиксели */
+    int* heights;                   /* Высота, пиксели */
+    int* category_ids;              /* Номер категории в словаре */
+    int* format_ids;                /* Номер формата в словаре */
+    int* place_ids;                 /* Номер места в словаре */
+    unsigned char* live_flags;      /* 1 - запись существует, 0 - удалена */
+    StringDictionary categories;    /* Словарь категорий */
+    StringDictionary formats;       /* Словарь форматов */
+    StringDictionary places;        /* Словарь мест съемки */
+} ColumnStore;
+
+/* Агрегаты одной группы */
+typedef struct {
+    int key;                        /* Ключ группы */
+    long count;                     /* Количество записей */
+    double sum;                     /* Сумма показателя */
+    double min;                     /* Минимум показателя */
+    double max;                     /* Максимум показателя */
+} GroupStats;
+
+/* Таблица групп с поиском по целочисленному ключу */
+typedef struct {
+    GroupStats* groups;             /* Группы в порядке появления */
+    int group_count;                /* Количество групп */
+    int group_capacity;             /* Емкость массива групп */
+    int* hash_slots;                /* Открытая адресация: номер группы или -1 */
+    int hash_capacity;              /* Размер хеш-таблицы (степень двойки) */
+} GroupTable;
+
+/* Часто используемые сводки, обновляемые при каждом добавлении записи */
+typedef struct {
+    long total_count;               /* Всего записей */
+    double total_size;              /* Суммарный размер, МБ */
+    GroupTable by_category;         /* Размер по категориям */
+    GroupTable by_format;           /* Размер по форматам */
+    GroupTable by_month;            /* Размер по месяцам (ключ ГГГГММ) */
+    GroupTable by_resolution;       /* Гистограмма разрешений */
+    int extremes_stale;             /* Минимумы и максимумы требуют пересчета */
+} ArchiveRollups;
+
+/* Список индексов записей, упорядоченный по возрастанию */
+typedef struct {
+    int* record_indices;            /* Индексы записей */
+    int count;                      /* Количество индексов */
+    int capacity;                   /* Емкость массива */
+} PostingList;
+
+/* Индекс подстрок: триграмма свернутого ключа -> записи, где она встречается */
+typedef struct {
+    int* trigram_keys;              /* Открытая адресация: триграмма или -1 */
+    PostingList* postings;          /* Списки записей по слотам */
+    int slot_count;                 /* Размер хеш-таблицы (степень двойки) */
+    int used_count;                 /* Количество занятых слотов */
+} TrigramIndex;
+
+/* Индекс тегов: свернутый тег -> записи с этим тегом */
+typedef struct {
+    StringDictionary tags;          /* Различные свернутые теги */
+    PostingList* postings;          /* Списки записей по номеру тега */
+    int posting_capacity;           /* Емкость массива списков */
+} TagIndex;
+
+/* Битовые маски вхождений символов образца для алгоритма Майерса */
+typedef struct {
+    unsigned long long masks[256];  /* Бит i установлен, если байт стоит в позиции i */
+    unsigned int wide_symbols[MYERS_MAX_PATTERN]; /* Символы UTF-8 образца (см. myers_next_symbol) */
+    unsigned long long wide_masks[MYERS_MAX_PATTERN]; /* Маски символов UTF-8 */
+    int wide_count;                 /* Количество различных символов UTF-8 */
+    int length;                     /* Длина образца в символах */
+} MyersPattern;
+
+/* Узел BK-дерева; номер узла совпадает с номером значения в словаре */
+typedef struct {
+    int edge_distance;              /* Расстояние до родителя (метка ребра) */
+    int first_child;                /* Первый потомок, -1 - нет */
+    int next_sibling;               /* Следующий потомок того же родителя, -1 - нет */
+} BkTreeNode;
+
+/* Индекс нечеткого поиска по различным значениям одного поля */
+typedef struct {
+    StringDictionary values;        /* Различные свернутые значения поля */
+    PostingList* postings;          /* Записи по номеру значения */
+    int posting_capacity;           /* Емкость массива списков */
+    BkTreeNode* nodes;              /* Узлы BK-дерева, узел 0 - корень */
+    int node_capacity;              /* Емкость массива узлов */
+} FuzzyIndex;
+
+/* Значение, найденное нечетким поиском */
+typedef struct {
+    int value_id;                   /* Номер значения в словаре */
+    int distance;                   /* Расстояние редактирования до запроса */
+} FuzzyMatch;
+
+/* Узел k-d дерева: точка записи в пространстве размеров */
+typedef struct {
+    double point[KD_DIMENSIONS];    /* Координаты записи (KD_AXIS_...) */
+    int record_index;               /* Индекс записи, -1 - запись убрана из дерева */
+    int axis;                       /* Ось, по которой узел делит пространство */
+    int left;                       /* Потомок с меньшими координатами, -1 - нет */
+    int right;                      /* Потомок с большими или равными координатами, -1 - нет */
+} KdTreeNode;
+
+/* k-d дерево по ширине, высоте, размеру и соотношению сторон */
+typedef struct {
+    KdTreeNode* nodes;              /* Узлы дерева */
+    int node_count;                 /* Количество узлов (с убранными) */
+    int node_capacity;              /* Емкость массива узлов */
+    int root;                       /* Корень, -1 - дерево пусто */
+    int built_count;                /* Количество узлов при последней сборке */
+    int change_count;               /* Вставок и удалений после последней сборки */
+    int removed_count;              /* Количество убранных узлов */
+    double scale[KD_DIMENSIONS];    /* Разброс значений по осям для метрики близости */
+} KdTree;
+
+/* Прямоугольная область запроса: границы по каждой оси включительно */
+typedef struct {
+    double low[KD_DIMENSIONS];      /* Нижние границы */
+    double high[KD_DIMENSIONS];     /* Верхние границы */
+} KdBox;
+
+/* Запись, найденная поиском ближайших */
+typedef struct {
+    int record_index;               /* Индекс записи */
+    double distance;                /* Квадрат нормированного расстояния до образца */
+} KdNeighbor;
+
+/* Раздел архива за один месяц съемки со своим индексом тегов */
+typedef struct {
+    int month_key;                  /* Месяц в виде ГГГГММ */
+    PostingList records;            /* Записи раздела по возрастанию индекса */
+    TagIndex tags;                  /* Индекс тегов записей раздела */
+} MonthPartition;
+
+/* Разделы по месяцам, упорядоченные по возрастанию month_key */
+typedef struct {
+    MonthPartition* partitions;     /* Массив разделов */
+    int count;                      /* Количество разделов */
+    int capacity;                   /* Емкость массива */
+} PartitionTable;
+
+/* Запечатанный год: записи хранятся в отдельном файле только для чтения */
+typedef struct {
+    int year;                       /* Год съемки */
+    int record_count;               /* Количество записей в файле раздела */
+    int is_loaded;                  /* Записи раздела уже загружены в память */
+} SealedSegment;
+
+/* Перечень запечатанных годов (читается из файла-перечня) */
+typedef struct {
+    SealedSegment* segments;        /* Разделы по возрастанию года */
+    int count;                      /* Количество разделов */
+    int capacity;                   /* Емкость массива */
+} SegmentDirectory;
+
+/* Поле в заданном пользователем порядке сортировки */
+typedef struct {
+    int field;                      /* Номер поля схемы (PHOTO_FIELD_...) */
+    int descending;                 /* 1 - по убыванию */
+} SortKeyField;
+
+/* Ключ сортировки записи: поля в порядке сортировки, сравнивается memcmp */
+typedef struct {
+    unsigned char key[PHOTO_SORT_KEY_LEN]; /* Закодированные поля */
+    int key_length;                 /* Количество значащих байт ключа */
+    int record_index;               /* Индекс записи */
+} SortKeyEntry;
+
+/* Растущий массив байт для кодирования блока */
+typedef struct {
+    unsigned char* data;            /* Память массива */
+    size_t length;                  /* Количество записанных байт */
+    size_t capacity;                /* Емкость массива */
+    int error;                      /* Признак нехватки памяти */
+} ByteBuffer;
+
+/* Последовательное чтение закодированного блока с проверкой границ */
+typedef struct {
+    const unsigned char* data;      /* Данные блока */
+    size_t length;                  /* Размер данных */
+    size_t position;                /* Текущая позиция чтения */
+    int error;                      /* Признак выхода за границу данных */
+} ByteReader;
+
+/* Список свободных ячеек массива записей, освобожденных при удалении */
+typedef struct {
+    int* slots;                     /* Индексы свободных ячеек (стек) */
+    int count;                      /* Количество свободных ячеек */
+    int capacity;                   /* Емкость массива */
+    long compaction_count;          /* Количество выполненных уплотнений */
+} FreeSlotList;
+
+/* Счетчики памяти одной подсистемы */
+typedef struct {
+    size_t current_bytes;           /* Занято сейчас (динамически) */
+    size_t peak_bytes;              /* Наибольшее занятое значение */
+    size_t static_bytes;            /* Статические массивы подсистемы */
+    long allocation_count;          /* Количество выделений */
+} MemorySubsystem;
+
+/* Учет памяти, выделяемой через memory_allocate */
+typedef struct {
+    MemorySubsystem subsystems[MEMORY_SUBSYSTEM_COUNT]; /* Счетчики по подсистемам */
+    size_t current_bytes;           /* Всего занято, включая статические массивы */
+    size_t peak_bytes;              /* Наибольшее общее значение */
+    size_t budget_bytes;            /* Лимит памяти, 0 - без лимита */
+    long failed_count;              /* Количество отказов в выделении */
+    int active_subsystem;           /* Подсистема, к которой относятся новые блоки */
+} MemoryAccounting;
+
+/* Заголовок перед каждым выделенным блоком */
+typedef union {
+    struct {
+        size_t size;                /* Размер данных блока */
+        int subsystem;              /* Подсистема-владелец */
+    } info;
+    long double alignment;          /* Выравнивание данных как для любого типа */
+} MemoryBlockHeader;
+
+/* Узел сжатого префиксного дерева. Метка ребра - часть ключа одного из
+ * значений, поэтому отдельно не хранится */
+typedef struct {
+    int label_value;                /* Значение, в ключе которого лежит метка */
+    int label_offset;               /* Начало метки в ключе */
+    int label_length;               /* Длина метки в байтах */
+    int value_id;                   /* Значение, ключ которого кончается в узле, -1 - нет */
+    int best_weight;                /* Наибольший вес значения в поддереве */
+    int first_child;                /* Первый потомок, -1 - нет */
+    int next_sibling;               /* Следующий потомок того же узла, -1 - нет */
+} CompletionNode;
+
+/* Префиксное дерево различных значений поля с количеством записей */
+typedef struct {
+    StringDictionary keys;          /* Свернутые значения (ключи дерева) */
+    StringDictionary spellings;     /* Написания значений для вывода */
+    int* spelling_ids;              /* Написание каждого значения (первое встреченное) */
+    int* weights;                   /* Количество записей с каждым значением */
+    int value_capacity;             /* Емкость массивов значений */
+    CompletionNode* nodes;          /* Узлы; узел 0 - корень с пустой меткой */
+    int node_count;                 /* Количество узлов */
+    int node_capacity;              /* Емкость массива узлов */
+} CompletionTrie;
+
+/* Подсказка автодополнения */
+typedef struct {
+    const char* value;              /* Написание значения */
+    int weight;                     /* Количество записей со значением */
+} Completion;
+
+/* Вспомогательные структуры, построенные над массивом записей */
+typedef struct {
+    QueryCache query_cache;         /* Кэш результатов поиска */
+    ColumnStore columns;            /* Столбцовое представление */
+    ArchiveRollups rollups;         /* Инкрементальные сводки */
+    TrigramIndex place_trigrams;    /* Индекс подстрок места съемки */
+    PartitionTable partitions;      /* Разделы по месяцам с индексами тегов */
+    FuzzyIndex name_fuzzy;          /* Нечеткий поиск по названию */
+    FuzzyIndex place_fuzzy;         /* Нечеткий поиск по месту съемки */
+    KdTree dimensions;              /* Индекс размеров и пропорций кадра */
+    CompletionTrie place_completions;   /* Автодополнение мест съемки */
+    CompletionTrie category_completions;/* Автодополнение категорий */
+    CompletionTrie tag_completions;     /* Автодополнение тегов */
+    SegmentDirectory segments;      /* Запечатанные годы, загружаемые по требованию */
+    FreeSlotList free_slots;        /* Свободные ячейки для повторного использования */
+    int suspended_indexes;          /* Освобожденные из-за лимита памяти (SEARCH_INDEX_...) */
+    int pending_indexes;            /* Перестраиваемые в паузах между операциями */
+    int rebuild_position;           /* Первая запись, еще не внесенная в перестраиваемые */
+} ArchiveIndexes;
+
+/* Буфер вывода: записи форматируются в память и выводятся крупными блоками */
+typedef struct {
+    FILE* stream;                   /* Поток, в который сбрасывается буфер */
+    char* data;                     /* Память буфера */
+    size_t capacity;                /* Размер буфера */
+    size_t length;                  /* Количество заполненных байт */
+    int write_error;                /* Признак ошибки записи */
+} OutputBuffer;
+
+/* Курсор постраничного просмотра: позиция последней показанной записи */
+typedef struct {
+    const SortKeyEntry* keys;       /* Ключи сортировки записей по индексу */
+    int page_size;                  /* Количество записей на странице */
+    int page_number;                /* Номер текущей страницы (с 1) */
+    int last_index;                 /* Индекс последней показанной записи, -1 - начало */
+} PageCursor;
+
+/* Запись при слиянии файлов архива: порядок - compare_photos_for_sorting,
+ * при равенстве - хеш и ключ всех полей (одинаковые записи равны) */
+typedef struct {
+    Photo photo;                    /* Поля записи */
+    unsigned int identity;          /* Хеш ключа всех полей */
+    unsigned char key[PHOTO_SORT_KEY_LEN]; /* Ключ всех полей в порядке схемы */
+} MergeRecord;
+
+/* Слияние отсортированных серий одного файла в один поток без повторов */
+typedef struct {
+    FILE* runs[MERGE_FAN_IN];       /* Временные файлы серий */
+    MergeRecord heads[MERGE_FAN_IN];/* Текущая запись каждой серии */
+    int has_head[MERGE_FAN_IN];     /* 1 - у серии есть текущая запись */
+    int run_count;                  /* Количество серий */
+    MergeRecord last;               /* Последняя выданная запись */
+    int has_last;                   /* 1 - запись уже выдавалась */
+    int duplicates;                 /* Отброшено повторов */
+    int skipped_lines;              /* Пропущено нераспознанных строк */
+} RunMerger;
+
+/* Учет памяти по подсистемам (общий для всех функций выделения памяти) */
+static MemoryAccounting memory_accounting;
+
 /* Прототипы функций */
 int initialize_program(void);
 int load_database_from_file(Photo database[], int* record_count);
-int save_database_to_file(const Photo database[], int record_count);
+int save_database_to_file(Photo database[], int record_count, ArchiveIndexes* indexes);
 int display_all_records(const Photo database[], int record_count);
-int add_photo_record(Photo database[], int* record_count);
-int find_photos_by_location(const Photo database[], int record_count, const char* location);
+int add_photo_record(Photo database[], int* record_count, ArchiveIndexes* indexes);
+int find_photos_by_location(const Photo database[], int record_count, const char* location,
+    ArchiveIndexes* indexes);
 int find_photos_by_date_and_tags(const Photo database[], int record_count,
-    const char* date, const char* tag);
+    const char* date, const char* tag, ArchiveIndexes* indexes);
 int sort_database_multi_level(Photo database[], int record_count);
 int display_main_menu(int* user_selection);
 int get_menu_selection(int* selection);
@@ -55,15 +581,335 @@ int validate_date_format(const char* date);
 int validate_positive_number(double number);
 int validate_positive_integer(int number);
 
+/* Прототипы функций кэша результатов запросов */
+unsigned long hash_string_djb2(const char* text);
+int normalize_query_text(const char* text, char* normalized, size_t normalized_size);
+int build_query_key(int query_kind, const char* date, const char* text, char* key);
+int photo_matches_query(const Photo* photo, int query_kind, const char* date, const char* text);
+int collect_query_results(const Photo database[], int record_count, int query_kind,
+    const char* date, const char* text, ArchiveIndexes* indexes, const int** record_indices);
+int query_cache_initialize(QueryCache* cache, size_t memory_budget);
+int query_cache_release(QueryCache* cache);
+CachedQuery* query_cache_lookup(QueryCache* cache, const char* key);
+CachedQuery* query_cache_store(QueryCache* cache, int query_kind, const char* date,
+    const char* text, const char* key, const int record_indices[], int result_count);
+int query_cache_remove_entry(QueryCache* cache, CachedQuery* entry);
+int query_cache_invalidate_for_record(QueryCache* cache, const Photo* photo);
+int query_cache_clear(QueryCache* cache);
+int print_query_cache_statistics(const QueryCache* cache);
+
+/* Прототипы функций постраничного просмотра */
+int print_record_table_header(void);
+int print_record_table_row(int row_number, const Photo* photo);
+int compare_records_in_order(const SortKeyEntry keys[], int index_a, int index_b);
+int select_records_page(const Photo database[], int record_count, const SortKeyEntry keys[],
+    int after_index, int limit, int selected_indices[]);
+int fetch_next_page(const Photo database[], int record_count, PageCursor* cursor,
+    int page_indices[]);
+int fetch_page_by_number(const Photo database[], int record_count, PageCursor* cursor,
+    int page_number, int page_indices[]);
+int browse_records_by_pages(const Photo database[], int record_count);
+
+/* Прототипы функций статистики и агрегации */
+int grow_array(void** array, size_t element_size, int new_capacity);
+int string_dictionary_initialize(StringDictionary* dictionary);
+int string_dictionary_release(StringDictionary* dictionary);
+int string_dictionary_find(const StringDictionary* dictionary, const char* value);
+int string_dictionary_intern(StringDictionary* dictionary, const char* value);
+int parse_date_key(const char* date);
+int resolution_bucket(int width, int height);
+const char* resolution_bucket_label(int bucket);
+int column_store_initialize(ColumnStore* store);
+int column_store_release(ColumnStore* store);
+int column_store_append(ColumnStore* store, const Photo* photo);
+int column_store_set_row(ColumnStore* store, int row, const Photo* photo);
+int column_store_build(ColumnStore* store, const Photo database[], int record_count);
+int group_table_initialize(GroupTable* table);
+int group_table_release(GroupTable* table);
+GroupStats* group_table_find(const GroupTable* table, int key);
+GroupStats* group_table_accumulate(GroupTable* table, int key, double value);
+int group_table_subtract(GroupTable* table, int key, double value);
+int archive_rollups_initialize(ArchiveRollups* rollups);
+int archive_rollups_release(ArchiveRollups* rollups);
+int archive_rollups_add(ArchiveRollups* rollups, const ColumnStore* store, int row);
+int archive_rollups_remove(ArchiveRollups* rollups, const ColumnStore* store, int row);
+int archive_rollups_rebuild(ArchiveRollups* rollups, const ColumnStore* store);
+int aggregate_column_store(const ColumnStore* store, int group_field, int measure,
+    GroupTable* result);
+int format_group_label(const ColumnStore* store, int group_field, int key,
+    char* label, size_t label_size);
+int compare_groups_by_count(const void* first_group, const void* second_group);
+int print_group_table(const ColumnStore* store, const GroupTable* table, int group_field,
+    const char* measure_name);
+int display_archive_statistics(ArchiveIndexes* indexes);
+int run_group_by_query(const ColumnStore* store);
+
+/* Прототипы функций буферизованного вывода и экспорта */
+int output_buffer_initialize(OutputBuffer* buffer, FILE* stream, char* storage, size_t capacity);
+int output_buffer_flush(OutputBuffer* buffer);
+int output_append_bytes(OutputBuffer* buffer, const char* bytes, size_t byte_count);
+int output_append_string(OutputBuffer* buffer, const char* text);
+int output_append_repeated(OutputBuffer* buffer, char character, int repeat_count);
+int output_append_padded(OutputBuffer* buffer, const char* text, int width, int max_length);
+int output_append_integer(OutputBuffer* buffer, long long value, int width);
+int output_append_fixed2(OutputBuffer* buffer, double value, char decimal_point, int width);
+int output_append_csv_field(OutputBuffer* buffer, const char* text);
+int output_append_json_string(OutputBuffer* buffer, const char* text);
+int format_record_table_row(OutputBuffer* buffer, int row_number, const Photo* photo);
+int format_record_csv(OutputBuffer* buffer, const Photo* photo);
+int format_record_json(OutputBuffer* buffer, const Photo* photo);
+char locale_decimal_point(void);
+int export_database(const Photo database[], int record_count, int export_format, FILE* stream);
+int export_database_interactive(const Photo database[], int record_count);
+int run_batch_export(const char* format_name);
+
+/* Прототипы функций поиска без учета регистра */
+int decode_utf8_cyrillic(const unsigned char* text, int* byte_count);
+unsigned int cp1251_to_unicode(unsigned char character);
+int is_utf8_text(const char* text);
+int fold_search_text(const char* text, char* folded, size_t folded_size);
+int photo_refresh_search_keys(Photo* photo);
+int compare_integers(const void* first_value, const void* second_value);
+int posting_list_insert(PostingList* list, int record_index);
+int posting_list_remove(PostingList* list, int record_index);
+int trigram_index_initialize(TrigramIndex* index);
+int trigram_index_release(TrigramIndex* index);
+PostingList* trigram_index_find(const TrigramIndex* index, int trigram);
+PostingList* trigram_index_get(TrigramIndex* index, int trigram);
+int trigram_index_add(TrigramIndex* index, const char* folded_text, int record_index);
+int trigram_index_remove(TrigramIndex* index, const char* folded_text, int record_index);
+int tag_index_initialize(TagIndex* index);
+int tag_index_release(TagIndex* index);
+PostingList* tag_index_get(TagIndex* index, const char* tag);
+int tag_index_add(TagIndex* index, const char* folded_tags, int record_index);
+int tag_index_remove(TagIndex* index, const char* folded_tags, int record_index);
+int search_indexes_build(ArchiveIndexes* indexes, const Photo database[], int record_count);
+int search_index_ready(const ArchiveIndexes* indexes, int index_flag);
+int search_indexes_maintained(const ArchiveIndexes* indexes, int record_index);
+int search_indexes_add_record(ArchiveIndexes* indexes, const Photo* photo, int record_index,
+    int index_mask);
+int search_indexes_rebuild_step(ArchiveIndexes* indexes, const Photo database[], int record_count,
+    int batch_size);
+int collect_index_candidates(const ArchiveIndexes* indexes, int query_kind, const char* date,
+    const char* text, int** candidates);
+
+/* Прототипы функций обслуживания вспомогательных структур */
+int archive_indexes_initialize(ArchiveIndexes* indexes);
+int archive_indexes_build(ArchiveIndexes* indexes, const Photo database[], int record_count);
+int archive_indexes_on_insert(ArchiveIndexes* indexes, const Photo database[], int record_index);
+int archive_indexes_on_update(ArchiveIndexes* indexes, const Photo database[], int record_index,
+    const Photo* old_photo);
+int archive_indexes_on_delete(ArchiveIndexes* indexes, const Photo* old_photo, int record_index);
+int archive_indexes_on_reorder(ArchiveIndexes* indexes, const Photo database[], int record_count);
+int archive_indexes_release(ArchiveIndexes* indexes);
+
+/* Прототипы функций изменения, удаления и уплотнения */
+int count_live_records(const Photo database[], int record_count);
+int free_slot_list_push(FreeSlotList* list, int record_index);
+int allocate_record_slot(ArchiveIndexes* indexes, int* record_count);
+int select_record_by_number(const Photo database[], int record_count);
+int read_edit_line(const char* label, const char* current_value, char* buffer, size_t buffer_size);
+int update_photo_record(Photo database[], int record_count, ArchiveIndexes* indexes);
+int delete_photo_record(Photo database[], int record_count, ArchiveIndexes* indexes);
+int archive_needs_compaction(const ArchiveIndexes* indexes, int record_count);
+int compact_database(Photo database[], int* record_count, ArchiveIndexes* indexes);
+
+/* Прототипы функций разделов архива по времени */
+int read_records_from_file(const char* filename, Photo database[], int* record_count,
+    int segment_year);
+int write_records_to_file(const char* filename, const Photo database[], int record_count,
+    int segment_year);
+int partition_table_initialize(PartitionTable* table);
+int partition_table_release(PartitionTable* table);
+MonthPartition* partition_table_find(const PartitionTable* table, int month_key);
+MonthPartition* partition_table_get(PartitionTable* table, int month_key);
+int partition_table_add(PartitionTable* table, const Photo* photo, int record_index);
+int partition_table_remove(PartitionTable* table, const Photo* photo, int record_index);
+int segment_directory_initialize(SegmentDirectory* directory);
+int segment_directory_release(SegmentDirectory* directory);
+SealedSegment* segment_directory_find(const SegmentDirectory* directory, int year);
+SealedSegment* segment_directory_add(SegmentDirectory* directory, int year, int record_count);
+int segment_directory_load(SegmentDirectory* directory);
+int segment_directory_save(const SegmentDirectory* directory);
+int load_sealed_segments(Photo database[], int* record_count, ArchiveIndexes* indexes,
+    int first_year, int last_year);
+int seal_old_years(Photo database[], int record_count, ArchiveIndexes* indexes);
+int check_record_writable(const Photo* photo);
+
+/* Прототипы функций нечеткого поиска */
+unsigned int myers_next_symbol(const unsigned char* text, int* byte_count);
+unsigned long long myers_symbol_mask(const MyersPattern* pattern, unsigned int symbol);
+int myers_prepare(const char* pattern, MyersPattern* prepared);
+int myers_edit_distance(const MyersPattern* pattern, const char* text);
+int fuzzy_index_initialize(FuzzyIndex* index);
+int fuzzy_index_release(FuzzyIndex* index);
+int fuzzy_index_reserve(FuzzyIndex* index, int value_id);
+int fuzzy_index_add(FuzzyIndex* index, const char* folded_value, int record_index);
+int fuzzy_index_remove(FuzzyIndex* index, const char* folded_value, int record_index);
+int fuzzy_index_search(const FuzzyIndex* index, const char* folded_query, int max_distance,
+    FuzzyMatch** matches);
+int compare_fuzzy_matches(const void* first_match, const void* second_match);
+int suggest_similar_places(const Photo database[], const char* folded_query,
+    const ArchiveIndexes* indexes);
+int find_photos_fuzzy(const Photo database[], int record_count, const char* text,
+    int max_distance, const ArchiveIndexes* indexes);
+int find_photos_fuzzy_interactive(const Photo database[], int record_count,
+    const ArchiveIndexes* indexes);
+
+/* Прототипы функций многомерного индекса размеров */
+int kd_photo_point(const Photo* photo, double point[]);
+int kd_tree_initialize(KdTree* tree);
+int kd_tree_release(KdTree* tree);
+int kd_select_nth(KdTreeNode nodes[], int first, int last, int nth, int axis);
+int kd_tree_build_range(KdTree* tree, int first, int last, int depth);
+int kd_tree_rebuild(KdTree* tree);
+int kd_tree_build(KdTree* tree, const Photo database[], int record_count);
+int kd_tree_after_change(KdTree* tree);
+int kd_tree_insert(KdTree* tree, const Photo* photo, int record_index);
+int kd_tree_remove(KdTree* tree, const Photo* photo, int record_index);
+int kd_tree_range(const KdTree* tree, const KdBox* box, int** record_indices);
+int kd_tree_nearest_visit(const KdTree* tree, int node, const double target[], int limit,
+    KdNeighbor neighbors[], int* found);
+int kd_tree_nearest(const KdTree* tree, const Photo* sample, int limit, KdNeighbor neighbors[]);
+int read_optional_number(const char* label, double* value);
+int find_photos_in_dimension_tree(const Photo database[], const KdTree* tree);
+int find_photos_by_dimensions_interactive(const Photo database[], int record_count,
+    const ArchiveIndexes* indexes);
+
+/* Прототипы функций схемы записи */
+char* schema_next_token(char** cursor);
+int schema_parse_text(char** cursor, char* value, size_t value_size);
+int schema_parse_real(char** cursor, double* value);
+int schema_parse_integer(char** cursor, int* value);
+int parse_photo_record(char* line, Photo* photo);
+int write_photo_record(FILE* stream, const Photo* photo);
+int format_csv_header(OutputBuffer* buffer);
+int print_schema_fields(void);
+int encode_real_sort_key(unsigned char key[], double value);
+int encode_integer_sort_key(unsigned char key[], int value);
+int append_field_sort_key(unsigned char key[], const Photo* photo, int field);
+int build_photo_sort_key(const Photo* photo, const SortKeyField order[], int order_length,
+    unsigned char key[]);
+int compare_sort_entries(const void* first_entry, const void* second_entry);
+int sort_database_by_fields(Photo database[], int record_count, const SortKeyField order[],
+    int order_length);
+int read_sort_order(SortKeyField order[], int* order_length);
+int sort_database_interactive(Photo database[], int record_count);
+
+/* Прототипы функций учета памяти */
+int memory_accounting_initialize(void);
+int memory_account_change(int subsystem, size_t added_bytes, size_t removed_bytes);
+int memory_register_static(int subsystem, size_t size);
+int memory_enter(int subsystem);
+int memory_leave(int previous_subsystem, int result);
+void* memory_allocate(size_t size);
+void* memory_allocate_zeroed(size_t count, size_t size);
+void* memory_reallocate(void* block, size_t size);
+int memory_release(void* block);
+int memory_over_budget(void);
+const char* memory_subsystem_name(int subsystem);
+int print_memory_statistics(const ArchiveIndexes* indexes);
+int archive_indexes_enforce_budget(ArchiveIndexes* indexes);
+int archive_indexes_resume(ArchiveIndexes* indexes, const Photo database[], int record_count);
+int change_memory_budget_interactive(ArchiveIndexes* indexes, const Photo database[],
+    int record_count);
+
+/* Прототипы функций файла индексов поиска */
+int read_file_bytes(const char* filename, unsigned char** data, size_t* length);
+int byte_buffer_append_postings(ByteBuffer* buffer, const PostingList* list, const int positions[]);
+int byte_reader_read_postings(ByteReader* reader, PostingList* list, int record_limit);
+int encode_fuzzy_index(const FuzzyIndex* index, const int positions[], ByteBuffer* payload);
+int decode_fuzzy_index(ByteReader* reader, FuzzyIndex* index, int record_limit);
+int encode_search_indexes(const ArchiveIndexes* indexes, const int positions[], ByteBuffer* payload);
+int decode_search_indexes(ByteReader* reader, ArchiveIndexes* indexes, int record_limit);
+int search_indexes_save(const ArchiveIndexes* indexes, const Photo database[], int record_count);
+int search_indexes_load(ArchiveIndexes* indexes, int record_count);
+int archive_indexes_open(ArchiveIndexes* indexes, const Photo database[], int record_count,
+    int* appended_count);
+
+/* Прототипы функций сжатого блочного формата */
+int byte_buffer_reserve(ByteBuffer* buffer, size_t extra_length);
+int byte_buffer_append(ByteBuffer* buffer, const void* bytes, size_t length);
+int byte_buffer_append_uint32(ByteBuffer* buffer, unsigned int value);
+int byte_buffer_append_varint(ByteBuffer* buffer, unsigned int value);
+int byte_buffer_append_string(ByteBuffer* buffer, const char* text);
+unsigned int byte_reader_read_uint32(ByteReader* reader);
+unsigned int byte_reader_read_varint(ByteReader* reader);
+int byte_reader_read_string(ByteReader* reader, char* text, size_t text_size);
+int bits_required(unsigned int max_value);
+int bit_pack_values(ByteBuffer* buffer, const unsigned int values[], int count);
+int bit_unpack_values(ByteReader* reader, unsigned int values[], int count);
+unsigned int block_checksum(const unsigned char* data, size_t length);
+int lz_compress(const unsigned char* source, size_t source_length, ByteBuffer* output);
+int lz_decompress(const unsigned char* source, size_t source_length,
+    unsigned char* destination, size_t destination_length);
+int encode_record_block(const Photo database[], int record_count, int segment_year,
+    ByteBuffer* block);
+int encode_block_payload(const Photo database[], const int rows[], int row_count,
+    unsigned int values[], ByteBuffer* payload);
+int decode_record_block(const unsigned char* payload, size_t payload_length,
+    Photo database[], int* record_count, int segment_year);
+int write_block_file(const char* filename, const Photo database[], int record_count,
+    int segment_year);
+int read_block_file(const char* filename, Photo database[], int* record_count, int segment_year);
+
+/* Прототипы функций слияния и сравнения файлов архива */
+void merge_record_prepare(MergeRecord* record);
+int compare_merge_records(const void* first_record, const void* second_record);
+int read_merge_record(FILE* stream, MergeRecord* record, int* skipped_lines);
+void run_merger_open(RunMerger* merger, FILE* runs[], int run_count);
+int run_merger_next(RunMerger* merger, MergeRecord* record);
+void run_merger_close(RunMerger* merger);
+int write_sorted_runs(FILE* input, FILE*** runs, int* run_count, int* skipped_lines);
+int merge_run_groups(RunMerger* merger, FILE* runs[], int* run_count);
+int sort_archive_file(const char* filename, RunMerger* merger);
+int run_batch_merge(const char* mode_name, const char* first_filename,
+    const char* second_filename);
+
+/* Прототипы функций автодополнения */
+int completion_trie_initialize(CompletionTrie* trie);
+int completion_trie_release(CompletionTrie* trie);
+int completion_trie_add_node(CompletionTrie* trie, int label_value, int label_offset,
+    int label_length, int value_id);
+int completion_trie_find_child(const CompletionTrie* trie, int node, unsigned char first_byte);
+int completion_trie_insert_key(CompletionTrie* trie, int value_id);
+int completion_trie_refresh_path(CompletionTrie* trie, const char* key);
+int completion_trie_adjust(CompletionTrie* trie, const char* text, int delta);
+int completion_heap_weight(const CompletionTrie* trie, int entry);
+int completion_heap_before(const CompletionTrie* trie, int first_entry, int second_entry);
+void completion_heap_push(const CompletionTrie* trie, int heap[], int* heap_size, int entry);
+int completion_heap_pop(const CompletionTrie* trie, int heap[], int* heap_size);
+int completion_trie_complete(const CompletionTrie* trie, const char* prefix,
+    Completion completions[], int limit);
+int completion_tries_adjust_record(ArchiveIndexes* indexes, const Photo* photo, int delta);
+int completion_tries_build(ArchiveIndexes* indexes, const Photo database[], int record_count);
+int archive_indexes_complete(const ArchiveIndexes* indexes, int field, const char* prefix,
+    Completion completions[], int limit);
+int read_text_with_completions(const ArchiveIndexes* indexes, int field, const char* prompt,
+    char* text, size_t text_size);
+int load_archive_for_batch(Photo database[], int* record_count, ArchiveIndexes* indexes);
+int run_batch_complete(const char* field_name, const char* prefix);
+
 /******************************************************************************
  * Функция: main
  *
  * Описание: Главная функция программы. Организует основной цикл работы
- *           с меню и обработкой выбора пользователя.
+ *           с меню и обработкой выбора пользователя. При запуске с ключом
+ *           --export <table|csv|jsonl> выводит весь архив в стандартный
+ *           поток вывода и завершает работу (для перенаправления в файл
+ *           или конвейер). С ключом --merge <union|intersect|delta>
+ *           <файл1> <файл2> выводит объединение, пересечение или разницу
+ *           двух файлов архива (в разнице строки только первого файла
+ *           помечены "< ", только второго - "> "). С ключом --complete <place|category|tags>
+ *           <начало> выводит самые частые значения поля с этим началом.
+ *
+ * Параметры:
+ *   argc - количество аргументов командной строки
+ *   argv - аргументы командной строки
  *
  * Возвращает: 0 при успешном завершении, 1 при ошибке инициализации
  ******************************************************************************/
-int main(void)
+int main(int argc, char* argv[])
 {
     Photo photo_database[MAX_PHOTOS];   /* Массив для хранения фотографий */
     int photo_count = 0;                /* Текущее количество фотографий */
@@ -71,6 +917,32 @@ int main(void)
     int user_choice = 0;
     int program_exit = 0;
     int operation_result = 0;
+    int segment_count = 0;
+    int appended_count = 0;
+    ArchiveIndexes archive_indexes;     /* Кэш, столбцы и сводки над записями */
+
+    /* Учет памяти: массив записей и буферы экспорта и сжатия размещены статически */
+    memory_accounting_initialize();
+    memory_register_static(MEMORY_RECORDS, sizeof(photo_database));
+    memory_register_static(MEMORY_IO, OUTPUT_BUFFER_SIZE + sizeof(long) * (1 << LZ_HASH_BITS));
+
+    /* Пакетный режим экспорта без меню */
+    if (argc == 3 && strcmp(argv[1], "--export") == 0)
+    {
+        return run_batch_export(argv[2]) == 0 ? 0 : 1;
+    }
+
+    /* Пакетный режим слияния двух файлов архива */
+    if (argc == 5 && strcmp(argv[1], "--merge") == 0)
+    {
+        return run_batch_merge(argv[2], argv[3], argv[4]) == 0 ? 0 : 1;
+    }
+
+    /* Пакетный режим подсказок для значений поля */
+    if (argc == 4 && strcmp(argv[1], "--complete") == 0)
+    {
+        return run_batch_complete(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
 
     /* Инициализация программы */
     operation_result = initialize_program();
@@ -80,27 +952,67 @@ int main(void)
         return 1;
     }
 
-    /* Загрузка данных из файла */
+    /* Загрузка активного файла; запечатанные годы загружаются по требованию */
+    archive_indexes_initialize(&archive_indexes);
     operation_result = load_database_from_file(photo_database, &photo_count);
-    if (operation_result == -1)
+    segment_count = segment_directory_load(&archive_indexes.segments);
+    if (operation_result == -1 && segment_count <= 0)
     {
         printf("Внимание: Файл '%s' не найден. Создана новая база данных.\n", FILENAME);
     }
-    else if (photo_count > 0)
+    else if (photo_count > 0 || segment_count > 0)
     {
         printf("Данные успешно загружены из файла '%s'. Загружено %d записей.\n",
             FILENAME, photo_count);
+        if (segment_count > 0)
+        {
+            printf("Запечатанных годов: %d (загружаются при первом обращении).\n", segment_count);
+        }
     }
     else
     {
         printf("Файл '%s' существует, но не содержит корректных данных.\n", FILENAME);
     }
 
+    operation_result = archive_indexes_open(&archive_indexes, photo_database, photo_count,
+        &appended_count);
+    if (operation_result < 0)
+    {
+        printf("Внимание: Недостаточно памяти для построения статистики.\n");
+    }
+    else if (operation_result == 0 && appended_count > 0)
+    {
+        printf("Индексы поиска загружены из файла '%s' и дополнены %d новыми записями.\n",
+            INDEX_FILENAME, appended_count);
+    }
+    else if (operation_result == 0)
+    {
+        printf("Индексы поиска загружены из файла '%s'.\n", INDEX_FILENAME);
+    }
+    else if (operation_result > 0 && photo_count > 0)
+    {
+        printf("Индексы поиска строятся в фоне; до завершения поиск выполняется просмотром.\n");
+    }
+    if (archive_indexes_enforce_budget(&archive_indexes) > 0)
+    {
+        printf("Внимание: Часть индексов не построена из-за лимита памяти.\n");
+    }
+
     prompt_for_enter_key();
 
     /* Основной цикл работы программы */
     while (program_exit == 0)
     {
+        /* Уплотнение выполняется в паузе между операциями пользователя */
+        if (archive_needs_compaction(&archive_indexes, photo_count))
+        {
+            compact_database(photo_database, &photo_count, &archive_indexes);
+        }
+
+        /* Там же продолжается перестройка индексов и применяется лимит памяти */
+        search_indexes_rebuild_step(&archive_indexes, photo_database, photo_count, INDEX_REBUILD_BATCH);
+        archive_indexes_enforce_budget(&archive_indexes);
+
         operation_result = display_main_menu(&user_choice);
         if (operation_result != 0)
         {
@@ -109,6 +1021,15 @@ int main(void)
             continue;
         }
 
+        /* Команды над всем архивом требуют записей всех запечатанных годов */
+        if (user_choice == 1 || user_choice == 3 || user_choice == 5 || user_choice == 8 ||
+            user_choice == 9 || user_choice == 10 || user_choice == 11 || user_choice == 12 ||
+            user_choice == 13 || user_choice == 14)
+        {
+            load_sealed_segments(photo_database, &photo_count, &archive_indexes,
+                ALL_YEARS_FIRST, ALL_YEARS_LAST);
+        }
+
         switch (user_choice)
         {
         case 1:
@@ -121,7 +1042,7 @@ int main(void)
             break;
 
         case 2:
-            operation_result = add_photo_record(photo_database, &photo_count);
+            operation_result = add_photo_record(photo_database, &photo_count, &archive_indexes);
             if (operation_result == 0)
             {
                 unsaved_changes = 1;
@@ -137,12 +1058,13 @@ int main(void)
         case 3:
         {
             char search_location[MAX_PLACE_LEN];
-            printf("Введите место съемки для поиска: ");
             clear_stdin_buffer();
-            fgets(search_location, MAX_PLACE_LEN, stdin);
-            search_location[strcspn(search_location, "\n")] = '\0';
+            read_text_with_completions(&archive_indexes, PHOTO_FIELD_place,
+                "Введите место съемки для поиска (? в конце - подсказки): ",
+                search_location, MAX_PLACE_LEN);
 
-            operation_result = find_photos_by_location(photo_database, photo_count, search_location);
+            operation_result = find_photos_by_location(photo_database, photo_count, search_location,
+                &archive_indexes);
             if (operation_result < 0)
             {
                 printf("Ошибка при поиске.\n");
@@ -159,6 +1081,11 @@ int main(void)
             printf("Введите дату для поиска (ГГГГ-ММ-ДД): ");
             clear_stdin_buffer();
             fgets(search_date, sizeof(search_date), stdin);
+            if (strchr(search_date, '\n') == NULL)
+            {
+                /* Дата заняла весь буфер - перевод строки остался во вводе */
+                clear_stdin_buffer();
+            }
             search_date[strcspn(search_date, "\n")] = '\0';
 
             if (validate_date_format(search_date) != 0)
@@ -168,12 +1095,16 @@ int main(void)
                 break;
             }
 
-            printf("Введите тег для поиска: ");
-            fgets(search_tag, sizeof(search_tag), stdin);
-            search_tag[strcspn(search_tag, "\n")] = '\0';
+            read_text_with_completions(&archive_indexes, PHOTO_FIELD_tags,
+                "Введите тег для поиска (? в конце - подсказки): ",
+                search_tag, sizeof(search_tag));
+
+            /* Загружается только год из запроса */
+            load_sealed_segments(photo_database, &photo_count, &archive_indexes,
+                parse_date_key(search_date) / 10000, parse_date_key(search_date) / 10000);
 
             operation_result = find_photos_by_date_and_tags(photo_database, photo_count,
-                search_date, search_tag);
+                search_date, search_tag, &archive_indexes);
             if (operation_result < 0)
             {
                 printf("Ошибка при поиске.\n");
@@ -183,10 +1114,13 @@ int main(void)
         break;
 
         case 5:
-            operation_result = sort_database_multi_level(photo_database, photo_count);
+            /* Сортируются только существующие записи */
+            compact_database(photo_database, &photo_count, &archive_indexes);
+            operation_result = sort_database_interactive(photo_database, photo_count);
             if (operation_result == 0)
             {
                 unsaved_changes = 1;
+                archive_indexes_on_reorder(&archive_indexes, photo_database, photo_count);
                 printf("Сортировка выполнена успешно.\n");
             }
             else
@@ -197,7 +1131,7 @@ int main(void)
             break;
 
         case 6:
-            operation_result = save_database_to_file(photo_database, photo_count);
+            operation_result = save_database_to_file(photo_database, photo_count, &archive_indexes);
             if (operation_result == 0)
             {
                 unsaved_changes = 0;
@@ -210,6 +1144,88 @@ int main(void)
             prompt_for_enter_key();
             break;
 
+        case 7:
+            print_query_cache_statistics(&archive_indexes.query_cache);
+            print_memory_statistics(&archive_indexes);
+            change_memory_budget_interactive(&archive_indexes, photo_database, photo_count);
+            prompt_for_enter_key();
+            break;
+
+        case 8:
+            operation_result = browse_records_by_pages(photo_database, photo_count);
+            if (operation_result != 0)
+            {
+                printf("Ошибка при постраничном просмотре.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 9:
+            operation_result = display_archive_statistics(&archive_indexes);
+            if (operation_result != 0)
+            {
+                printf("Ошибка при расчете статистики.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 10:
+            operation_result = export_database_interactive(photo_database, photo_count);
+            if (operation_result != 0)
+            {
+                printf("Ошибка при экспорте.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 11:
+            operation_result = update_photo_record(photo_database, photo_count, &archive_indexes);
+            if (operation_result == 0)
+            {
+                unsaved_changes = 1;
+                printf("Запись успешно изменена.\n");
+            }
+            else
+            {
+                printf("Запись не изменена.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 12:
+            operation_result = delete_photo_record(photo_database, photo_count, &archive_indexes);
+            if (operation_result == 0)
+            {
+                unsaved_changes = 1;
+                printf("Запись удалена.\n");
+            }
+            else
+            {
+                printf("Запись не удалена.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 13:
+            operation_result = find_photos_fuzzy_interactive(photo_database, photo_count,
+                &archive_indexes);
+            if (operation_result < 0)
+            {
+                printf("Ошибка при поиске.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
+        case 14:
+            operation_result = find_photos_by_dimensions_interactive(photo_database, photo_count,
+                &archive_indexes);
+            if (operation_result < 0)
+            {
+                printf("Ошибка при поиске.\n");
+            }
+            prompt_for_enter_key();
+            break;
+
         case 0:
             if (unsaved_changes != 0)
             {
@@ -222,7 +1238,7 @@ int main(void)
 
                 if (save_confirmation == 'y' || save_confirmation == 'Y')
                 {
-                    operation_result = save_database_to_file(photo_database, photo_count);
+                    operation_result = save_database_to_file(photo_database, photo_count, &archive_indexes);
                     if (operation_result == 0)
                     {
                         printf("Данные успешно сохранены.\n");
@@ -239,12 +1255,13 @@ int main(void)
             break;
 
         default:
-            printf("\nОшибка: Неверный выбор. Пожалуйста, введите число от 0 до 6.\n");
+            printf("\nОшибка: Неверный выбор. Пожалуйста, введите число от 0 до 14.\n");
             prompt_for_enter_key();
             break;
         }
     }
 
+    archive_indexes_release(&archive_indexes);
     return 0;
 }
 
@@ -283,41 +1300,64 @@ int initialize_program(void)
  * Возвращает: 0 при успешной загрузке, -1 при ошибке открытия файла
  ******************************************************************************/
 int load_database_from_file(Photo database[], int* record_count)
+{
+    *record_count = 0;
+    if (read_records_from_file(FILENAME, database, record_count, 0) != 0)
+    {
+        printf("Внимание: Не удалось загрузить данные из файла или файл не существует.\n");
+        printf("Будет создана новая база данных.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: read_records_from_file
+ *
+ * Описание: Читает записи из текстового файла и дописывает их в конец
+ *           массива (активный файл или файл запечатанного года).
+ *
+ * Параметры:
+ *   filename - имя файла
+ *   database - массив структур Photo
+ *   record_count - указатель на количество записей, увеличивается на
+ *                  число прочитанных
+ *   segment_year - год запечатанного раздела, 0 для активного файла
+ *
+ * Возвращает: 0 при успешном чтении, -1 при ошибке открытия файла
+ ******************************************************************************/
+int read_records_from_file(const char* filename, Photo database[], int* record_count,
+    int segment_year)
 {
     FILE* file_handle = NULL;
-    int records_loaded = 0;
+    char line[PHOTO_RECORD_LINE_LEN];
+    int records_loaded = *record_count;
 
-    file_handle = fopen(FILENAME, "r");
+    file_handle = fopen(filename, "r");
     if (file_handle == NULL)
     {
-        printf("Внимание: Не удалось загрузить данные из файла или файл не существует.\n");
-        printf("Будет создана новая база данных.\n");
-        *record_count = 0;
         return -1;
     }
 
-    while (records_loaded < MAX_PHOTOS)
+    while (records_loaded < MAX_PHOTOS && fgets(line, sizeof(line), file_handle) != NULL)
     {
-        int result = fscanf(file_handle, "%49[^|]|%10[^|]|%49[^|]|%29[^|]|%99[^|]|%lf|%d|%d|%9s",
-            database[records_loaded].name,
-            database[records_loaded].date,
-            database[records_loaded].place,
-            database[records_loaded].category,
-            database[records_loaded].tags,
-            &database[records_loaded].size,
-            &database[records_loaded].width,
-            &database[records_loaded].height,
-            database[records_loaded].format);
+        /* Пропускаем оставшуюся часть слишком длинной строки */
+        if (strchr(line, '\n') == NULL)
+        {
+            int ch;
+            while ((ch = fgetc(file_handle)) != '\n' && ch != EOF)
+                ;
+        }
 
-        if (result != 9)  /* Если не удалось прочитать все 9 полей */
+        if (parse_photo_record(line, &database[records_loaded]) != 0)  /* Если не удалось прочитать все поля */
             break;
 
+        photo_refresh_search_keys(&database[records_loaded]);
+        database[records_loaded].is_deleted = 0;
+        database[records_loaded].version = 0;
+        database[records_loaded].segment_year = segment_year;
         records_loaded++;
-
-        /* Пропускаем оставшуюся часть строки (символ новой строки или пробелы) */
-        int ch;
-        while ((ch = fgetc(file_handle)) != '\n' && ch != EOF)
-            ;
     }
 
     fclose(file_handle);
@@ -328,38 +1368,77 @@ int load_database_from_file(Photo database[], int* record_count)
 /******************************************************************************
  * Функция: save_database_to_file
  *
- * Описание: Сохраняет данные о фотографиях в текстовый файл.
+ * Описание: Сохраняет данные о фотографиях. Сначала запечатываются старые
+ *           годы (их записи переносятся в отдельные файлы), затем
+ *           сохраняется перечень разделов и только после этого в основной
+ *           файл записываются остальные записи, рядом - индексы поиска (их
+ *           фоновое построение при этом завершается). Если перечень
+ *           записать не удалось, основной файл не трогается: иначе записи
+ *           нового раздела пропали бы из обоих файлов. Файлы уже
+ *           запечатанных годов не перезаписываются.
  *
  * Параметры:
  *   database - массив структур Photo для сохранения
  *   record_count - количество записей для сохранения
+ *   indexes - вспомогательные структуры архива (перечень разделов)
  *
  * Возвращает: 0 при успешном сохранении, -1 при ошибке открытия файла
  ******************************************************************************/
-int save_database_to_file(const Photo database[], int record_count)
+int save_database_to_file(Photo database[], int record_count, ArchiveIndexes* indexes)
+{
+    if (seal_old_years(database, record_count, indexes) < 0 ||
+        segment_directory_save(&indexes->segments) != 0 ||
+        write_records_to_file(FILENAME, database, record_count, 0) != 0)
+    {
+        return -1;
+    }
+
+    /* Незавершенное фоновое построение доводится до конца, чтобы файл
+       индексов описывал весь сохраненный архив */
+    search_indexes_rebuild_step(indexes, database, record_count, 0);
+    if (search_indexes_save(indexes, database, record_count) < 0)
+    {
+        printf("Внимание: Не удалось сохранить индексы поиска в файл '%s'.\n", INDEX_FILENAME);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: write_records_to_file
+ *
+ * Описание: Записывает в текстовый файл существующие записи указанного
+ *           раздела.
+ *
+ * Параметры:
+ *   filename - имя файла
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   segment_year - год запечатанного раздела, 0 для активного файла
+ *
+ * Возвращает: 0 при успешной записи, -1 при ошибке
+ ******************************************************************************/
+int write_records_to_file(const char* filename, const Photo database[], int record_count,
+    int segment_year)
 {
     FILE* file_handle = NULL;
     int i = 0;
 
-    file_handle = fopen(FILENAME, "w");
+    file_handle = fopen(filename, "w");
     if (file_handle == NULL)
     {
-        printf("Ошибка: Не удалось открыть файл '%s' для записи.\n", FILENAME);
+        printf("Ошибка: Не удалось открыть файл '%s' для записи.\n", filename);
         return -1;
     }
 
     for (i = 0; i < record_count; i++)
     {
-        if (fprintf(file_handle, "%s|%s|%s|%s|%s|%.2f|%d|%d|%s\n",
-            database[i].name,
-            database[i].date,
-            database[i].place,
-            database[i].category,
-            database[i].tags,
-            database[i].size,
-            database[i].width,
-            database[i].height,
-            database[i].format) < 0)
+        if (database[i].is_deleted || database[i].segment_year != segment_year)
+        {
+            continue;
+        }
+
+        if (write_photo_record(file_handle, &database[i]) != 0)
         {
             fclose(file_handle);
             printf("Ошибка записи в файл.\n");
@@ -375,45 +1454,26 @@ int save_database_to_file(const Photo database[], int record_count)
  * Функция: display_all_records
  *
  * Описание: Выводит на экран все записи о фотографиях в табличном формате.
+ *           Строки таблицы форматируются в буфер и выводятся крупными блоками.
  *
  * Параметры:
  *   database - массив структур Photo для вывода
  *   record_count - количество записей для вывода
  *
- * Возвращает: 0 при успешном выводе, -1 если база данных пуста
+ * Возвращает: 0 при успешном выводе, -1 если база данных пуста или
+ *             при ошибке вывода
  ******************************************************************************/
 int display_all_records(const Photo database[], int record_count)
 {
-    int i = 0;
-
     if (record_count <= 0)
     {
         printf("База данных пуста.\n");
         return -1;
     }
 
-    printf("\nВсего фотографий в базе: %d\n\n", record_count);
-    print_horizontal_separator();
-    printf("№  Название          Дата       Место          Категория   Размер   Разрешение Формат\n");
-    print_horizontal_separator();
-
-    for (i = 0; i < record_count; i++)
-    {
-        printf("%-3d%-17.17s%-12s%-15.15s%-12.12s%-8.2f  %dx%d   %s\n",
-            i + 1,
-            database[i].name,
-            database[i].date,
-            database[i].place,
-            database[i].category,
-            database[i].size,
-            database[i].width,
-            database[i].height,
-            database[i].format);
-    }
-
-    print_horizontal_separator();
-    return 0;
-}
+    printf("\nВсего фотографий в базе: %d\n\n", count_live_records(database, record_count));
+    return export_database(database, record_count, EXPORT_FORMAT_TABLE, stdout);
+}
 
 /******************************************************************************
  * Функция: add_photo_record
@@ -423,16 +1483,19 @@ int display_all_records(const Photo database[], int record_count)
  * Параметры:
  *   database - массив структур Photo
  *   record_count - указатель на переменную с текущим количеством записей
+ *   indexes - вспомогательные структуры архива (свободные ячейки, индексы)
  *
  * Возвращает: 0 при успешном добавлении, -1 при ошибке
  ******************************************************************************/
-int add_photo_record(Photo database[], int* record_count)
+int add_photo_record(Photo database[], int* record_count, ArchiveIndexes* indexes)
 {
     Photo new_photo_record;
     int input_status = 0;
+    int record_index = 0;
     char size_input[50];  /* Буфер для ввода размера как строки */
+    char prompt[160];     /* Приглашение с допустимой длиной поля */
 
-    if (*record_count >= MAX_PHOTOS)
+    if (*record_count >= MAX_PHOTOS && indexes->free_slots.count == 0)
     {
         printf("Ошибка: Достигнуто максимальное количество записей (%d).\n", MAX_PHOTOS);
         return -1;
@@ -450,6 +1513,11 @@ int add_photo_record(Photo database[], int* record_count)
     do {
         printf("Введите дату съемки (ГГГГ-ММ-ДД): ");
         fgets(new_photo_record.date, sizeof(new_photo_record.date), stdin);
+        if (strchr(new_photo_record.date, '\n') == NULL)
+        {
+            /* Дата заняла весь буфер - перевод строки остался во вводе */
+            clear_stdin_buffer();
+        }
         new_photo_record.date[strcspn(new_photo_record.date, "\n")] = '\0';
 
         if (validate_date_format(new_photo_record.date) != 0)
@@ -458,20 +1526,22 @@ int add_photo_record(Photo database[], int* record_count)
         }
     } while (validate_date_format(new_photo_record.date) != 0);
 
-    /* Ввод места съемки */
-    printf("Введите место съемки (до %d символов): ", MAX_PLACE_LEN - 1);
-    fgets(new_photo_record.place, MAX_PLACE_LEN, stdin);
-    new_photo_record.place[strcspn(new_photo_record.place, "\n")] = '\0';
+    /* Ввод места съемки, категории и тегов; "?" в конце показывает уже
+       встречавшиеся значения, чтобы одно значение не вводилось по-разному */
+    snprintf(prompt, sizeof(prompt), "Введите место съемки (до %d символов, ? - подсказки): ",
+        MAX_PLACE_LEN - 1);
+    read_text_with_completions(indexes, PHOTO_FIELD_place, prompt,
+        new_photo_record.place, MAX_PLACE_LEN);
 
-    /* Ввод категории */
-    printf("Введите категорию (до %d символов): ", MAX_CATEGORY_LEN - 1);
-    fgets(new_photo_record.category, MAX_CATEGORY_LEN, stdin);
-    new_photo_record.category[strcspn(new_photo_record.category, "\n")] = '\0';
+    snprintf(prompt, sizeof(prompt), "Введите категорию (до %d символов, ? - подсказки): ",
+        MAX_CATEGORY_LEN - 1);
+    read_text_with_completions(indexes, PHOTO_FIELD_category, prompt,
+        new_photo_record.category, MAX_CATEGORY_LEN);
 
-    /* Ввод теги */
-    printf("Введите теги через запятую (до %d символов): ", MAX_TAGS_LEN - 1);
-    fgets(new_photo_record.tags, MAX_TAGS_LEN, stdin);
-    new_photo_record.tags[strcspn(new_photo_record.tags, "\n")] = '\0';
+    snprintf(prompt, sizeof(prompt), "Введите теги через запятую (до %d символов, ? - подсказки): ",
+        MAX_TAGS_LEN - 1);
+    read_text_with_completions(indexes, PHOTO_FIELD_tags, prompt,
+        new_photo_record.tags, MAX_TAGS_LEN);
 
     /* Ввод размера файла с проверкой - используем строку и заменяем запятую на точку */
     do {
@@ -543,460 +1613,11449 @@ int add_photo_record(Photo database[], int* record_count)
     fgets(new_photo_record.format, MAX_FORMAT_LEN, stdin);
     new_photo_record.format[strcspn(new_photo_record.format, "\n")] = '\0';
 
-    /* Добавление новой фотографии в массив */
-    database[*record_count] = new_photo_record;
-    (*record_count)++;
+    /* Добавление новой фотографии в свободную ячейку или в конец массива */
+    photo_refresh_search_keys(&new_photo_record);
+    new_photo_record.is_deleted = 0;
+    new_photo_record.version = 0;
+    new_photo_record.segment_year = 0;
+    record_index = allocate_record_slot(indexes, record_count);
+    database[record_index] = new_photo_record;
+
+    if (archive_indexes_on_insert(indexes, database, record_index) != 0)
+    {
+        printf("Внимание: Недостаточно памяти для обновления индексов.\n");
+    }
 
     return 0;
 }
-
 /******************************************************************************
- * Функция: find_photos_by_location
+ * Функция: count_live_records
  *
- * Описание: Выполняет поиск фотографий по месту съемки.
+ * Описание: Подсчитывает записи, не помеченные как удаленные.
  *
  * Параметры:
- *   database - массив структур Photo для поиска
- *   record_count - количество записей в массиве
- *   location - строка с местом для поиска
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
  *
- * Возвращает: количество найденных фотографий, -1 если база данных пуста
+ * Возвращает: количество существующих записей
  ******************************************************************************/
-int find_photos_by_location(const Photo database[], int record_count, const char* location)
+int count_live_records(const Photo database[], int record_count)
 {
+    int live_count = 0;
     int i = 0;
-    int found_records = 0;
-
-    if (record_count <= 0)
-    {
-        printf("База данных пуста.\n");
-        return -1;
-    }
-
-    if (location == NULL || strlen(location) == 0)
-    {
-        printf("Ошибка: Не задано место для поиска.\n");
-        return -1;
-    }
-
-    printf("\nРезультаты поиска для места: '%s'\n", location);
-    print_horizontal_separator();
 
     for (i = 0; i < record_count; i++)
     {
-        /* Поиск подстроки (регистрозависимый) */
-        if (strstr(database[i].place, location) != NULL)
+        if (!database[i].is_deleted)
         {
-            printf("%d. %s (Дата: %s, Категория: %s)\n",
-                found_records + 1,
-                database[i].name,
-                database[i].date,
-                database[i].category);
-            found_records++;
+            live_count++;
         }
     }
 
-    print_horizontal_separator();
-
-    if (found_records == 0)
-    {
-        printf("Фотографии с указанным местом съемки не найдены.\n");
-    }
-    else
-    {
-        printf("\nНайдено фотографий: %d\n", found_records);
-    }
-
-    return found_records;
+    return live_count;
 }
 
 /******************************************************************************
- * Функция: find_photos_by_date_and_tags
+ * Функция: free_slot_list_push
  *
- * Описание: Выполняет комбинированный поиск по дате и тегам.
+ * Описание: Помещает ячейку удаленной записи в список свободных.
  *
  * Параметры:
- *   database - массив структур Photo для поиска
- *   record_count - количество записей в массиве
- *   date - дата для поиска (формат ГГГГ-ММ-ДД)
- *   tag - тег для поиска
+ *   list - список свободных ячеек
+ *   record_index - индекс освобожденной ячейки
  *
- * Возвращает: количество найденных фотографий, -1 при ошибке
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
  ******************************************************************************/
-int find_photos_by_date_and_tags(const Photo database[], int record_count,
-    const char* date, const char* tag)
+int free_slot_list_push(FreeSlotList* list, int record_index)
 {
-    int i = 0;
-    int found_records = 0;
-
-    if (record_count <= 0)
-    {
-        printf("База данных пуста.\n");
-        return -1;
-    }
-
-    if (date == NULL || tag == NULL)
-    {
-        printf("Ошибка: Не заданы параметры поиска.\n");
-        return -1;
-    }
+    int previous_subsystem = memory_enter(MEMORY_RECORDS);
 
-    if (validate_date_format(date) != 0)
+    if (list->count == list->capacity)
     {
-        printf("Ошибка: Неверный формат даты.\n");
-        return -1;
+        int new_capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+        if (grow_array((void**)&list->slots, sizeof(int), new_capacity) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+        list->capacity = new_capacity;
     }
 
-    printf("\nРезультаты поиска для даты '%s' и тега '%s':\n", date, tag);
-    print_horizontal_separator();
+    list->slots[list->count++] = record_index;
+    return 0;
+}
 
-    for (i = 0; i < record_count; i++)
+/******************************************************************************
+ * Функция: allocate_record_slot
+ *
+ * Описание: Выбирает ячейку для новой записи. Сначала повторно используется
+ *           ячейка из списка свободных, иначе запись добавляется в конец.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   record_count - указатель на количество занятых ячеек массива
+ *
+ * Возвращает: индекс ячейки, -1 если свободных ячеек нет
+ ******************************************************************************/
+int allocate_record_slot(ArchiveIndexes* indexes, int* record_count)
+{
+    if (indexes->free_slots.count > 0)
     {
-        if (strcmp(database[i].date, date) == 0 &&
-            strstr(database[i].tags, tag) != NULL)
-        {
-            printf("%d. %s (Место: %s, Категория: %s)\n",
-                found_records + 1,
-                database[i].name,
-                database[i].place,
-                database[i].category);
-            printf("   Теги: %s\n", database[i].tags);
-            printf("   Разрешение: %dx%d, Размер: %.2f МБ\n",
-                database[i].width,
-                database[i].height,
-                database[i].size);
-            print_horizontal_separator();
-            found_records++;
-        }
+        return indexes->free_slots.slots[--indexes->free_slots.count];
     }
 
-    if (found_records == 0)
-    {
-        printf("Фотографии с указанной датой и тегом не найдены.\n");
-    }
-    else
+    if (*record_count >= MAX_PHOTOS)
     {
-        printf("\nНайдено фотографий: %d\n", found_records);
+        return -1;
     }
 
-    return found_records;
+    return (*record_count)++;
 }
 
 /******************************************************************************
- * Функция: sort_database_multi_level
+ * Функция: select_record_by_number
  *
- * Описание: Выполняет многоуровневую сортировку фотографий по дате,
- *           категории и разрешению (ширина × высота).
+ * Описание: Запрашивает у пользователя номер записи (как в таблице
+ *           просмотра) и проверяет, что запись существует.
  *
  * Параметры:
- *   database - массив структур Photo для сортировки
- *   record_count - количество записей в массиве
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
  *
- * Возвращает: 0 при успешной сортировке, -1 при ошибке
+ * Возвращает: индекс записи, -1 при ошибке ввода
  ******************************************************************************/
-int sort_database_multi_level(Photo database[], int record_count)
+int select_record_by_number(const Photo database[], int record_count)
 {
-    if (record_count <= 1)
+    int record_number = 0;
+    int input_result = 0;
+
+    if (count_live_records(database, record_count) == 0)
     {
-        printf("Нечего сортировать. В базе данных %d записей.\n", record_count);
+        printf("База данных пуста.\n");
         return -1;
     }
 
-    qsort(database, record_count, sizeof(Photo), compare_photos_for_sorting);
-    return 0;
+    printf("Введите номер записи (1-%d): ", record_count);
+    input_result = scanf("%d", &record_number);
+    clear_stdin_buffer();
+
+    if (input_result != 1 || record_number < 1 || record_number > record_count ||
+        database[record_number - 1].is_deleted)
+    {
+        printf("Ошибка: Записи с таким номером нет.\n");
+        return -1;
+    }
+
+    return record_number - 1;
 }
 
 /******************************************************************************
- * Функция: compare_photos_for_sorting
+ * Функция: read_edit_line
  *
- * Описание: Функция сравнения для qsort. Сравнивает фотографии по дате,
- *           затем по категории, затем по разрешению (произведение ширины на высоту).
+ * Описание: Выводит текущее значение поля и читает новое. Пустой ввод
+ *           оставляет текущее значение.
  *
  * Параметры:
- *   first_photo - указатель на первую фотографию
- *   second_photo - указатель на вторую фотографию
+ *   label - название поля
+ *   current_value - текущее значение
+ *   buffer - буфер для нового значения
+ *   buffer_size - размер буфера
  *
- * Возвращает: отрицательное число если first < second,
- *             0 если first == second,
- *             положительное если first > second
+ * Возвращает: 1 если значение изменено, 0 если оставлено прежним
  ******************************************************************************/
-int compare_photos_for_sorting(const void* first_photo, const void* second_photo)
+int read_edit_line(const char* label, const char* current_value, char* buffer, size_t buffer_size)
 {
-    const Photo* photo_a = (const Photo*)first_photo;
-    const Photo* photo_b = (const Photo*)second_photo;
-    int date_comparison = 0;
-    int category_comparison = 0;
-    int resolution_a = 0;
-    int resolution_b = 0;
-
-    /* Сравнение по дате */
-    date_comparison = strcmp(photo_a->date, photo_b->date);
-    if (date_comparison != 0)
+    printf("%s [%s]: ", label, current_value);
+    if (fgets(buffer, (int)buffer_size, stdin) == NULL)
     {
-        return date_comparison;
+        buffer[0] = '\0';
     }
-
-    /* Если даты равны, сравнение по категории */
-    category_comparison = strcmp(photo_a->category, photo_b->category);
-    if (category_comparison != 0)
+    else if (strchr(buffer, '\n') == NULL)
     {
-        return category_comparison;
+        clear_stdin_buffer();
     }
+    buffer[strcspn(buffer, "\n")] = '\0';
 
-    /* Если категории равны, сравнение по разрешению */
-    resolution_a = photo_a->width * photo_a->height;
-    resolution_b = photo_b->width * photo_b->height;
+    if (buffer[0] == '\0')
+    {
+        strncpy(buffer, current_value, buffer_size - 1);
+        buffer[buffer_size - 1] = '\0';
+        return 0;
+    }
 
-    return resolution_a - resolution_b;
+    return 1;
 }
 
 /******************************************************************************
- * Функция: display_main_menu
+ * Функция: update_photo_record
  *
- * Описание: Выводит на экран главное меню программы и получает выбор пользователя.
+ * Описание: Изменяет существующую запись на месте. Для каждого поля
+ *           выводится текущее значение; Enter оставляет его без изменений.
+ *           Вспомогательные структуры обновляются только для этой записи.
  *
  * Параметры:
- *   user_selection - указатель на переменную для хранения выбора пользователя
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
  *
- * Возвращает: 0 при успешном отображении, -1 при ошибке
+ * Возвращает: 0 при успешном изменении, -1 при ошибке
  ******************************************************************************/
-int display_main_menu(int* user_selection)
+int update_photo_record(Photo database[], int record_count, ArchiveIndexes* indexes)
 {
-    int menu_selection = 0;
+    Photo old_photo;
+    Photo* photo = NULL;
+    char value[MAX_TAGS_LEN];
+    char current[50];
+    char* end_pointer = NULL;
+    int record_index = 0;
+    int i = 0;
 
-    if (user_selection == NULL)
+    record_index = select_record_by_number(database, record_count);
+    if (record_index < 0)
     {
         return -1;
     }
 
-    system("cls");
-    printf("\n");
-    print_horizontal_separator();
-    printf("          ГЛАВНОЕ МЕНЮ ФОТОАРХИВА          \n");
-    print_horizontal_separator();
-    printf("1. Просмотр всех фотографий\n");
-    printf("2. Добавить новую фотографию\n");
-    printf("3. Поиск по месту съемки\n");
-    printf("4. Комбинированный поиск (дата + теги)\n");
-    printf("5. Многоуровневая сортировка\n");
-    printf("6. Сохранить изменения в файл\n");
-    printf("0. Выход из программы\n");
-    print_horizontal_separator();
-    printf("\nВыберите действие (0-6): ");
-
-    if (get_menu_selection(&menu_selection) != 0)
+    if (check_record_writable(&database[record_index]) != 0)
     {
         return -1;
     }
 
-    *user_selection = menu_selection;
+    photo = &database[record_index];
+    old_photo = *photo;
+    show_photo_information(photo);
+    printf("\nВведите новые значения (Enter - оставить текущее):\n\n");
+
+    read_edit_line("Название", old_photo.name, photo->name, sizeof(photo->name));
+
+    do {
+        read_edit_line("Дата съемки (ГГГГ-ММ-ДД)", old_photo.date, value, sizeof(photo->date));
+        if (validate_date_format(value) != 0)
+        {
+            printf("Ошибка: Неверный формат даты. Используйте ГГГГ-ММ-ДД\n");
+        }
+    } while (validate_date_format(value) != 0);
+    strcpy(photo->date, value);
+
+    read_edit_line("Место съемки", old_photo.place, photo->place, sizeof(photo->place));
+    read_edit_line("Категория", old_photo.category, photo->category, sizeof(photo->category));
+    read_edit_line("Теги", old_photo.tags, photo->tags, sizeof(photo->tags));
+
+    snprintf(current, sizeof(current), "%.2f", old_photo.size);
+    do {
+        if (read_edit_line("Размер файла в МБ", current, value, sizeof(current)) == 0)
+        {
+            photo->size = old_photo.size;
+            break;
+        }
+
+        for (i = 0; value[i] != '\0'; i++)
+        {
+            if (value[i] == ',')
+            {
+                value[i] = '.';
+            }
+        }
+        photo->size = strtod(value, &end_pointer);
+        if (end_pointer == value || *end_pointer != '\0' || validate_positive_number(photo->size) != 0)
+        {
+            printf("Ошибка: Размер должен быть положительным числом.\n");
+            continue;
+        }
+        break;
+    } while (1);
+
+    snprintf(current, sizeof(current), "%d", old_photo.width);
+    do {
+        if (read_edit_line("Ширина в пикселях", current, value, sizeof(current)) == 0)
+        {
+            photo->width = old_photo.width;
+            break;
+        }
+
+        photo->width = (int)strtol(value, &end_pointer, 10);
+        if (*end_pointer != '\0' || validate_positive_integer(photo->width) != 0)
+        {
+            printf("Ошибка: Ширина должна быть положительным целым числом.\n");
+            continue;
+        }
+        break;
+    } while (1);
+
+    snprintf(current, sizeof(current), "%d", old_photo.height);
+    do {
+        if (read_edit_line("Высота в пикселях", current, value, sizeof(current)) == 0)
+        {
+            photo->height = old_photo.height;
+            break;
+        }
+
+        photo->height = (int)strtol(value, &end_pointer, 10);
+        if (*end_pointer != '\0' || validate_positive_integer(photo->height) != 0)
+        {
+            printf("Ошибка: Высота должна быть положительным целым числом.\n");
+            continue;
+        }
+        break;
+    } while (1);
+
+    read_edit_line("Формат файла", old_photo.format, photo->format, sizeof(photo->format));
+
+    photo_refresh_search_keys(photo);
+    photo->version = old_photo.version + 1;
+
+    if (archive_indexes_on_update(indexes, database, record_index, &old_photo) != 0)
+    {
+        printf("Внимание: Недостаточно памяти для обновления индексов.\n");
+    }
+
     return 0;
 }
 
 /******************************************************************************
- * Функция: get_menu_selection
+ * Функция: delete_photo_record
  *
- * Описание: Получает выбор пользователя из меню.
+ * Описание: Помечает запись как удаленную (надгробие). Ячейка попадает в
+ *           список свободных и повторно используется при добавлении, а
+ *           массив уплотняется, когда удаленных записей становится много.
  *
  * Параметры:
- *   selection - указатель на переменную для хранения выбора
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
  *
- * Возвращает: 0 при успешном получении, -1 при ошибке
+ * Возвращает: 0 при успешном удалении, -1 при ошибке или отказе
  ******************************************************************************/
-int get_menu_selection(int* selection)
+int delete_photo_record(Photo database[], int record_count, ArchiveIndexes* indexes)
 {
-    int input_result = 0;
+    Photo old_photo;
+    char answer[10];
+    int record_index = 0;
 
-    if (selection == NULL)
+    record_index = select_record_by_number(database, record_count);
+    if (record_index < 0)
     {
         return -1;
     }
 
-    input_result = scanf("%d", selection);
-    clear_stdin_buffer();
+    if (check_record_writable(&database[record_index]) != 0)
+    {
+        return -1;
+    }
 
-    if (input_result != 1)
+    show_photo_information(&database[record_index]);
+    printf("\nУдалить эту запись? (y/n): ");
+    if (fgets(answer, sizeof(answer), stdin) == NULL || (answer[0] != 'y' && answer[0] != 'Y'))
     {
-        *selection = -1;
         return -1;
     }
 
+    old_photo = database[record_index];
+    database[record_index].is_deleted = 1;
+    database[record_index].version++;
+
+    if (archive_indexes_on_delete(indexes, &old_photo, record_index) != 0)
+    {
+        printf("Внимание: Недостаточно памяти для обновления индексов.\n");
+    }
+
     return 0;
 }
 
 /******************************************************************************
- * Функция: clear_stdin_buffer
+ * Функция: archive_needs_compaction
  *
- * Описание: Очищает буфер ввода стандартного потока.
+ * Описание: Проверяет, накопилось ли достаточно удаленных записей, чтобы
+ *           уплотнение массива окупилось.
  *
- * Возвращает: количество очищенных символов
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   record_count - количество занятых ячеек массива
+ *
+ * Возвращает: 1 если нужно уплотнение, 0 если нет
  ******************************************************************************/
-int clear_stdin_buffer(void)
+int archive_needs_compaction(const ArchiveIndexes* indexes, int record_count)
 {
-    int character = 0;
-    int cleared_count = 0;
-
-    while ((character = getchar()) != '\n' && character != EOF)
-    {
-        cleared_count++;
-    }
+    int deleted_count = indexes->free_slots.count;
 
-    return cleared_count;
+    return deleted_count >= COMPACTION_MIN_DEAD &&
+        deleted_count * 100 >= record_count * COMPACTION_DEAD_PERCENT;
+}
+
+/******************************************************************************
+ * Функция: compact_database
+ *
+ * Описание: Удаляет надгробия, сдвигая существующие записи к началу массива
+ *           с сохранением их порядка, и перестраивает вспомогательные
+ *           структуры, зависящие от номеров записей.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - указатель на количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество удаленных ячеек, -1 при нехватке памяти
+ ******************************************************************************/
+int compact_database(Photo database[], int* record_count, ArchiveIndexes* indexes)
+{
+    int removed_count = 0;
+    int write_index = 0;
+    int i = 0;
+
+    if (indexes->free_slots.count == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < *record_count; i++)
+    {
+        if (!database[i].is_deleted)
+        {
+            if (write_index != i)
+            {
+                database[write_index] = database[i];
+            }
+            write_index++;
+        }
+    }
+
+    removed_count = *record_count - write_index;
+    *record_count = write_index;
+    indexes->free_slots.count = 0;
+    indexes->free_slots.compaction_count++;
+
+    if (archive_indexes_on_reorder(indexes, database, *record_count) != 0)
+    {
+        return -1;
+    }
+
+    return removed_count;
+}
+
+/******************************************************************************
+ * Функция: find_photos_by_location
+ *
+ * Описание: Выполняет поиск фотографий по месту съемки.
+ *
+ * Параметры:
+ *   database - массив структур Photo для поиска
+ *   record_count - количество записей в массиве
+ *   location - строка с местом для поиска (регистр не учитывается)
+ *   indexes - кэш и индексы поиска
+ *
+ * Возвращает: количество найденных фотографий, -1 если база данных пуста
+ ******************************************************************************/
+int find_photos_by_location(const Photo database[], int record_count, const char* location,
+    ArchiveIndexes* indexes)
+{
+    int i = 0;
+    int found_records = 0;
+    const int* record_indices = NULL;
+    char search_text[MAX_TAGS_LEN];
+    char folded_text[MAX_TAGS_LEN];
+
+    if (record_count <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    if (location == NULL || normalize_query_text(location, search_text, sizeof(search_text)) == 0)
+    {
+        printf("Ошибка: Не задано место для поиска.\n");
+        return -1;
+    }
+
+    fold_search_text(search_text, folded_text, sizeof(folded_text));
+    found_records = collect_query_results(database, record_count, QUERY_KIND_LOCATION,
+        "", folded_text, indexes, &record_indices);
+    if (found_records < 0)
+    {
+        printf("Ошибка: Недостаточно памяти для поиска.\n");
+        return -1;
+    }
+
+    printf("\nРезультаты поиска для места: '%s'\n", search_text);
+    print_horizontal_separator();
+
+    for (i = 0; i < found_records; i++)
+    {
+        const Photo* photo = &database[record_indices[i]];
+        printf("%d. %s (Дата: %s, Категория: %s)\n",
+            i + 1,
+            photo->name,
+            photo->date,
+            photo->category);
+    }
+
+    print_horizontal_separator();
+
+    if (found_records == 0)
+    {
+        printf("Фотографии с указанным местом съемки не найдены.\n");
+        suggest_similar_places(database, folded_text, indexes);
+    }
+    else
+    {
+        printf("\nНайдено фотографий: %d\n", found_records);
+    }
+
+    return found_records;
+}
+
+/******************************************************************************
+ * Функция: find_photos_by_date_and_tags
+ *
+ * Описание: Выполняет комбинированный поиск по дате и тегам.
+ *
+ * Параметры:
+ *   database - массив структур Photo для поиска
+ *   record_count - количество записей в массиве
+ *   date - дата для поиска (формат ГГГГ-ММ-ДД)
+ *   tag - тег для поиска (регистр не учитывается)
+ *   indexes - кэш и индексы поиска
+ *
+ * Возвращает: количество найденных фотографий, -1 при ошибке
+ ******************************************************************************/
+int find_photos_by_date_and_tags(const Photo database[], int record_count,
+    const char* date, const char* tag, ArchiveIndexes* indexes)
+{
+    int i = 0;
+    int found_records = 0;
+    const int* record_indices = NULL;
+    char search_text[MAX_TAGS_LEN];
+    char folded_text[MAX_TAGS_LEN];
+
+    if (record_count <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    if (date == NULL || tag == NULL)
+    {
+        printf("Ошибка: Не заданы параметры поиска.\n");
+        return -1;
+    }
+
+    if (validate_date_format(date) != 0)
+    {
+        printf("Ошибка: Неверный формат даты.\n");
+        return -1;
+    }
+
+    normalize_query_text(tag, search_text, sizeof(search_text));
+    fold_search_text(search_text, folded_text, sizeof(folded_text));
+
+    found_records = collect_query_results(database, record_count, QUERY_KIND_DATE_AND_TAG,
+        date, folded_text, indexes, &record_indices);
+    if (found_records < 0)
+    {
+        printf("Ошибка: Недостаточно памяти для поиска.\n");
+        return -1;
+    }
+
+    printf("\nРезультаты поиска для даты '%s' и тега '%s':\n", date, search_text);
+    print_horizontal_separator();
+
+    for (i = 0; i < found_records; i++)
+    {
+        const Photo* photo = &database[record_indices[i]];
+        printf("%d. %s (Место: %s, Категория: %s)\n",
+            i + 1,
+            photo->name,
+            photo->place,
+            photo->category);
+        printf("   Теги: %s\n", photo->tags);
+        printf("   Разрешение: %dx%d, Размер: %.2f МБ\n",
+            photo->width,
+            photo->height,
+            photo->size);
+        print_horizontal_separator();
+    }
+
+    if (found_records == 0)
+    {
+        printf("Фотографии с указанной датой и тегом не найдены.\n");
+    }
+    else
+    {
+        printf("\nНайдено фотографий: %d\n", found_records);
+    }
+
+    return found_records;
+}
+
+/******************************************************************************
+ * Функция: sort_database_multi_level
+ *
+ * Описание: Выполняет многоуровневую сортировку фотографий по дате,
+ *           категории и разрешению (ширина × высота).
+ *
+ * Параметры:
+ *   database - массив структур Photo для сортировки
+ *   record_count - количество записей в массиве
+ *
+ * Возвращает: 0 при успешной сортировке, -1 при ошибке
+ ******************************************************************************/
+int sort_database_multi_level(Photo database[], int record_count)
+{
+    if (record_count <= 1)
+    {
+        printf("Нечего сортировать. В базе данных %d записей.\n", record_count);
+        return -1;
+    }
+
+    qsort(database, record_count, sizeof(Photo), compare_photos_for_sorting);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: compare_photos_for_sorting
+ *
+ * Описание: Функция сравнения для qsort. Сравнивает фотографии по дате,
+ *           затем по категории, затем по разрешению (произведение ширины на высоту).
+ *
+ * Параметры:
+ *   first_photo - указатель на первую фотографию
+ *   second_photo - указатель на вторую фотографию
+ *
+ * Возвращает: отрицательное число если first < second,
+ *             0 если first == second,
+ *             положительное если first > second
+ ******************************************************************************/
+int compare_photos_for_sorting(const void* first_photo, const void* second_photo)
+{
+    const Photo* photo_a = (const Photo*)first_photo;
+    const Photo* photo_b = (const Photo*)second_photo;
+    int date_comparison = 0;
+    int category_comparison = 0;
+    int resolution_a = 0;
+    int resolution_b = 0;
+
+    /* Сравнение по дате */
+    date_comparison = strcmp(photo_a->date, photo_b->date);
+    if (date_comparison != 0)
+    {
+        return date_comparison;
+    }
+
+    /* Если даты равны, сравнение по категории */
+    category_comparison = strcmp(photo_a->category, photo_b->category);
+    if (category_comparison != 0)
+    {
+        return category_comparison;
+    }
+
+    /* Если категории равны, сравнение по разрешению */
+    resolution_a = photo_a->width * photo_a->height;
+    resolution_b = photo_b->width * photo_b->height;
+
+    return resolution_a - resolution_b;
+}
+
+/******************************************************************************
+ * Функция: display_main_menu
+ *
+ * Описание: Выводит на экран главное меню программы и получает выбор пользователя.
+ *
+ * Параметры:
+ *   user_selection - указатель на переменную для хранения выбора пользователя
+ *
+ * Возвращает: 0 при успешном отображении, -1 при ошибке
+ ******************************************************************************/
+int display_main_menu(int* user_selection)
+{
+    int menu_selection = 0;
+
+    if (user_selection == NULL)
+    {
+        return -1;
+    }
+
+    system("cls");
+    printf("\n");
+    print_horizontal_separator();
+    printf("          ГЛАВНОЕ МЕНЮ ФОТОАРХИВА          \n");
+    print_horizontal_separator();
+    printf("1. Просмотр всех фотографий\n");
+    printf("2. Добавить новую фотографию\n");
+    printf("3. Поиск по месту съемки\n");
+    printf("4. Комбинированный поиск (дата + теги)\n");
+    printf("5. Многоуровневая сортировка\n");
+    printf("6. Сохранить изменения в файл\n");
+    printf("7. Статистика кэша и памяти\n");
+    printf("8. Постраничный просмотр с сортировкой\n");
+    printf("9. Статистика архива (группировка)\n");
+    printf("10. Экспорт (таблица, CSV, JSON Lines)\n");
+    printf("11. Изменить запись\n");
+    printf("12. Удалить запись\n");
+    printf("13. Нечеткий поиск по названию и месту\n");
+    printf("14. Поиск по размерам и пропорциям кадра\n");
+    printf("0. Выход из программы\n");
+    print_horizontal_separator();
+    printf("\nВыберите действие (0-14): ");
+
+    if (get_menu_selection(&menu_selection) != 0)
+    {
+        return -1;
+    }
+
+    *user_selection = menu_selection;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: get_menu_selection
+ *
+ * Описание: Получает выбор пользователя из меню.
+ *
+ * Параметры:
+ *   selection - указатель на переменную для хранения выбора
+ *
+ * Возвращает: 0 при успешном получении, -1 при ошибке
+ ******************************************************************************/
+int get_menu_selection(int* selection)
+{
+    int input_result = 0;
+
+    if (selection == NULL)
+    {
+        return -1;
+    }
+
+    input_result = scanf("%d", selection);
+    clear_stdin_buffer();
+
+    if (input_result != 1)
+    {
+        *selection = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: clear_stdin_buffer
+ *
+ * Описание: Очищает буфер ввода стандартного потока.
+ *
+ * Возвращает: количество очищенных символов
+ ******************************************************************************/
+int clear_stdin_buffer(void)
+{
+    int character = 0;
+    int cleared_count = 0;
+
+    while ((character = getchar()) != '\n' && character != EOF)
+    {
+        cleared_count++;
+    }
+
+    return cleared_count;
 }
 
 /******************************************************************************
  * Функция: show_photo_information
  *
- * Описание: Выводит подробную информацию об одной фотографии.
+ * Описание: Выводит подробную информацию об одной фотографии.
+ *
+ * Параметры:
+ *   photo - указатель на структуру Photo для вывода
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int show_photo_information(const Photo* photo)
+{
+    char storage[SMALL_OUTPUT_BUFFER_SIZE];
+    OutputBuffer buffer;
+
+    if (photo == NULL || output_buffer_initialize(&buffer, stdout, storage, sizeof(storage)) != 0)
+    {
+        return -1;
+    }
+
+    output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+    output_append_string(&buffer, "\n     ПОДРОБНАЯ ИНФОРМАЦИЯ О ФОТОГРАФИИ     \n");
+    output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+
+#define SCHEMA_SHOW_TEXT(field, length, label) \
+    output_append_string(&buffer, "\n" label ": "); \
+    output_append_string(&buffer, photo->field);
+    /* Число без подписи вывода продолжает строку предыдущего поля */
+#define SCHEMA_SHOW_REAL(field, label, view_label, view_suffix) \
+    if (view_label[0] != '\0') \
+    { \
+        output_append_string(&buffer, "\n" view_label ": "); \
+    } \
+    output_append_fixed2(&buffer, photo->field, locale_decimal_point(), 0); \
+    output_append_string(&buffer, view_suffix);
+#define SCHEMA_SHOW_INTEGER(field, label, view_label, view_suffix) \
+    if (view_label[0] != '\0') \
+    { \
+        output_append_string(&buffer, "\n" view_label ": "); \
+    } \
+    output_append_integer(&buffer, photo->field, 0); \
+    output_append_string(&buffer, view_suffix);
+    PHOTO_SCHEMA(SCHEMA_SHOW_TEXT, SCHEMA_SHOW_REAL, SCHEMA_SHOW_INTEGER)
+#undef SCHEMA_SHOW_TEXT
+#undef SCHEMA_SHOW_REAL
+#undef SCHEMA_SHOW_INTEGER
+
+    output_append_string(&buffer, "\n");
+    output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+    output_append_string(&buffer, "\n");
+
+    return output_buffer_flush(&buffer);
+}
+
+/******************************************************************************
+ * Функция: prompt_for_enter_key
+ *
+ * Описание: Ожидает нажатия клавиши Enter для продолжения.
+ *
+ * Возвращает: 0 при успешном ожидании
+ ******************************************************************************/
+int prompt_for_enter_key(void)
+{
+    printf("\nДля продолжения нажмите Enter...");
+    clear_stdin_buffer();
+    getchar();
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: print_horizontal_separator
+ *
+ * Описание: Выводит разделительную линию.
+ *
+ * Возвращает: количество выведенных символов
+ ******************************************************************************/
+int print_horizontal_separator(void)
+{
+    static const char separator_line[SEPARATOR_WIDTH + 2] =
+        "==================================================\n";
+
+    fputs(separator_line, stdout);
+    return SEPARATOR_WIDTH;
+}
+
+/******************************************************************************
+ * Функция: validate_date_format
+ *
+ * Описание: Проверяет корректность формата даты ГГГГ-ММ-ДД.
+ *
+ * Параметры:
+ *   date - строка с датой для проверки
+ *
+ * Возвращает: 0 если формат корректен, -1 если некорректен
+ ******************************************************************************/
+int validate_date_format(const char* date)
+{
+    int year = 0;
+    int month = 0;
+    int day = 0;
+
+    if (date == NULL || strlen(date) != 10)
+    {
+        return -1;
+    }
+
+    if (date[4] != '-' || date[7] != '-')
+    {
+        return -1;
+    }
+
+    if (sscanf(date, "%4d-%2d-%2d", &year, &month, &day) != 3)
+    {
+        return -1;
+    }
+
+    if (year < 1900 || year > 2100)
+    {
+        return -1;
+    }
+
+    if (month < 1 || month > 12)
+    {
+        return -1;
+    }
+
+    if (day < 1 || day > 31)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: validate_positive_number
+ *
+ * Описание: Проверяет, является ли число положительным.
+ *
+ * Параметры:
+ *   number - число для проверки
+ *
+ * Возвращает: 0 если число положительное, -1 если нет
+ ******************************************************************************/
+int validate_positive_number(double number)
+{
+    if (number > 0)
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Функция: validate_positive_integer
+ *
+ * Описание: Проверяет, является ли целое число положительным.
+ *
+ * Параметры:
+ *   number - целое число для проверки
+ *
+ * Возвращает: 0 если число положительное, -1 если нет
+ ******************************************************************************/
+int validate_positive_integer(int number)
+{
+    if (number > 0)
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Функция: hash_string_djb2
+ *
+ * Описание: Вычисляет хеш строки по алгоритму DJB2 (hash * 33 + c).
+ *
+ * Параметры:
+ *   text - строка для хеширования
+ *
+ * Возвращает: значение хеша
+ ******************************************************************************/
+unsigned long hash_string_djb2(const char* text)
+{
+    unsigned long hash = 5381;
+    int character = 0;
+
+    while ((character = (unsigned char)*text++) != '\0')
+    {
+        hash = ((hash << 5) + hash) + character;
+    }
+
+    return hash;
+}
+
+/******************************************************************************
+ * Функция: normalize_query_text
+ *
+ * Описание: Приводит строку запроса к нормализованному виду: удаляет
+ *           пробельные символы по краям и схлопывает повторяющиеся пробелы.
+ *
+ * Параметры:
+ *   text - исходная строка запроса
+ *   normalized - буфер для нормализованной строки
+ *   normalized_size - размер буфера
+ *
+ * Возвращает: длину нормализованной строки
+ ******************************************************************************/
+int normalize_query_text(const char* text, char* normalized, size_t normalized_size)
+{
+    size_t length = 0;
+    int pending_space = 0;
+
+    if (normalized == NULL || normalized_size == 0)
+    {
+        return 0;
+    }
+
+    while (text != NULL && *text != '\0')
+    {
+        if (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n')
+        {
+            pending_space = (length > 0);
+        }
+        else
+        {
+            if (pending_space && length + 1 < normalized_size)
+            {
+                normalized[length++] = ' ';
+            }
+            pending_space = 0;
+            if (length + 1 < normalized_size)
+            {
+                normalized[length++] = *text;
+            }
+        }
+        text++;
+    }
+
+    normalized[length] = '\0';
+    return (int)length;
+}
+
+/******************************************************************************
+ * Функция: build_query_key
+ *
+ * Описание: Формирует ключ кэша из вида запроса и его нормализованных
+ *           параметров.
+ *
+ * Параметры:
+ *   query_kind - вид запроса (QUERY_KIND_...)
+ *   date - дата из запроса (пустая строка, если не используется)
+ *   text - нормализованное место или тег
+ *   key - буфер размером MAX_QUERY_KEY_LEN для ключа
+ *
+ * Возвращает: 0 при успехе, -1 если ключ не помещается в буфер
+ ******************************************************************************/
+int build_query_key(int query_kind, const char* date, const char* text, char* key)
+{
+    int key_length = snprintf(key, MAX_QUERY_KEY_LEN, "%c|%s|%s", query_kind, date, text);
+
+    if (key_length < 0 || key_length >= MAX_QUERY_KEY_LEN)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: photo_matches_query
+ *
+ * Описание: Проверяет, удовлетворяет ли фотография условию запроса.
+ *           Используется и при поиске, и при сбросе устаревших элементов кэша.
+ *           Место и теги сравниваются по свернутым ключам, поэтому поиск
+ *           не зависит от регистра.
+ *
+ * Параметры:
+ *   photo - проверяемая фотография
+ *   query_kind - вид запроса (QUERY_KIND_...)
+ *   date - дата из запроса
+ *   text - свернутое место или тег из запроса
+ *
+ * Возвращает: 1 если фотография подходит, 0 если нет
+ ******************************************************************************/
+int photo_matches_query(const Photo* photo, int query_kind, const char* date, const char* text)
+{
+    if (photo->is_deleted)
+    {
+        return 0;
+    }
+
+    if (query_kind == QUERY_KIND_LOCATION)
+    {
+        return strstr(photo->place_key, text) != NULL;
+    }
+
+    if (query_kind == QUERY_KIND_DATE_AND_TAG)
+    {
+        return strcmp(photo->date, date) == 0 && strstr(photo->tags_key, text) != NULL;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: collect_query_results
+ *
+ * Описание: Возвращает индексы записей, удовлетворяющих запросу. Сначала
+ *           ищет результат в кэше, при промахе проверяет кандидатов из
+ *           индекса (или все записи, если индекс неприменим) и сохраняет
+ *           результат в кэш.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей в массиве
+ *   query_kind - вид запроса (QUERY_KIND_...)
+ *   date - дата из запроса
+ *   text - нормализованное и свернутое место или тег
+ *   indexes - кэш и индексы поиска
+ *   record_indices - указатель для возврата массива индексов (принадлежит кэшу)
+ *
+ * Возвращает: количество найденных записей, -1 при нехватке памяти
+ ******************************************************************************/
+int collect_query_results(const Photo database[], int record_count, int query_kind,
+    const char* date, const char* text, ArchiveIndexes* indexes, const int** record_indices)
+{
+    char key[MAX_QUERY_KEY_LEN];
+    QueryCache* cache = &indexes->query_cache;
+    CachedQuery* entry = NULL;
+    int* found_indices = NULL;
+    int* candidates = NULL;
+    int candidate_count = 0;
+    int found_records = 0;
+    int key_is_valid = 0;
+    int i = 0;
+
+    key_is_valid = (build_query_key(query_kind, date, text, key) == 0);
+    if (key_is_valid)
+    {
+        entry = query_cache_lookup(cache, key);
+        if (entry != NULL)
+        {
+            *record_indices = entry->record_indices;
+            return entry->result_count;
+        }
+    }
+
+    found_indices = (int*)memory_allocate((record_count > 0 ? record_count : 1) * sizeof(int));
+    if (found_indices == NULL)
+    {
+        return -1;
+    }
+
+    candidate_count = collect_index_candidates(indexes, query_kind, date, text, &candidates);
+    if (candidate_count >= 0)
+    {
+        /* Проверка только записей-кандидатов из индекса */
+        for (i = 0; i < candidate_count; i++)
+        {
+            if (candidates[i] < record_count &&
+                photo_matches_query(&database[candidates[i]], query_kind, date, text))
+            {
+                found_indices[found_records++] = candidates[i];
+            }
+        }
+        memory_release(candidates);
+    }
+    else
+    {
+        for (i = 0; i < record_count; i++)
+        {
+            if (photo_matches_query(&database[i], query_kind, date, text))
+            {
+                found_indices[found_records++] = i;
+            }
+        }
+    }
+
+    if (key_is_valid)
+    {
+        entry = query_cache_store(cache, query_kind, date, text, key, found_indices, found_records);
+    }
+
+    if (entry != NULL)
+    {
+        memory_release(found_indices);
+        *record_indices = entry->record_indices;
+    }
+    else
+    {
+        /* Результат не кэшируется, но должен жить до следующего запроса */
+        memory_release(cache->overflow_indices);
+        cache->overflow_indices = found_indices;
+        *record_indices = found_indices;
+    }
+
+    return found_records;
+}
+
+/******************************************************************************
+ * Функция: query_cache_initialize
+ *
+ * Описание: Инициализирует пустой кэш результатов запросов.
+ *
+ * Параметры:
+ *   cache - кэш для инициализации
+ *   memory_budget - лимит памяти кэша в байтах
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int query_cache_initialize(QueryCache* cache, size_t memory_budget)
+{
+    if (cache == NULL)
+    {
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->memory_budget = memory_budget;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: query_cache_release
+ *
+ * Описание: Освобождает всю память, занятую кэшем.
+ *
+ * Параметры:
+ *   cache - кэш для освобождения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int query_cache_release(QueryCache* cache)
+{
+    if (cache == NULL)
+    {
+        return -1;
+    }
+
+    query_cache_clear(cache);
+    memory_release(cache->overflow_indices);
+    cache->overflow_indices = NULL;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: query_cache_lookup
+ *
+ * Описание: Ищет результат запроса в кэше. При попадании элемент
+ *           переносится в начало списка LRU.
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *   key - нормализованный ключ запроса
+ *
+ * Возвращает: найденный элемент или NULL при промахе
+ ******************************************************************************/
+CachedQuery* query_cache_lookup(QueryCache* cache, const char* key)
+{
+    CachedQuery* entry = NULL;
+
+    if (cache == NULL || key == NULL)
+    {
+        return NULL;
+    }
+
+    entry = cache->buckets[hash_string_djb2(key) % QUERY_CACHE_BUCKETS];
+    while (entry != NULL && strcmp(entry->key, key) != 0)
+    {
+        entry = entry->bucket_next;
+    }
+
+    if (entry == NULL)
+    {
+        cache->miss_count++;
+        return NULL;
+    }
+
+    cache->hit_count++;
+
+    /* Перенос элемента в начало списка LRU */
+    if (entry != cache->lru_head)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+        if (entry->lru_next != NULL)
+        {
+            entry->lru_next->lru_prev = entry->lru_prev;
+        }
+        else
+        {
+            cache->lru_tail = entry->lru_prev;
+        }
+
+        entry->lru_prev = NULL;
+        entry->lru_next = cache->lru_head;
+        cache->lru_head->lru_prev = entry;
+        cache->lru_head = entry;
+    }
+
+    return entry;
+}
+
+/******************************************************************************
+ * Функция: query_cache_store
+ *
+ * Описание: Сохраняет результат запроса в кэше. При превышении лимита памяти
+ *           вытесняет давно не использованные элементы.
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *   query_kind - вид запроса (QUERY_KIND_...)
+ *   date - дата из запроса
+ *   text - нормализованное место или тег
+ *   key - нормализованный ключ запроса
+ *   record_indices - индексы найденных записей
+ *   result_count - количество найденных записей
+ *
+ * Возвращает: сохраненный элемент или NULL, если результат не кэшируется
+ ******************************************************************************/
+CachedQuery* query_cache_store(QueryCache* cache, int query_kind, const char* date,
+    const char* text, const char* key, const int record_indices[], int result_count)
+{
+    CachedQuery* entry = NULL;
+    size_t entry_size = sizeof(CachedQuery) + (size_t)result_count * sizeof(int);
+    unsigned long bucket = 0;
+    int previous_subsystem = 0;
+
+    if (cache == NULL || entry_size > cache->memory_budget ||
+        strlen(key) >= MAX_QUERY_KEY_LEN || strlen(text) >= MAX_TAGS_LEN)
+    {
+        return NULL;
+    }
+
+    while (cache->memory_used + entry_size > cache->memory_budget && cache->lru_tail != NULL)
+    {
+        query_cache_remove_entry(cache, cache->lru_tail);
+        cache->eviction_count++;
+    }
+
+    previous_subsystem = memory_enter(MEMORY_QUERY_CACHE);
+    entry = (CachedQuery*)memory_allocate_zeroed(1, sizeof(CachedQuery));
+    if (entry != NULL)
+    {
+        entry->record_indices = (int*)memory_allocate((result_count > 0 ? result_count : 1) * sizeof(int));
+        if (entry->record_indices == NULL)
+        {
+            memory_release(entry);
+            entry = NULL;
+        }
+    }
+    memory_leave(previous_subsystem, 0);
+
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    strcpy(entry->key, key);
+    strncpy(entry->date, date, sizeof(entry->date) - 1);
+    strcpy(entry->text, text);
+    entry->query_kind = query_kind;
+    entry->result_count = result_count;
+    entry->memory_used = entry_size;
+    if (result_count > 0)
+    {
+        memcpy(entry->record_indices, record_indices, (size_t)result_count * sizeof(int));
+    }
+
+    bucket = hash_string_djb2(key) % QUERY_CACHE_BUCKETS;
+    entry->bucket_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL)
+    {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL)
+    {
+        cache->lru_tail = entry;
+    }
+
+    cache->memory_used += entry_size;
+    cache->entry_count++;
+    return entry;
+}
+
+/******************************************************************************
+ * Функция: query_cache_remove_entry
+ *
+ * Описание: Удаляет элемент из хеш-таблицы и списка LRU и освобождает его.
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *   entry - удаляемый элемент
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int query_cache_remove_entry(QueryCache* cache, CachedQuery* entry)
+{
+    CachedQuery** link = NULL;
+
+    if (cache == NULL || entry == NULL)
+    {
+        return -1;
+    }
+
+    link = &cache->buckets[hash_string_djb2(entry->key) % QUERY_CACHE_BUCKETS];
+    while (*link != NULL && *link != entry)
+    {
+        link = &(*link)->bucket_next;
+    }
+    if (*link == entry)
+    {
+        *link = entry->bucket_next;
+    }
+
+    if (entry->lru_prev != NULL)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        cache->lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next != NULL)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        cache->lru_tail = entry->lru_prev;
+    }
+
+    cache->memory_used -= entry->memory_used;
+    cache->entry_count--;
+    memory_release(entry->record_indices);
+    memory_release(entry);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: query_cache_invalidate_for_record
+ *
+ * Описание: Сбрасывает элементы кэша, которым могла бы соответствовать
+ *           добавленная или измененная запись. Результаты остальных
+ *           запросов остаются действительными.
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *   photo - добавленная или измененная запись
+ *
+ * Возвращает: количество сброшенных элементов, -1 при ошибке
+ ******************************************************************************/
+int query_cache_invalidate_for_record(QueryCache* cache, const Photo* photo)
+{
+    CachedQuery* entry = NULL;
+    CachedQuery* next_entry = NULL;
+    int invalidated = 0;
+
+    if (cache == NULL || photo == NULL)
+    {
+        return -1;
+    }
+
+    for (entry = cache->lru_head; entry != NULL; entry = next_entry)
+    {
+        next_entry = entry->lru_next;
+        if (photo_matches_query(photo, entry->query_kind, entry->date, entry->text))
+        {
+            query_cache_remove_entry(cache, entry);
+            invalidated++;
+        }
+    }
+
+    cache->invalidation_count += invalidated;
+    return invalidated;
+}
+
+/******************************************************************************
+ * Функция: query_cache_clear
+ *
+ * Описание: Удаляет все элементы кэша (например, после перестановки записей).
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *
+ * Возвращает: количество удаленных элементов, -1 при ошибке
+ ******************************************************************************/
+int query_cache_clear(QueryCache* cache)
+{
+    int removed = 0;
+
+    if (cache == NULL)
+    {
+        return -1;
+    }
+
+    while (cache->lru_head != NULL)
+    {
+        query_cache_remove_entry(cache, cache->lru_head);
+        removed++;
+    }
+
+    cache->invalidation_count += removed;
+    return removed;
+}
+
+/******************************************************************************
+ * Функция: print_query_cache_statistics
+ *
+ * Описание: Выводит счетчики попаданий и промахов и занятую кэшем память.
+ *
+ * Параметры:
+ *   cache - кэш результатов запросов
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int print_query_cache_statistics(const QueryCache* cache)
+{
+    long total_queries = 0;
+
+    if (cache == NULL)
+    {
+        return -1;
+    }
+
+    total_queries = cache->hit_count + cache->miss_count;
+
+    printf("\n");
+    print_horizontal_separator();
+    printf("          СТАТИСТИКА КЭША ЗАПРОСОВ          \n");
+    print_horizontal_separator();
+    printf("Элементов в кэше: %d\n", cache->entry_count);
+    printf("Занято памяти: %lu из %lu байт\n",
+        (unsigned long)cache->memory_used, (unsigned long)cache->memory_budget);
+    printf("Попаданий: %ld, промахов: %ld", cache->hit_count, cache->miss_count);
+    if (total_queries > 0)
+    {
+        printf(" (доля попаданий %.1f%%)", 100.0 * cache->hit_count / total_queries);
+    }
+    printf("\n");
+    printf("Сброшено элементов: %ld, вытеснено: %ld\n",
+        cache->invalidation_count, cache->eviction_count);
+    print_horizontal_separator();
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: print_record_table_header
+ *
+ * Описание: Выводит заголовок таблицы записей.
+ *
+ * Возвращает: 0 при успешном выводе
+ ******************************************************************************/
+int print_record_table_header(void)
+{
+    print_horizontal_separator();
+    printf("№  Название          Дата       Место          Категория   Размер   Разрешение Формат\n");
+    print_horizontal_separator();
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: print_record_table_row
+ *
+ * Описание: Выводит одну запись в виде строки таблицы.
+ *
+ * Параметры:
+ *   row_number - номер строки, выводимый в первом столбце
+ *   photo - указатель на выводимую запись
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int print_record_table_row(int row_number, const Photo* photo)
+{
+    char storage[SMALL_OUTPUT_BUFFER_SIZE];
+    OutputBuffer buffer;
+
+    if (photo == NULL || output_buffer_initialize(&buffer, stdout, storage, sizeof(storage)) != 0)
+    {
+        return -1;
+    }
+
+    format_record_table_row(&buffer, row_number, photo);
+    return output_buffer_flush(&buffer);
+}
+
+/******************************************************************************
+ * Функция: compare_records_in_order
+ *
+ * Описание: Сравнивает две записи базы в строгом порядке: по ключам
+ *           сортировки (build_photo_sort_key), а при равенстве - по индексу
+ *           записи. Строгий порядок позволяет однозначно продолжать
+ *           просмотр с позиции курсора.
+ *
+ * Параметры:
+ *   keys - ключи сортировки, построенные для каждой записи по ее индексу
+ *   index_a - индекс первой записи
+ *   index_b - индекс второй записи
+ *
+ * Возвращает: отрицательное число если a < b, 0 если a == b,
+ *             положительное если a > b
+ ******************************************************************************/
+int compare_records_in_order(const SortKeyEntry keys[], int index_a, int index_b)
+{
+    return compare_sort_entries(&keys[index_a], &keys[index_b]);
+}
+
+/******************************************************************************
+ * Функция: select_records_page
+ *
+ * Описание: Отбирает limit наименьших записей, следующих в порядке сортировки
+ *           за записью after_index, без полной сортировки базы. Используется
+ *           max-куча размера limit, поэтому сложность O(N log K).
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей в массиве
+ *   keys - ключи сортировки записей (см. compare_records_in_order)
+ *   after_index - индекс записи-курсора, -1 для выборки с начала
+ *   limit - максимальное количество отбираемых записей
+ *   selected_indices - массив размером не менее limit для результата
+ *
+ * Возвращает: количество отобранных записей (в порядке сортировки)
+ ******************************************************************************/
+int select_records_page(const Photo database[], int record_count, const SortKeyEntry keys[],
+    int after_index, int limit, int selected_indices[])
+{
+    int heap_size = 0;
+    int i = 0;
+
+    if (database == NULL || selected_indices == NULL || limit <= 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < record_count; i++)
+    {
+        int position = 0;
+
+        if (database[i].is_deleted)
+        {
+            continue;
+        }
+
+        if (after_index >= 0 && compare_records_in_order(keys, i, after_index) <= 0)
+        {
+            continue;
+        }
+
+        if (heap_size < limit)
+        {
+            /* Просеивание вверх нового элемента */
+            position = heap_size++;
+            while (position > 0)
+            {
+                int parent = (position - 1) / 2;
+                if (compare_records_in_order(keys, selected_indices[parent], i) >= 0)
+                {
+                    break;
+                }
+                selected_indices[position] = selected_indices[parent];
+                position = parent;
+            }
+            selected_indices[position] = i;
+        }
+        else if (compare_records_in_order(keys, i, selected_indices[0]) < 0)
+        {
+            /* Замена наибольшего элемента кучи и просеивание вниз */
+            while (1)
+            {
+                int child = 2 * position + 1;
+                if (child >= heap_size)
+                {
+                    break;
+                }
+                if (child + 1 < heap_size &&
+                    compare_records_in_order(keys,
+                        selected_indices[child + 1], selected_indices[child]) > 0)
+                {
+                    child++;
+                }
+                if (compare_records_in_order(keys, selected_indices[child], i) <= 0)
+                {
+                    break;
+                }
+                selected_indices[position] = selected_indices[child];
+                position = child;
+            }
+            selected_indices[position] = i;
+        }
+    }
+
+    /* Пирамидальная сортировка отобранных элементов по возрастанию */
+    for (i = heap_size - 1; i > 0; i--)
+    {
+        int largest = selected_indices[0];
+        int moved = selected_indices[i];
+        int position = 0;
+
+        while (1)
+        {
+            int child = 2 * position + 1;
+            if (child >= i)
+            {
+                break;
+            }
+            if (child + 1 < i &&
+                compare_records_in_order(keys,
+                    selected_indices[child + 1], selected_indices[child]) > 0)
+            {
+                child++;
+            }
+            if (compare_records_in_order(keys, selected_indices[child], moved) <= 0)
+            {
+                break;
+            }
+            selected_indices[position] = selected_indices[child];
+            position = child;
+        }
+        selected_indices[position] = moved;
+        selected_indices[i] = largest;
+    }
+
+    return heap_size;
+}
+
+/******************************************************************************
+ * Функция: fetch_next_page
+ *
+ * Описание: Отбирает следующую страницу после позиции курсора и сдвигает
+ *           курсор на последнюю отобранную запись.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей в массиве
+ *   cursor - курсор постраничного просмотра
+ *   page_indices - массив размером не менее cursor->page_size
+ *
+ * Возвращает: количество записей на странице, 0 если записи закончились
+ ******************************************************************************/
+int fetch_next_page(const Photo database[], int record_count, PageCursor* cursor,
+    int page_indices[])
+{
+    int page_count = 0;
+
+    if (cursor == NULL)
+    {
+        return 0;
+    }
+
+    page_count = select_records_page(database, record_count, cursor->keys,
+        cursor->last_index, cursor->page_size, page_indices);
+    if (page_count > 0)
+    {
+        cursor->last_index = page_indices[page_count - 1];
+        cursor->page_number++;
+    }
+
+    return page_count;
+}
+
+/******************************************************************************
+ * Функция: fetch_page_by_number
+ *
+ * Описание: Отбирает страницу с заданным номером. Отбираются первые
+ *           page_number × page_size записей (частичная выборка кучей),
+ *           из которых возвращается последняя страница.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей в массиве
+ *   cursor - курсор постраничного просмотра
+ *   page_number - номер страницы (с 1)
+ *   page_indices - массив размером не менее cursor->page_size
+ *
+ * Возвращает: количество записей на странице, 0 если страницы нет,
+ *             -1 при нехватке памяти
+ ******************************************************************************/
+int fetch_page_by_number(const Photo database[], int record_count, PageCursor* cursor,
+    int page_number, int page_indices[])
+{
+    int* selected_indices = NULL;
+    int prefix_limit = 0;
+    int selected_count = 0;
+    int page_start = 0;
+    int page_count = 0;
+
+    if (cursor == NULL || page_number < 1 ||
+        (long long)(page_number - 1) * cursor->page_size >= count_live_records(database, record_count))
+    {
+        return 0;
+    }
+
+    prefix_limit = page_number * cursor->page_size;
+    selected_indices = (int*)memory_allocate((size_t)prefix_limit * sizeof(int));
+    if (selected_indices == NULL)
+    {
+        return -1;
+    }
+
+    selected_count = select_records_page(database, record_count, cursor->keys,
+        -1, prefix_limit, selected_indices);
+    page_start = (page_number - 1) * cursor->page_size;
+    page_count = selected_count - page_start;
+    memcpy(page_indices, selected_indices + page_start, (size_t)page_count * sizeof(int));
+    memory_release(selected_indices);
+
+    cursor->last_index = page_indices[page_count - 1];
+    cursor->page_number = page_number;
+    return page_count;
+}
+
+/******************************************************************************
+ * Функция: browse_records_by_pages
+ *
+ * Описание: Интерактивный постраничный просмотр записей в выбранном порядке.
+ *           Порядок полей запрашивается как при сортировке (read_sort_order),
+ *           ключи записей строятся один раз, а каждая страница отбирается
+ *           частичной выборкой, без сортировки всей базы и без вывода всех
+ *           записей.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей в массиве
+ *
+ * Возвращает: 0 при успешном просмотре, -1 при ошибке
+ ******************************************************************************/
+int browse_records_by_pages(const Photo database[], int record_count)
+{
+    static const SortKeyField default_order[] = {
+        { PHOTO_FIELD_date, 0 }, { PHOTO_FIELD_category, 0 },
+        { PHOTO_FIELD_width, 0 }, { PHOTO_FIELD_height, 0 }
+    };
+    SortKeyField order[PHOTO_FIELD_COUNT];
+    SortKeyEntry* keys = NULL;
+    PageCursor cursor;
+    int page_indices[MAX_PAGE_SIZE];
+    int order_length = 0;
+    int live_count = count_live_records(database, record_count);
+    int page_count = 0;
+    int total_pages = 0;
+    int first_page = 1;
+    int requested_page = 0;
+    char command[16];
+    int i = 0;
+
+    if (live_count <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    if (read_sort_order(order, &order_length) != 0)
+    {
+        return -1;
+    }
+    if (order_length == 0)
+    {
+        order_length = (int)(sizeof(default_order) / sizeof(default_order[0]));
+        memcpy(order, default_order, sizeof(default_order));
+    }
+
+    printf("Введите количество записей на странице (1-%d, по умолчанию %d): ",
+        MAX_PAGE_SIZE, DEFAULT_PAGE_SIZE);
+    if (scanf("%d", &cursor.page_size) != 1 ||
+        cursor.page_size < 1 || cursor.page_size > MAX_PAGE_SIZE)
+    {
+        cursor.page_size = DEFAULT_PAGE_SIZE;
+    }
+    clear_stdin_buffer();
+
+    printf("Введите номер начальной страницы (по умолчанию 1): ");
+    if (scanf("%d", &first_page) != 1 || first_page < 1)
+    {
+        first_page = 1;
+    }
+    clear_stdin_buffer();
+
+    keys = (SortKeyEntry*)memory_allocate((size_t)record_count * sizeof(SortKeyEntry));
+    if (keys == NULL)
+    {
+        printf("Ошибка: Недостаточно памяти для сортировки.\n");
+        return -1;
+    }
+    for (i = 0; i < record_count; i++)
+    {
+        keys[i].key_length = build_photo_sort_key(&database[i], order, order_length, keys[i].key);
+        keys[i].record_index = i;
+    }
+
+    cursor.keys = keys;
+    cursor.page_number = 0;
+    cursor.last_index = -1;
+    total_pages = (live_count + cursor.page_size - 1) / cursor.page_size;
+    if (first_page > total_pages)
+    {
+        printf("Страницы %d нет (всего страниц: %d), просмотр начинается с первой.\n",
+            first_page, total_pages);
+        first_page = 1;
+    }
+
+    page_count = (first_page == 1)
+        ? fetch_next_page(database, record_count, &cursor, page_indices)
+        : fetch_page_by_number(database, record_count, &cursor, first_page, page_indices);
+
+    while (page_count > 0)
+    {
+        printf("\nСтраница %d из %d\n", cursor.page_number, total_pages);
+        print_record_table_header();
+        for (i = 0; i < page_count; i++)
+        {
+            print_record_table_row((cursor.page_number - 1) * cursor.page_size + i + 1,
+                &database[page_indices[i]]);
+        }
+        print_horizontal_separator();
+
+        printf("Enter - следующая страница, номер - переход к странице, q - выход: ");
+        if (fgets(command, sizeof(command), stdin) == NULL || command[0] == 'q' || command[0] == 'Q')
+        {
+            break;
+        }
+
+        if (command[0] >= '0' && command[0] <= '9')
+        {
+            requested_page = atoi(command);
+            if (requested_page < 1 || requested_page > total_pages)
+            {
+                /* Текущая страница показывается снова */
+                printf("Ошибка: Страницы %d нет (всего страниц: %d).\n", requested_page, total_pages);
+                continue;
+            }
+            page_count = fetch_page_by_number(database, record_count, &cursor,
+                requested_page, page_indices);
+        }
+        else
+        {
+            page_count = fetch_next_page(database, record_count, &cursor, page_indices);
+        }
+    }
+
+    memory_release(keys);
+    if (page_count < 0)
+    {
+        printf("Ошибка: Недостаточно памяти для выборки страницы.\n");
+        return -1;
+    }
+
+    if (page_count == 0)
+    {
+        printf("Больше записей нет.\n");
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: grow_array
+ *
+ * Описание: Увеличивает динамический массив до заданной емкости.
+ *
+ * Параметры:
+ *   array - указатель на указатель массива (обновляется при успехе)
+ *   element_size - размер элемента в байтах
+ *   new_capacity - новая емкость в элементах
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int grow_array(void** array, size_t element_size, int new_capacity)
+{
+    void* grown = memory_reallocate(*array, element_size * (size_t)new_capacity);
+
+    if (grown == NULL)
+    {
+        return -1;
+    }
+
+    *array = grown;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: string_dictionary_initialize
+ *
+ * Описание: Инициализирует пустой словарь строк.
+ *
+ * Параметры:
+ *   dictionary - словарь для инициализации
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int string_dictionary_initialize(StringDictionary* dictionary)
+{
+    if (dictionary == NULL)
+    {
+        return -1;
+    }
+
+    memset(dictionary, 0, sizeof(*dictionary));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: string_dictionary_release
+ *
+ * Описание: Освобождает память словаря строк.
+ *
+ * Параметры:
+ *   dictionary - словарь для освобождения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int string_dictionary_release(StringDictionary* dictionary)
+{
+    int i = 0;
+
+    if (dictionary == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < dictionary->value_count; i++)
+    {
+        memory_release(dictionary->values[i]);
+    }
+    memory_release(dictionary->values);
+    memory_release(dictionary->hash_slots);
+    memset(dictionary, 0, sizeof(*dictionary));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: string_dictionary_find
+ *
+ * Описание: Ищет строку в словаре.
+ *
+ * Параметры:
+ *   dictionary - словарь строк
+ *   value - искомая строка
+ *
+ * Возвращает: номер строки или -1, если строки нет в словаре
+ ******************************************************************************/
+int string_dictionary_find(const StringDictionary* dictionary, const char* value)
+{
+    unsigned long slot = 0;
+
+    if (dictionary == NULL || value == NULL || dictionary->hash_capacity == 0)
+    {
+        return -1;
+    }
+
+    slot = hash_string_djb2(value) & (unsigned long)(dictionary->hash_capacity - 1);
+    while (dictionary->hash_slots[slot] >= 0)
+    {
+        if (strcmp(dictionary->values[dictionary->hash_slots[slot]], value) == 0)
+        {
+            return dictionary->hash_slots[slot];
+        }
+        slot = (slot + 1) & (unsigned long)(dictionary->hash_capacity - 1);
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Функция: string_dictionary_intern
+ *
+ * Описание: Возвращает номер строки в словаре, добавляя ее при отсутствии.
+ *           Номера уже добавленных строк не меняются.
+ *
+ * Параметры:
+ *   dictionary - словарь строк
+ *   value - строка
+ *
+ * Возвращает: номер строки, -1 при нехватке памяти
+ ******************************************************************************/
+int string_dictionary_intern(StringDictionary* dictionary, const char* value)
+{
+    int value_id = string_dictionary_find(dictionary, value);
+    unsigned long slot = 0;
+    char* value_copy = NULL;
+    int i = 0;
+    int previous_subsystem = memory_enter(MEMORY_STRINGS);
+
+    if (value_id >= 0 || dictionary == NULL || value == NULL)
+    {
+        return memory_leave(previous_subsystem, value_id);
+    }
+
+    /* Перестроение хеш-таблицы при заполнении на 3/4 */
+    if ((dictionary->value_count + 1) * 4 > dictionary->hash_capacity * 3)
+    {
+        int new_capacity = dictionary->hash_capacity > 0 ? dictionary->hash_capacity * 2 : 64;
+        int* new_slots = (int*)memory_allocate((size_t)new_capacity * sizeof(int));
+
+        if (new_slots == NULL)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+
+        for (i = 0; i < new_capacity; i++)
+        {
+            new_slots[i] = -1;
+        }
+        for (i = 0; i < dictionary->value_count; i++)
+        {
+            slot = hash_string_djb2(dictionary->values[i]) & (unsigned long)(new_capacity - 1);
+            while (new_slots[slot] >= 0)
+            {
+                slot = (slot + 1) & (unsigned long)(new_capacity - 1);
+            }
+            new_slots[slot] = i;
+        }
+
+        memory_release(dictionary->hash_slots);
+        dictionary->hash_slots = new_slots;
+        dictionary->hash_capacity = new_capacity;
+    }
+
+    if (dictionary->value_count == dictionary->value_capacity)
+    {
+        int new_capacity = dictionary->value_capacity > 0 ? dictionary->value_capacity * 2 : 16;
+        if (grow_array((void**)&dictionary->values, sizeof(char*), new_capacity) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+        dictionary->value_capacity = new_capacity;
+    }
+
+    value_copy = (char*)memory_allocate(strlen(value) + 1);
+    if (value_copy == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+    strcpy(value_copy, value);
+
+    value_id = dictionary->value_count++;
+    dictionary->values[value_id] = value_copy;
+
+    slot = hash_string_djb2(value) & (unsigned long)(dictionary->hash_capacity - 1);
+    while (dictionary->hash_slots[slot] >= 0)
+    {
+        slot = (slot + 1) & (unsigned long)(dictionary->hash_capacity - 1);
+    }
+    dictionary->hash_slots[slot] = value_id;
+
+    return memory_leave(previous_subsystem, value_id);
+}
+
+/******************************************************************************
+ * Функция: parse_date_key
+ *
+ * Описание: Преобразует дату ГГГГ-ММ-ДД в целое число ГГГГММДД.
+ *
+ * Параметры:
+ *   date - строка с датой
+ *
+ * Возвращает: дату в виде ГГГГММДД, 0 если формат даты неверен
+ ******************************************************************************/
+int parse_date_key(const char* date)
+{
+    static const int digit_positions[8] = { 0, 1, 2, 3, 5, 6, 8, 9 };
+    int date_key = 0;
+    int i = 0;
+
+    if (date == NULL || strlen(date) != 10 || date[4] != '-' || date[7] != '-')
+    {
+        return 0;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        char digit = date[digit_positions[i]];
+        if (digit < '0' || digit > '9')
+        {
+            return 0;
+        }
+        date_key = date_key * 10 + (digit - '0');
+    }
+
+    return date_key;
+}
+
+/******************************************************************************
+ * Функция: resolution_bucket
+ *
+ * Описание: Определяет диапазон гистограммы разрешений для изображения.
+ *
+ * Параметры:
+ *   width - ширина в пикселях
+ *   height - высота в пикселях
+ *
+ * Возвращает: номер диапазона от 0 до RESOLUTION_BUCKET_COUNT - 1
+ ******************************************************************************/
+int resolution_bucket(int width, int height)
+{
+    static const long long bucket_limits[RESOLUTION_BUCKET_COUNT - 1] = {
+        1000000LL, 2000000LL, 5000000LL, 8000000LL, 12000000LL, 24000000LL
+    };
+    long long pixels = (long long)width * height;
+    int bucket = 0;
+
+    while (bucket < RESOLUTION_BUCKET_COUNT - 1 && pixels >= bucket_limits[bucket])
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/******************************************************************************
+ * Функция: resolution_bucket_label
+ *
+ * Описание: Возвращает подпись диапазона гистограммы разрешений.
+ *
+ * Параметры:
+ *   bucket - номер диапазона
+ *
+ * Возвращает: строку с подписью диапазона
+ ******************************************************************************/
+const char* resolution_bucket_label(int bucket)
+{
+    static const char* bucket_labels[RESOLUTION_BUCKET_COUNT] = {
+        "до 1 Мп", "1-2 Мп", "2-5 Мп", "5-8 Мп", "8-12 Мп", "12-24 Мп", "от 24 Мп"
+    };
+
+    if (bucket < 0 || bucket >= RESOLUTION_BUCKET_COUNT)
+    {
+        return "?";
+    }
+
+    return bucket_labels[bucket];
+}
+
+/******************************************************************************
+ * Функция: column_store_initialize
+ *
+ * Описание: Инициализирует пустое столбцовое представление.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int column_store_initialize(ColumnStore* store)
+{
+    if (store == NULL)
+    {
+        return -1;
+    }
+
+    memset(store, 0, sizeof(*store));
+    string_dictionary_initialize(&store->categories);
+    string_dictionary_initialize(&store->formats);
+    string_dictionary_initialize(&store->places);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: column_store_release
+ *
+ * Описание: Освобождает память столбцового представления и его словарей.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int column_store_release(ColumnStore* store)
+{
+    if (store == NULL)
+    {
+        return -1;
+    }
+
+    memory_release(store->date_keys);
+    memory_release(store->sizes);
+    memory_release(store->widths);
+    memory_release(store->heights);
+    memory_release(store->category_ids);
+    memory_release(store->format_ids);
+    memory_release(store->place_ids);
+    memory_release(store->live_flags);
+    string_dictionary_release(&store->categories);
+    string_dictionary_release(&store->formats);
+    string_dictionary_release(&store->places);
+    memset(store, 0, sizeof(*store));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: column_store_append
+ *
+ * Описание: Добавляет запись в конец столбцов.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *   photo - добавляемая запись
+ *
+ * Возвращает: номер добавленной строки, -1 при нехватке памяти
+ ******************************************************************************/
+int column_store_append(ColumnStore* store, const Photo* photo)
+{
+    if (store == NULL)
+    {
+        return -1;
+    }
+
+    return column_store_set_row(store, store->row_count, photo);
+}
+
+/******************************************************************************
+ * Функция: column_store_set_row
+ *
+ * Описание: Записывает запись в строку столбцов с заданным номером
+ *           (перезапись существующей строки или добавление в конец).
+ *           Строковые поля заменяются номерами в словарях.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *   row - номер строки (не больше текущего количества строк)
+ *   photo - запись
+ *
+ * Возвращает: номер строки, -1 при ошибке или нехватке памяти
+ ******************************************************************************/
+int column_store_set_row(ColumnStore* store, int row, const Photo* photo)
+{
+    int category_id = 0;
+    int format_id = 0;
+    int place_id = 0;
+    int previous_subsystem = memory_enter(MEMORY_COLUMNS);
+
+    if (store == NULL || photo == NULL || row < 0 || row > store->row_count)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    if (row == store->row_capacity)
+    {
+        int new_capacity = store->row_capacity > 0 ? store->row_capacity * 2 : INITIAL_COLUMN_CAPACITY;
+
+        if (grow_array((void**)&store->date_keys, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->sizes, sizeof(double), new_capacity) != 0 ||
+            grow_array((void**)&store->widths, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->heights, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->category_ids, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->format_ids, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->place_ids, sizeof(int), new_capacity) != 0 ||
+            grow_array((void**)&store->live_flags, sizeof(unsigned char), new_capacity) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+        store->row_capacity = new_capacity;
+    }
+
+    category_id = string_dictionary_intern(&store->categories, photo->category);
+    format_id = string_dictionary_intern(&store->formats, photo->format);
+    place_id = string_dictionary_intern(&store->places, photo->place);
+    if (category_id < 0 || format_id < 0 || place_id < 0)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    if (row == store->row_count)
+    {
+        store->row_count++;
+    }
+    store->date_keys[row] = parse_date_key(photo->date);
+    store->sizes[row] = photo->size;
+    store->widths[row] = photo->width;
+    store->heights[row] = photo->height;
+    store->category_ids[row] = category_id;
+    store->format_ids[row] = format_id;
+    store->place_ids[row] = place_id;
+    store->live_flags[row] = (unsigned char)(photo->is_deleted ? 0 : 1);
+    return memory_leave(previous_subsystem, row);
+}
+
+/******************************************************************************
+ * Функция: column_store_build
+ *
+ * Описание: Заново заполняет столбцы по массиву записей. Словари
+ *           сохраняются, поэтому номера строк в них не меняются.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int column_store_build(ColumnStore* store, const Photo database[], int record_count)
+{
+    int i = 0;
+    int previous_subsystem = memory_enter(MEMORY_COLUMNS);
+
+    if (store == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    store->row_count = 0;
+    for (i = 0; i < record_count; i++)
+    {
+        if (column_store_append(store, &database[i]) < 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+    }
+
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: group_table_initialize
+ *
+ * Описание: Инициализирует пустую таблицу групп.
+ *
+ * Параметры:
+ *   table - таблица групп
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int group_table_initialize(GroupTable* table)
+{
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    memset(table, 0, sizeof(*table));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: group_table_release
+ *
+ * Описание: Освобождает память таблицы групп.
+ *
+ * Параметры:
+ *   table - таблица групп
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int group_table_release(GroupTable* table)
+{
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    memory_release(table->groups);
+    memory_release(table->hash_slots);
+    memset(table, 0, sizeof(*table));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: group_table_find
+ *
+ * Описание: Ищет группу по ключу.
+ *
+ * Параметры:
+ *   table - таблица групп
+ *   key - ключ группы
+ *
+ * Возвращает: указатель на группу или NULL, если группы нет
+ ******************************************************************************/
+GroupStats* group_table_find(const GroupTable* table, int key)
+{
+    unsigned int slot = 0;
+
+    if (table == NULL || table->hash_capacity == 0)
+    {
+        return NULL;
+    }
+
+    slot = ((unsigned int)key * 2654435761u) & (unsigned int)(table->hash_capacity - 1);
+    while (table->hash_slots[slot] >= 0)
+    {
+        if (table->groups[table->hash_slots[slot]].key == key)
+        {
+            return &table->groups[table->hash_slots[slot]];
+        }
+        slot = (slot + 1) & (unsigned int)(table->hash_capacity - 1);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Функция: group_table_accumulate
+ *
+ * Описание: Добавляет значение показателя в группу с заданным ключом,
+ *           создавая группу при необходимости.
+ *
+ * Параметры:
+ *   table - таблица групп
+ *   key - ключ группы
+ *   value - значение показателя
+ *
+ * Возвращает: указатель на группу, NULL при нехватке памяти
+ ******************************************************************************/
+GroupStats* group_table_accumulate(GroupTable* table, int key, double value)
+{
+    GroupStats* group = group_table_find(table, key);
+    unsigned int slot = 0;
+    int i = 0;
+
+    if (group != NULL && group->count == 0)
+    {
+        /* Группа опустела после удалений - начинается заново */
+        group->count = 1;
+        group->sum = value;
+        group->min = value;
+        group->max = value;
+        return group;
+    }
+
+    if (group != NULL)
+    {
+        group->count++;
+        group->sum += value;
+        if (value < group->min)
+        {
+            group->min = value;
+        }
+        if (value > group->max)
+        {
+            group->max = value;
+        }
+        return group;
+    }
+
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    /* Перестроение хеш-таблицы при заполнении наполовину */
+    if ((table->group_count + 1) * 2 > table->hash_capacity)
+    {
+        int new_capacity = table->hash_capacity > 0 ? table->hash_capacity * 2 : 16;
+        int* new_slots = (int*)memory_allocate((size_t)new_capacity * sizeof(int));
+
+        if (new_slots == NULL)
+        {
+            return NULL;
+        }
+
+        for (i = 0; i < new_capacity; i++)
+        {
+            new_slots[i] = -1;
+        }
+        for (i = 0; i < table->group_count; i++)
+        {
+            slot = ((unsigned int)table->groups[i].key * 2654435761u) & (unsigned int)(new_capacity - 1);
+            while (new_slots[slot] >= 0)
+            {
+                slot = (slot + 1) & (unsigned int)(new_capacity - 1);
+            }
+            new_slots[slot] = i;
+        }
+
+        memory_release(table->hash_slots);
+        table->hash_slots = new_slots;
+        table->hash_capacity = new_capacity;
+    }
+
+    if (table->group_count == table->group_capacity)
+    {
+        int new_capacity = table->group_capacity > 0 ? table->group_capacity * 2 : 8;
+        if (grow_array((void**)&table->groups, sizeof(GroupStats), new_capacity) != 0)
+        {
+            return NULL;
+        }
+        table->group_capacity = new_capacity;
+    }
+
+    group = &table->groups[table->group_count];
+    group->key = key;
+    group->count = 1;
+    group->sum = value;
+    group->min = value;
+    group->max = value;
+
+    slot = ((unsigned int)key * 2654435761u) & (unsigned int)(table->hash_capacity - 1);
+    while (table->hash_slots[slot] >= 0)
+    {
+        slot = (slot + 1) & (unsigned int)(table->hash_capacity - 1);
+    }
+    table->hash_slots[slot] = table->group_count++;
+
+    return group;
+}
+
+/******************************************************************************
+ * Функция: group_table_subtract
+ *
+ * Описание: Вычитает значение показателя из группы с заданным ключом.
+ *           Количество и сумма пересчитываются точно; минимум и максимум
+ *           по одному вычитанию восстановить нельзя, поэтому сообщается,
+ *           что они могли устареть.
+ *
+ * Параметры:
+ *   table - таблица групп
+ *   key - ключ группы
+ *   value - значение показателя
+ *
+ * Возвращает: 0 при успехе, 1 если минимум или максимум группы устарел,
+ *             -1 если группы нет
+ ******************************************************************************/
+int group_table_subtract(GroupTable* table, int key, double value)
+{
+    GroupStats* group = group_table_find(table, key);
+
+    if (group == NULL || group->count == 0)
+    {
+        return -1;
+    }
+
+    group->count--;
+    group->sum -= value;
+    if (group->count == 0)
+    {
+        group->sum = 0.0;
+        return 0;
+    }
+
+    return (value <= group->min || value >= group->max) ? 1 : 0;
+}
+
+/******************************************************************************
+ * Функция: archive_rollups_initialize
+ *
+ * Описание: Инициализирует пустые сводки.
+ *
+ * Параметры:
+ *   rollups - сводки архива
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int archive_rollups_initialize(ArchiveRollups* rollups)
+{
+    if (rollups == NULL)
+    {
+        return -1;
+    }
+
+    rollups->total_count = 0;
+    rollups->total_size = 0.0;
+    rollups->extremes_stale = 0;
+    group_table_initialize(&rollups->by_category);
+    group_table_initialize(&rollups->by_format);
+    group_table_initialize(&rollups->by_month);
+    group_table_initialize(&rollups->by_resolution);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: archive_rollups_release
+ *
+ * Описание: Освобождает память сводок.
+ *
+ * Параметры:
+ *   rollups - сводки архива
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int archive_rollups_release(ArchiveRollups* rollups)
+{
+    if (rollups == NULL)
+    {
+        return -1;
+    }
+
+    group_table_release(&rollups->by_category);
+    group_table_release(&rollups->by_format);
+    group_table_release(&rollups->by_month);
+    group_table_release(&rollups->by_resolution);
+    return archive_rollups_initialize(rollups);
+}
+
+/******************************************************************************
+ * Функция: archive_rollups_add
+ *
+ * Описание: Учитывает одну строку столбцового представления в сводках.
+ *           Выполняется за O(1) при каждом добавлении записи.
+ *
+ * Параметры:
+ *   rollups - сводки архива
+ *   store - столбцовое представление
+ *   row - номер строки
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_rollups_add(ArchiveRollups* rollups, const ColumnStore* store, int row)
+{
+    double size = store->sizes[row];
+    int previous_subsystem = memory_enter(MEMORY_ROLLUPS);
+
+    rollups->total_count++;
+    rollups->total_size += size;
+
+    if (group_table_accumulate(&rollups->by_category, store->category_ids[row], size) == NULL ||
+        group_table_accumulate(&rollups->by_format, store->format_ids[row], size) == NULL ||
+        group_table_accumulate(&rollups->by_month, store->date_keys[row] / 100, size) == NULL ||
+        group_table_accumulate(&rollups->by_resolution,
+            resolution_bucket(store->widths[row], store->heights[row]), size) == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: archive_rollups_remove
+ *
+ * Описание: Вычитает одну строку столбцового представления из сводок.
+ *           Если удаленное значение было минимумом или максимумом группы,
+ *           сводки помечаются для пересчета перед следующим выводом.
+ *
+ * Параметры:
+ *   rollups - сводки архива
+ *   store - столбцовое представление
+ *   row - номер строки
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int archive_rollups_remove(ArchiveRollups* rollups, const ColumnStore* store, int row)
+{
+    double size = 0.0;
+    int stale_groups = 0;
+
+    if (rollups == NULL || store == NULL || row < 0 || row >= store->row_count)
+    {
+        return -1;
+    }
+
+    size = store->sizes[row];
+    rollups->total_count--;
+    rollups->total_size -= size;
+
+    /* Каждая таблица обновляется независимо от результата предыдущей */
+    stale_groups += group_table_subtract(&rollups->by_category, store->category_ids[row], size) != 0;
+    stale_groups += group_table_subtract(&rollups->by_format, store->format_ids[row], size) != 0;
+    stale_groups += group_table_subtract(&rollups->by_month, store->date_keys[row] / 100, size) != 0;
+    stale_groups += group_table_subtract(&rollups->by_resolution,
+        resolution_bucket(store->widths[row], store->heights[row]), size) != 0;
+    if (stale_groups > 0)
+    {
+        rollups->extremes_stale = 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: archive_rollups_rebuild
+ *
+ * Описание: Заново вычисляет сводки по всем существующим строкам.
+ *
+ * Параметры:
+ *   rollups - сводки архива
+ *   store - столбцовое представление
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_rollups_rebuild(ArchiveRollups* rollups, const ColumnStore* store)
+{
+    int row = 0;
+    int previous_subsystem = memory_enter(MEMORY_ROLLUPS);
+
+    if (rollups == NULL || store == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    archive_rollups_release(rollups);
+    for (row = 0; row < store->row_count; row++)
+    {
+        if (store->live_flags[row] && archive_rollups_add(rollups, store, row) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+    }
+
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: aggregate_column_store
+ *
+ * Описание: Группирует записи по выбранному полю и вычисляет количество,
+ *           сумму, минимум и максимум показателя. Ключи групп и значения
+ *           показателя сначала извлекаются из столбцов простыми циклами,
+ *           затем агрегируются за один проход.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *   group_field - поле группировки (GROUP_BY_...)
+ *   measure - агрегируемый показатель (MEASURE_...)
+ *   result - инициализированная пустая таблица групп для результата
+ *
+ * Возвращает: количество групп, -1 при ошибке
+ ******************************************************************************/
+int aggregate_column_store(const ColumnStore* store, int group_field, int measure,
+    GroupTable* result)
+{
+    int* group_keys = NULL;
+    double* measure_values = NULL;
+    int row_count = 0;
+    int i = 0;
+
+    if (store == NULL || result == NULL)
+    {
+        return -1;
+    }
+
+    row_count = store->row_count;
+    group_keys = (int*)memory_allocate((size_t)(row_count > 0 ? row_count : 1) * sizeof(int));
+    measure_values = (double*)memory_allocate((size_t)(row_count > 0 ? row_count : 1) * sizeof(double));
+    if (group_keys == NULL || measure_values == NULL)
+    {
+        memory_release(group_keys);
+        memory_release(measure_values);
+        return -1;
+    }
+
+    switch (group_field)
+    {
+    case GROUP_BY_CATEGORY:
+        memcpy(group_keys, store->category_ids, (size_t)row_count * sizeof(int));
+        break;
+    case GROUP_BY_FORMAT:
+        memcpy(group_keys, store->format_ids, (size_t)row_count * sizeof(int));
+        break;
+    case GROUP_BY_PLACE:
+        memcpy(group_keys, store->place_ids, (size_t)row_count * sizeof(int));
+        break;
+    case GROUP_BY_YEAR:
+        for (i = 0; i < row_count; i++)
+        {
+            group_keys[i] = store->date_keys[i] / 10000;
+        }
+        break;
+    case GROUP_BY_MONTH:
+        for (i = 0; i < row_count; i++)
+        {
+            group_keys[i] = store->date_keys[i] / 100;
+        }
+        break;
+    case GROUP_BY_DATE:
+        memcpy(group_keys, store->date_keys, (size_t)row_count * sizeof(int));
+        break;
+    default:
+        for (i = 0; i < row_count; i++)
+        {
+            group_keys[i] = resolution_bucket(store->widths[i], store->heights[i]);
+        }
+        break;
+    }
+
+    switch (measure)
+    {
+    case MEASURE_WIDTH:
+        for (i = 0; i < row_count; i++)
+        {
+            measure_values[i] = store->widths[i];
+        }
+        break;
+    case MEASURE_HEIGHT:
+        for (i = 0; i < row_count; i++)
+        {
+            measure_values[i] = store->heights[i];
+        }
+        break;
+    case MEASURE_MEGAPIXELS:
+        for (i = 0; i < row_count; i++)
+        {
+            measure_values[i] = (double)store->widths[i] * store->heights[i] / 1000000.0;
+        }
+        break;
+    default:
+        memcpy(measure_values, store->sizes, (size_t)row_count * sizeof(double));
+        break;
+    }
+
+    for (i = 0; i < row_count; i++)
+    {
+        if (store->live_flags[i] == 0)
+        {
+            continue;
+        }
+
+        if (group_table_accumulate(result, group_keys[i], measure_values[i]) == NULL)
+        {
+            memory_release(group_keys);
+            memory_release(measure_values);
+            return -1;
+        }
+    }
+
+    memory_release(group_keys);
+    memory_release(measure_values);
+    return result->group_count;
+}
+
+/******************************************************************************
+ * Функция: format_group_label
+ *
+ * Описание: Формирует подпись группы по ее ключу.
+ *
+ * Параметры:
+ *   store - столбцовое представление (для словарей)
+ *   group_field - поле группировки (GROUP_BY_...)
+ *   key - ключ группы
+ *   label - буфер для подписи
+ *   label_size - размер буфера
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int format_group_label(const ColumnStore* store, int group_field, int key,
+    char* label, size_t label_size)
+{
+    const StringDictionary* dictionary = NULL;
+
+    switch (group_field)
+    {
+    case GROUP_BY_CATEGORY:
+        dictionary = &store->categories;
+        break;
+    case GROUP_BY_FORMAT:
+        dictionary = &store->formats;
+        break;
+    case GROUP_BY_PLACE:
+        dictionary = &store->places;
+        break;
+    case GROUP_BY_YEAR:
+        snprintf(label, label_size, "%04d", key);
+        return 0;
+    case GROUP_BY_MONTH:
+        snprintf(label, label_size, "%04d-%02d", key / 100, key % 100);
+        return 0;
+    case GROUP_BY_DATE:
+        snprintf(label, label_size, "%04d-%02d-%02d", key / 10000, key / 100 % 100, key % 100);
+        return 0;
+    default:
+        snprintf(label, label_size, "%s", resolution_bucket_label(key));
+        return 0;
+    }
+
+    if (key < 0 || key >= dictionary->value_count)
+    {
+        snprintf(label, label_size, "?");
+        return -1;
+    }
+
+    snprintf(label, label_size, "%s", dictionary->values[key]);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: compare_groups_by_count
+ *
+ * Описание: Функция сравнения для qsort: группы по убыванию количества
+ *           записей, при равенстве - по возрастанию ключа.
+ *
+ * Параметры:
+ *   first_group - указатель на первую группу
+ *   second_group - указатель на вторую группу
+ *
+ * Возвращает: результат сравнения для qsort
+ ******************************************************************************/
+int compare_groups_by_count(const void* first_group, const void* second_group)
+{
+    const GroupStats* group_a = (const GroupStats*)first_group;
+    const GroupStats* group_b = (const GroupStats*)second_group;
+
+    if (group_a->count != group_b->count)
+    {
+        return (group_a->count < group_b->count) - (group_a->count > group_b->count);
+    }
+
+    return (group_a->key > group_b->key) - (group_a->key < group_b->key);
+}
+
+/******************************************************************************
+ * Функция: print_group_table
+ *
+ * Описание: Выводит таблицу групп по убыванию количества записей.
+ *
+ * Параметры:
+ *   store - столбцовое представление (для подписей групп)
+ *   table - таблица групп
+ *   group_field - поле группировки (GROUP_BY_...)
+ *   measure_name - название агрегируемого показателя
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int print_group_table(const ColumnStore* store, const GroupTable* table, int group_field,
+    const char* measure_name)
+{
+    GroupStats* sorted_groups = NULL;
+    char label[MAX_PLACE_LEN];
+    int i = 0;
+
+    if (table->group_count == 0)
+    {
+        printf("Нет данных.\n");
+        return 0;
+    }
+
+    sorted_groups = (GroupStats*)memory_allocate((size_t)table->group_count * sizeof(GroupStats));
+    if (sorted_groups == NULL)
+    {
+        return -1;
+    }
+    memcpy(sorted_groups, table->groups, (size_t)table->group_count * sizeof(GroupStats));
+    qsort(sorted_groups, table->group_count, sizeof(GroupStats), compare_groups_by_count);
+
+    printf("%-20s %7s  %-28s\n", "Группа", "Кол-во", measure_name);
+    printf("%-20s %7s  %10s %10s %10s %10s\n", "", "", "сумма", "среднее", "мин", "макс");
+    for (i = 0; i < table->group_count; i++)
+    {
+        if (sorted_groups[i].count == 0)
+        {
+            continue;
+        }
+
+        format_group_label(store, group_field, sorted_groups[i].key, label, sizeof(label));
+        printf("%-20.20s %7ld  %10.2f %10.2f %10.2f %10.2f\n",
+            label,
+            sorted_groups[i].count,
+            sorted_groups[i].sum,
+            sorted_groups[i].sum / sorted_groups[i].count,
+            sorted_groups[i].min,
+            sorted_groups[i].max);
+    }
+
+    memory_release(sorted_groups);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: display_archive_statistics
+ *
+ * Описание: Выводит готовые сводки архива (без просмотра записей) и
+ *           предлагает выполнить произвольную группировку.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int display_archive_statistics(ArchiveIndexes* indexes)
+{
+    ArchiveRollups* rollups = NULL;
+    char answer = 'n';
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    rollups = &indexes->rollups;
+    if (rollups->extremes_stale && archive_rollups_rebuild(rollups, &indexes->columns) != 0)
+    {
+        return -1;
+    }
+
+    if (rollups->total_count == 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    printf("\n");
+    print_horizontal_separator();
+    printf("             СТАТИСТИКА АРХИВА             \n");
+    print_horizontal_separator();
+    printf("Всего фотографий: %ld, общий размер: %.2f МБ\n",
+        rollups->total_count, rollups->total_size);
+    printf("Свободных ячеек после удаления: %d, выполнено уплотнений: %ld\n",
+        indexes->free_slots.count, indexes->free_slots.compaction_count);
+
+    printf("\nПо категориям:\n");
+    print_group_table(&indexes->columns, &rollups->by_category, GROUP_BY_CATEGORY, "Размер, МБ");
+    printf("\nПо форматам:\n");
+    print_group_table(&indexes->columns, &rollups->by_format, GROUP_BY_FORMAT, "Размер, МБ");
+    printf("\nПо месяцам:\n");
+    print_group_table(&indexes->columns, &rollups->by_month, GROUP_BY_MONTH, "Размер, МБ");
+    printf("\nПо разрешению:\n");
+    print_group_table(&indexes->columns, &rollups->by_resolution, GROUP_BY_RESOLUTION, "Размер, МБ");
+    print_horizontal_separator();
+
+    printf("Выполнить произвольную группировку? (y/n): ");
+    if (scanf(" %c", &answer) == 1 && (answer == 'y' || answer == 'Y'))
+    {
+        clear_stdin_buffer();
+        return run_group_by_query(&indexes->columns);
+    }
+    clear_stdin_buffer();
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: run_group_by_query
+ *
+ * Описание: Запрашивает у пользователя поле группировки и показатель,
+ *           выполняет агрегацию и выводит результат.
+ *
+ * Параметры:
+ *   store - столбцовое представление
+ *
+ * Возвращает: 0 при успешном выполнении, -1 при ошибке
+ ******************************************************************************/
+int run_group_by_query(const ColumnStore* store)
+{
+    static const char* measure_names[MEASURE_COUNT] = {
+        "", "Размер, МБ", "Ширина, пикс.", "Высота, пикс.", "Разрешение, Мп"
+    };
+    GroupTable result;
+    int group_field = 0;
+    int measure = 0;
+    int operation_result = 0;
+
+    printf("Группировать по: 1 - категории, 2 - формату, 3 - месту, 4 - году,\n");
+    printf("                 5 - месяцу, 6 - дате, 7 - разрешению: ");
+    if (scanf("%d", &group_field) != 1 || group_field < 1 || group_field >= GROUP_BY_FIELD_COUNT)
+    {
+        clear_stdin_buffer();
+        printf("Ошибка: Неверное поле группировки.\n");
+        return -1;
+    }
+    clear_stdin_buffer();
+
+    printf("Показатель: 1 - размер, 2 - ширина, 3 - высота, 4 - мегапиксели: ");
+    if (scanf("%d", &measure) != 1 || measure < 1 || measure >= MEASURE_COUNT)
+    {
+        clear_stdin_buffer();
+        printf("Ошибка: Неверный показатель.\n");
+        return -1;
+    }
+    clear_stdin_buffer();
+
+    group_table_initialize(&result);
+    if (aggregate_column_store(store, group_field, measure, &result) < 0)
+    {
+        group_table_release(&result);
+        printf("Ошибка: Недостаточно памяти для группировки.\n");
+        return -1;
+    }
+
+    printf("\n");
+    operation_result = print_group_table(store, &result, group_field, measure_names[measure]);
+    group_table_release(&result);
+    return operation_result;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_initialize
+ *
+ * Описание: Инициализирует пустые вспомогательные структуры архива.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int archive_indexes_initialize(ArchiveIndexes* indexes)
+{
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    query_cache_initialize(&indexes->query_cache, QUERY_CACHE_BUDGET_BYTES);
+    column_store_initialize(&indexes->columns);
+    archive_rollups_initialize(&indexes->rollups);
+    trigram_index_initialize(&indexes->place_trigrams);
+    partition_table_initialize(&indexes->partitions);
+    fuzzy_index_initialize(&indexes->name_fuzzy);
+    fuzzy_index_initialize(&indexes->place_fuzzy);
+    kd_tree_initialize(&indexes->dimensions);
+    completion_trie_initialize(&indexes->place_completions);
+    completion_trie_initialize(&indexes->category_completions);
+    completion_trie_initialize(&indexes->tag_completions);
+    segment_directory_initialize(&indexes->segments);
+    memset(&indexes->free_slots, 0, sizeof(indexes->free_slots));
+    indexes->suspended_indexes = 0;
+    indexes->pending_indexes = 0;
+    indexes->rebuild_position = 0;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_build
+ *
+ * Описание: Строит все вспомогательные структуры по загруженным записям.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_build(ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    int row = 0;
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    query_cache_clear(&indexes->query_cache);
+    indexes->free_slots.count = 0;
+    for (row = record_count - 1; row >= 0; row--)
+    {
+        if (database[row].is_deleted && free_slot_list_push(&indexes->free_slots, row) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (column_store_build(&indexes->columns, database, record_count) != 0 ||
+        archive_rollups_rebuild(&indexes->rollups, &indexes->columns) != 0 ||
+        completion_tries_build(indexes, database, record_count) != 0)
+    {
+        return -1;
+    }
+
+    return search_indexes_build(indexes, database, record_count);
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_on_insert
+ *
+ * Описание: Обновляет вспомогательные структуры после добавления записи:
+ *           сбрасывает затронутые элементы кэша, дописывает строку в
+ *           столбцы, индексы поиска и сводки.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_index - индекс добавленной записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_on_insert(ArchiveIndexes* indexes, const Photo database[], int record_index)
+{
+    const Photo* photo = &database[record_index];
+    int maintained = 0;
+    int row = 0;
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    maintained = search_indexes_maintained(indexes, record_index);
+    query_cache_invalidate_for_record(&indexes->query_cache, photo);
+
+    /* Повторно занятая ячейка перезаписывает свою строку в столбцах */
+    row = column_store_set_row(&indexes->columns, record_index, photo);
+    if (row < 0 ||
+        search_indexes_add_record(indexes, photo, record_index, maintained) != 0 ||
+        ((maintained & SEARCH_INDEX_DIMENSIONS) != 0 &&
+            kd_tree_insert(&indexes->dimensions, photo, record_index) != 0) ||
+        completion_tries_adjust_record(indexes, photo, 1) != 0)
+    {
+        return -1;
+    }
+
+    return archive_rollups_add(&indexes->rollups, &indexes->columns, row);
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_on_update
+ *
+ * Описание: Обновляет вспомогательные структуры после изменения записи на
+ *           месте: сбрасывает элементы кэша, затронутые старой и новой
+ *           версией, вычитает старую строку из сводок и подсказок и
+ *           учитывает новую, переносит запись в индексах поиска.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_index - индекс измененной записи
+ *   old_photo - копия записи до изменения
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_on_update(ArchiveIndexes* indexes, const Photo database[], int record_index,
+    const Photo* old_photo)
+{
+    const Photo* new_photo = &database[record_index];
+    int maintained = 0;
+
+    if (indexes == NULL || old_photo == NULL)
+    {
+        return -1;
+    }
+
+    maintained = search_indexes_maintained(indexes, record_index);
+    query_cache_invalidate_for_record(&indexes->query_cache, old_photo);
+    query_cache_invalidate_for_record(&indexes->query_cache, new_photo);
+
+    archive_rollups_remove(&indexes->rollups, &indexes->columns, record_index);
+    completion_tries_adjust_record(indexes, old_photo, -1);
+    if (column_store_set_row(&indexes->columns, record_index, new_photo) < 0 ||
+        archive_rollups_add(&indexes->rollups, &indexes->columns, record_index) != 0 ||
+        completion_tries_adjust_record(indexes, new_photo, 1) != 0)
+    {
+        return -1;
+    }
+
+    if (strcmp(old_photo->place_key, new_photo->place_key) != 0)
+    {
+        trigram_index_remove(&indexes->place_trigrams, old_photo->place_key, record_index);
+        fuzzy_index_remove(&indexes->place_fuzzy, old_photo->place_key, record_index);
+        if (((maintained & SEARCH_INDEX_TRIGRAMS) != 0 &&
+                trigram_index_add(&indexes->place_trigrams, new_photo->place_key, record_index) != 0) ||
+            ((maintained & SEARCH_INDEX_FUZZY) != 0 &&
+                fuzzy_index_add(&indexes->place_fuzzy, new_photo->place_key, record_index) != 0))
+        {
+            return -1;
+        }
+    }
+
+    if (strcmp(old_photo->name_key, new_photo->name_key) != 0 &&
+        (maintained & SEARCH_INDEX_FUZZY) != 0)
+    {
+        fuzzy_index_remove(&indexes->name_fuzzy, old_photo->name_key, record_index);
+        if (fuzzy_index_add(&indexes->name_fuzzy, new_photo->name_key, record_index) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if ((strcmp(old_photo->tags_key, new_photo->tags_key) != 0 ||
+        strcmp(old_photo->date, new_photo->date) != 0) && (maintained & SEARCH_INDEX_PARTITIONS) != 0)
+    {
+        partition_table_remove(&indexes->partitions, old_photo, record_index);
+        if (partition_table_add(&indexes->partitions, new_photo, record_index) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if ((old_photo->width != new_photo->width || old_photo->height != new_photo->height ||
+        old_photo->size != new_photo->size) && (maintained & SEARCH_INDEX_DIMENSIONS) != 0)
+    {
+        kd_tree_remove(&indexes->dimensions, old_photo, record_index);
+        if (kd_tree_insert(&indexes->dimensions, new_photo, record_index) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_on_delete
+ *
+ * Описание: Обновляет вспомогательные структуры после пометки записи как
+ *           удаленной: сбрасывает затронутые элементы кэша, вычитает строку
+ *           из сводок, убирает запись из индексов поиска и помещает ячейку
+ *           в список свободных.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   old_photo - копия записи до удаления
+ *   record_index - индекс удаленной записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_on_delete(ArchiveIndexes* indexes, const Photo* old_photo, int record_index)
+{
+    if (indexes == NULL || old_photo == NULL)
+    {
+        return -1;
+    }
+
+    query_cache_invalidate_for_record(&indexes->query_cache, old_photo);
+
+    if (record_index < indexes->columns.row_count && indexes->columns.live_flags[record_index])
+    {
+        archive_rollups_remove(&indexes->rollups, &indexes->columns, record_index);
+        indexes->columns.live_flags[record_index] = 0;
+    }
+
+    trigram_index_remove(&indexes->place_trigrams, old_photo->place_key, record_index);
+    partition_table_remove(&indexes->partitions, old_photo, record_index);
+    fuzzy_index_remove(&indexes->name_fuzzy, old_photo->name_key, record_index);
+    fuzzy_index_remove(&indexes->place_fuzzy, old_photo->place_key, record_index);
+    kd_tree_remove(&indexes->dimensions, old_photo, record_index);
+    completion_tries_adjust_record(indexes, old_photo, -1);
+
+    return free_slot_list_push(&indexes->free_slots, record_index);
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_on_reorder
+ *
+ * Описание: Обновляет вспомогательные структуры после перестановки записей
+ *           (например, сортировки). Сводки от порядка не зависят.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_on_reorder(ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    /* Сохраненные в кэше и индексах номера записей больше недействительны */
+    query_cache_clear(&indexes->query_cache);
+    if (column_store_build(&indexes->columns, database, record_count) != 0)
+    {
+        return -1;
+    }
+
+    return search_indexes_build(indexes, database, record_count);
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_release
+ *
+ * Описание: Освобождает память всех вспомогательных структур.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int archive_indexes_release(ArchiveIndexes* indexes)
+{
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    query_cache_release(&indexes->query_cache);
+    column_store_release(&indexes->columns);
+    archive_rollups_release(&indexes->rollups);
+    trigram_index_release(&indexes->place_trigrams);
+    partition_table_release(&indexes->partitions);
+    fuzzy_index_release(&indexes->name_fuzzy);
+    fuzzy_index_release(&indexes->place_fuzzy);
+    kd_tree_release(&indexes->dimensions);
+    completion_trie_release(&indexes->place_completions);
+    completion_trie_release(&indexes->category_completions);
+    completion_trie_release(&indexes->tag_completions);
+    segment_directory_release(&indexes->segments);
+    memory_release(indexes->free_slots.slots);
+    memset(&indexes->free_slots, 0, sizeof(indexes->free_slots));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: output_buffer_initialize
+ *
+ * Описание: Подготавливает буфер вывода над заданной памятью.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   stream - поток, в который сбрасывается буфер
+ *   storage - память для буфера
+ *   capacity - размер памяти в байтах
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int output_buffer_initialize(OutputBuffer* buffer, FILE* stream, char* storage, size_t capacity)
+{
+    if (buffer == NULL || stream == NULL || storage == NULL || capacity == 0)
+    {
+        return -1;
+    }
+
+    buffer->stream = stream;
+    buffer->data = storage;
+    buffer->capacity = capacity;
+    buffer->length = 0;
+    buffer->write_error = 0;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: output_buffer_flush
+ *
+ * Описание: Записывает накопленные данные в поток одним вызовом fwrite.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *
+ * Возвращает: 0 при успехе, -1 если при записи возникла ошибка
+ ******************************************************************************/
+int output_buffer_flush(OutputBuffer* buffer)
+{
+    if (buffer->length > 0)
+    {
+        if (fwrite(buffer->data, 1, buffer->length, buffer->stream) != buffer->length)
+        {
+            buffer->write_error = 1;
+        }
+        buffer->length = 0;
+    }
+
+    return buffer->write_error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: output_append_bytes
+ *
+ * Описание: Добавляет байты в буфер, при заполнении сбрасывая его в поток.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   bytes - добавляемые байты
+ *   byte_count - количество байт
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_bytes(OutputBuffer* buffer, const char* bytes, size_t byte_count)
+{
+    while (byte_count > 0)
+    {
+        size_t chunk = buffer->capacity - buffer->length;
+
+        if (chunk == 0)
+        {
+            output_buffer_flush(buffer);
+            continue;
+        }
+
+        if (chunk > byte_count)
+        {
+            chunk = byte_count;
+        }
+        memcpy(buffer->data + buffer->length, bytes, chunk);
+        buffer->length += chunk;
+        bytes += chunk;
+        byte_count -= chunk;
+    }
+
+    return buffer->write_error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: output_append_string
+ *
+ * Описание: Добавляет строку в буфер.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   text - добавляемая строка
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_string(OutputBuffer* buffer, const char* text)
+{
+    return output_append_bytes(buffer, text, strlen(text));
+}
+
+/******************************************************************************
+ * Функция: output_append_repeated
+ *
+ * Описание: Добавляет в буфер символ, повторенный заданное число раз.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   character - символ
+ *   repeat_count - количество повторений
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_repeated(OutputBuffer* buffer, char character, int repeat_count)
+{
+    while (repeat_count > 0)
+    {
+        if (buffer->length == buffer->capacity)
+        {
+            output_buffer_flush(buffer);
+        }
+        buffer->data[buffer->length++] = character;
+        repeat_count--;
+    }
+
+    return buffer->write_error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: output_append_padded
+ *
+ * Описание: Добавляет строку, выровненную по левому краю, аналогично
+ *           формату printf "%-W.Ms".
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   text - добавляемая строка
+ *   width - минимальная ширина поля
+ *   max_length - максимальное количество байт строки, -1 без ограничения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_padded(OutputBuffer* buffer, const char* text, int width, int max_length)
+{
+    int text_length = 0;
+
+    while (text[text_length] != '\0' && (max_length < 0 || text_length < max_length))
+    {
+        text_length++;
+    }
+
+    output_append_bytes(buffer, text, (size_t)text_length);
+    return output_append_repeated(buffer, ' ', width - text_length);
+}
+
+/******************************************************************************
+ * Функция: output_append_integer
+ *
+ * Описание: Добавляет целое число в десятичной записи без вызова printf.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   value - число
+ *   width - минимальная ширина поля (выравнивание по левому краю), 0 без
+ *           выравнивания
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_integer(OutputBuffer* buffer, long long value, int width)
+{
+    char digits[24];
+    int position = (int)sizeof(digits);
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value
+                                             : (unsigned long long)value;
+
+    do {
+        digits[--position] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+    {
+        digits[--position] = '-';
+    }
+
+    output_append_bytes(buffer, digits + position, sizeof(digits) - (size_t)position);
+    return output_append_repeated(buffer, ' ', width - ((int)sizeof(digits) - position));
+}
+
+/******************************************************************************
+ * Функция: output_append_fixed2
+ *
+ * Описание: Добавляет число с двумя знаками после запятой. Число
+ *           форматируется через "%.2f", поэтому округление совпадает с
+ *           файлом архива (write_photo_record); разделитель локали
+ *           заменяется заданным.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   value - число
+ *   decimal_point - символ десятичного разделителя
+ *   width - минимальная ширина поля (выравнивание по левому краю), 0 без
+ *           выравнивания
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_fixed2(OutputBuffer* buffer, double value, char decimal_point, int width)
+{
+    char digits[DBL_MAX_10_EXP + 8];  /* Целая часть наибольшего double, знак и дробь */
+    char* separator = NULL;
+    int length = snprintf(digits, sizeof(digits), "%.2f", value);
+
+    if (length < 0 || length >= (int)sizeof(digits))
+    {
+        return -1;
+    }
+
+    separator = strchr(digits, locale_decimal_point());
+    if (separator != NULL)
+    {
+        *separator = decimal_point;
+    }
+
+    output_append_bytes(buffer, digits, (size_t)length);
+    return output_append_repeated(buffer, ' ', width - length);
+}
+
+/******************************************************************************
+ * Функция: output_append_csv_field
+ *
+ * Описание: Добавляет поле CSV. Поля с запятыми, кавычками или переводами
+ *           строк заключаются в кавычки, кавычки внутри удваиваются.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   text - значение поля
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_csv_field(OutputBuffer* buffer, const char* text)
+{
+    if (strpbrk(text, ",\"\r\n") == NULL)
+    {
+        return output_append_string(buffer, text);
+    }
+
+    output_append_repeated(buffer, '"', 1);
+    while (*text != '\0')
+    {
+        size_t run_length = strcspn(text, "\"");
+
+        output_append_bytes(buffer, text, run_length);
+        text += run_length;
+        if (*text == '"')
+        {
+            output_append_repeated(buffer, '"', 2);
+            text++;
+        }
+    }
+
+    return output_append_repeated(buffer, '"', 1);
+}
+
+/******************************************************************************
+ * Функция: output_append_json_string
+ *
+ * Описание: Добавляет строку JSON в кавычках с экранированием кавычек,
+ *           обратной косой черты и управляющих символов. JSON допускает
+ *           только UTF-8, поэтому строка в CP1251 перекодируется;
+ *           строка, уже записанная в UTF-8, выводится как есть.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   text - значение строки
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int output_append_json_string(OutputBuffer* buffer, const char* text)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    int utf8_input = is_utf8_text(text);
+
+    output_append_repeated(buffer, '"', 1);
+    for (; *text != '\0'; text++)
+    {
+        unsigned char character = (unsigned char)*text;
+
+        if (character >= 0x80 && !utf8_input)
+        {
+            unsigned int code_point = cp1251_to_unicode(character);
+            char encoded[3];
+
+            if (code_point < 0x800)
+            {
+                encoded[0] = (char)(0xC0 | (code_point >> 6));
+                encoded[1] = (char)(0x80 | (code_point & 0x3F));
+                output_append_bytes(buffer, encoded, 2);
+            }
+            else
+            {
+                encoded[0] = (char)(0xE0 | (code_point >> 12));
+                encoded[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+                encoded[2] = (char)(0x80 | (code_point & 0x3F));
+                output_append_bytes(buffer, encoded, 3);
+            }
+        }
+        else if (character == '"' || character == '\\')
+        {
+            output_append_repeated(buffer, '\\', 1);
+            output_append_repeated(buffer, (char)character, 1);
+        }
+        else if (character < 0x20)
+        {
+            output_append_string(buffer, "\\u00");
+            output_append_repeated(buffer, hex_digits[character >> 4], 1);
+            output_append_repeated(buffer, hex_digits[character & 0x0F], 1);
+        }
+        else
+        {
+            output_append_repeated(buffer, (char)character, 1);
+        }
+    }
+
+    return output_append_repeated(buffer, '"', 1);
+}
+
+/******************************************************************************
+ * Функция: format_record_table_row
+ *
+ * Описание: Форматирует запись как строку таблицы просмотра
+ *           (эквивалент "%-3d%-17.17s%-12s%-15.15s%-12.12s%-8.2f  %dx%d   %s").
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   row_number - номер строки
+ *   photo - запись
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int format_record_table_row(OutputBuffer* buffer, int row_number, const Photo* photo)
+{
+    output_append_integer(buffer, row_number, 3);
+    output_append_padded(buffer, photo->name, 17, 17);
+    output_append_padded(buffer, photo->date, 12, -1);
+    output_append_padded(buffer, photo->place, 15, 15);
+    output_append_padded(buffer, photo->category, 12, 12);
+    output_append_fixed2(buffer, photo->size, locale_decimal_point(), 8);
+    output_append_string(buffer, "  ");
+    output_append_integer(buffer, photo->width, 0);
+    output_append_repeated(buffer, 'x', 1);
+    output_append_integer(buffer, photo->height, 0);
+    output_append_string(buffer, "   ");
+    output_append_string(buffer, photo->format);
+    return output_append_repeated(buffer, '\n', 1);
+}
+
+/******************************************************************************
+ * Функция: format_record_csv
+ *
+ * Описание: Форматирует запись как строку CSV. Размер выводится с точкой
+ *           независимо от локали.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   photo - запись
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int format_record_csv(OutputBuffer* buffer, const Photo* photo)
+{
+    const char* separator = "";
+
+#define SCHEMA_CSV_TEXT(field, length, label) \
+    output_append_string(buffer, separator); \
+    output_append_csv_field(buffer, photo->field); \
+    separator = ",";
+#define SCHEMA_CSV_REAL(field, label, view_label, view_suffix) \
+    output_append_string(buffer, separator); \
+    output_append_fixed2(buffer, photo->field, '.', 0); \
+    separator = ",";
+#define SCHEMA_CSV_INTEGER(field, label, view_label, view_suffix) \
+    output_append_string(buffer, separator); \
+    output_append_integer(buffer, photo->field, 0); \
+    separator = ",";
+    PHOTO_SCHEMA(SCHEMA_CSV_TEXT, SCHEMA_CSV_REAL, SCHEMA_CSV_INTEGER)
+#undef SCHEMA_CSV_TEXT
+#undef SCHEMA_CSV_REAL
+#undef SCHEMA_CSV_INTEGER
+
+    return output_append_repeated(buffer, '\n', 1);
+}
+
+/******************************************************************************
+ * Функция: format_record_json
+ *
+ * Описание: Форматирует запись как JSON-объект в одну строку.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *   photo - запись
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int format_record_json(OutputBuffer* buffer, const Photo* photo)
+{
+    const char* separator = "{";
+
+#define SCHEMA_JSON_TEXT(field, length, label) \
+    output_append_string(buffer, separator); \
+    output_append_string(buffer, "\"" #field "\":"); \
+    output_append_json_string(buffer, photo->field); \
+    separator = ",";
+#define SCHEMA_JSON_REAL(field, label, view_label, view_suffix) \
+    output_append_string(buffer, separator); \
+    output_append_string(buffer, "\"" #field "\":"); \
+    output_append_fixed2(buffer, photo->field, '.', 0); \
+    separator = ",";
+#define SCHEMA_JSON_INTEGER(field, label, view_label, view_suffix) \
+    output_append_string(buffer, separator); \
+    output_append_string(buffer, "\"" #field "\":"); \
+    output_append_integer(buffer, photo->field, 0); \
+    separator = ",";
+    PHOTO_SCHEMA(SCHEMA_JSON_TEXT, SCHEMA_JSON_REAL, SCHEMA_JSON_INTEGER)
+#undef SCHEMA_JSON_TEXT
+#undef SCHEMA_JSON_REAL
+#undef SCHEMA_JSON_INTEGER
+
+    return output_append_string(buffer, "}\n");
+}
+
+/******************************************************************************
+ * Функция: locale_decimal_point
+ *
+ * Описание: Возвращает десятичный разделитель текущей локали, чтобы числа
+ *           на экране выглядели так же, как при выводе через printf.
+ *
+ * Возвращает: символ десятичного разделителя
+ ******************************************************************************/
+char locale_decimal_point(void)
+{
+    const struct lconv* locale_info = localeconv();
+
+    if (locale_info == NULL || locale_info->decimal_point == NULL ||
+        locale_info->decimal_point[0] == '\0')
+    {
+        return '.';
+    }
+
+    return locale_info->decimal_point[0];
+}
+
+/******************************************************************************
+ * Функция: export_database
+ *
+ * Описание: Выводит все записи в поток в выбранном формате. Записи
+ *           форматируются в общий буфер, который сбрасывается в поток
+ *           блоками по OUTPUT_BUFFER_SIZE байт. Строки выводятся в той же
+ *           кодировке, что и в файле архива.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   export_format - формат вывода (EXPORT_FORMAT_...)
+ *   stream - поток вывода
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int export_database(const Photo database[], int record_count, int export_format, FILE* stream)
+{
+    static char export_storage[OUTPUT_BUFFER_SIZE];
+    OutputBuffer buffer;
+    int i = 0;
+
+    if (database == NULL || output_buffer_initialize(&buffer, stream, export_storage,
+        sizeof(export_storage)) != 0)
+    {
+        return -1;
+    }
+
+    /* Ранее выведенный через printf текст должен оказаться перед таблицей */
+    fflush(stream);
+
+    if (export_format == EXPORT_FORMAT_TABLE)
+    {
+        output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+        output_append_string(&buffer,
+            "\n№  Название          Дата       Место          Категория   Размер   Разрешение Формат\n");
+        output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+        output_append_repeated(&buffer, '\n', 1);
+    }
+    else if (export_format == EXPORT_FORMAT_CSV)
+    {
+        format_csv_header(&buffer);
+    }
+
+    for (i = 0; i < record_count; i++)
+    {
+        if (database[i].is_deleted)
+        {
+            continue;
+        }
+
+        switch (export_format)
+        {
+        case EXPORT_FORMAT_CSV:
+            format_record_csv(&buffer, &database[i]);
+            break;
+        case EXPORT_FORMAT_JSON_LINES:
+            format_record_json(&buffer, &database[i]);
+            break;
+        default:
+            format_record_table_row(&buffer, i + 1, &database[i]);
+            break;
+        }
+    }
+
+    if (export_format == EXPORT_FORMAT_TABLE)
+    {
+        output_append_repeated(&buffer, '=', SEPARATOR_WIDTH);
+        output_append_repeated(&buffer, '\n', 1);
+    }
+
+    if (output_buffer_flush(&buffer) != 0 || fflush(stream) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: export_database_interactive
+ *
+ * Описание: Запрашивает формат и имя файла и выполняет экспорт архива.
+ *           Пустое имя файла означает вывод на экран.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успешном экспорте, -1 при ошибке
+ ******************************************************************************/
+int export_database_interactive(const Photo database[], int record_count)
+{
+    char export_filename[FILENAME_MAX];
+    FILE* export_stream = NULL;
+    int export_format = 0;
+    int operation_result = 0;
+
+    if (record_count <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    printf("Формат экспорта: 1 - таблица, 2 - CSV, 3 - JSON Lines: ");
+    if (scanf("%d", &export_format) != 1 ||
+        export_format < EXPORT_FORMAT_TABLE || export_format > EXPORT_FORMAT_JSON_LINES)
+    {
+        clear_stdin_buffer();
+        printf("Ошибка: Неверный формат экспорта.\n");
+        return -1;
+    }
+    clear_stdin_buffer();
+
+    printf("Введите имя файла (Enter - вывод на экран): ");
+    if (fgets(export_filename, sizeof(export_filename), stdin) == NULL)
+    {
+        return -1;
+    }
+    export_filename[strcspn(export_filename, "\n")] = '\0';
+
+    if (export_filename[0] == '\0')
+    {
+        return export_database(database, record_count, export_format, stdout);
+    }
+
+    export_stream = fopen(export_filename, "w");
+    if (export_stream == NULL)
+    {
+        printf("Ошибка: Не удалось открыть файл '%s' для записи.\n", export_filename);
+        return -1;
+    }
+
+    operation_result = export_database(database, record_count, export_format, export_stream);
+    if (fclose(export_stream) != 0)
+    {
+        operation_result = -1;
+    }
+
+    if (operation_result == 0)
+    {
+        printf("Экспортировано записей: %d в файл '%s'.\n", record_count, export_filename);
+    }
+
+    return operation_result;
+}
+
+/******************************************************************************
+ * Функция: run_batch_export
+ *
+ * Описание: Пакетный режим: загружает архив и выводит его в стандартный
+ *           поток вывода без меню и приглашений.
+ *
+ * Параметры:
+ *   format_name - название формата: "table", "csv" или "jsonl"
+ *
+ * Возвращает: 0 при успешном экспорте, -1 при ошибке
+ ******************************************************************************/
+int run_batch_export(const char* format_name)
+{
+    static Photo database[MAX_PHOTOS];
+    ArchiveIndexes indexes;
+    int record_count = 0;
+    int export_format = 0;
+    int operation_result = 0;
+
+    if (strcmp(format_name, "table") == 0)
+    {
+        export_format = EXPORT_FORMAT_TABLE;
+    }
+    else if (strcmp(format_name, "csv") == 0)
+    {
+        export_format = EXPORT_FORMAT_CSV;
+    }
+    else if (strcmp(format_name, "jsonl") == 0)
+    {
+        export_format = EXPORT_FORMAT_JSON_LINES;
+    }
+    else
+    {
+        fprintf(stderr, "Неизвестный формат экспорта '%s' (table, csv, jsonl).\n", format_name);
+        return -1;
+    }
+
+    if (load_archive_for_batch(database, &record_count, &indexes) != 0)
+    {
+        return -1;
+    }
+
+    operation_result = export_database(database, record_count, export_format, stdout);
+    archive_indexes_release(&indexes);
+    return operation_result;
+}
+
+/******************************************************************************
+ * Функция: decode_utf8_cyrillic
+ *
+ * Описание: Распознает двухбайтовую последовательность UTF-8 кириллической
+ *           буквы и возвращает соответствующую строчную букву в CP1251
+ *           (буква Ё приводится к Е).
+ *
+ * Параметры:
+ *   text - указатель на первый байт последовательности
+ *   byte_count - указатель для возврата длины последовательности в байтах
+ *
+ * Возвращает: код строчной буквы в CP1251, -1 если это не кириллица
+ ******************************************************************************/
+int decode_utf8_cyrillic(const unsigned char* text, int* byte_count)
+{
+    int code_point = 0;
+
+    if ((text[0] & 0xE0) == 0xC0)
+    {
+        *byte_count = 2;
+    }
+    else if ((text[0] & 0xF0) == 0xE0)
+    {
+        *byte_count = 3;
+        return -1;
+    }
+    else if ((text[0] & 0xF8) == 0xF0)
+    {
+        *byte_count = 4;
+        return -1;
+    }
+    else
+    {
+        *byte_count = 1;
+        return -1;
+    }
+
+    code_point = ((text[0] & 0x1F) << 6) | (text[1] & 0x3F);
+    if (code_point >= 0x410 && code_point <= 0x42F)
+    {
+        return 0xE0 + (code_point - 0x410);
+    }
+    if (code_point >= 0x430 && code_point <= 0x44F)
+    {
+        return 0xE0 + (code_point - 0x430);
+    }
+    if (code_point == 0x401 || code_point == 0x451)
+    {
+        return 0xE5;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Функция: cp1251_to_unicode
+ *
+ * Описание: Возвращает кодовую точку Unicode символа CP1251. Кириллица
+ *           А-я (0xC0-0xFF) идет в Unicode подряд, остальные символы
+ *           старшей половины берутся из таблицы.
+ *
+ * Параметры:
+ *   character - символ CP1251
+ *
+ * Возвращает: кодовую точку (U+FFFD для неопределенного байта 0x98)
+ ******************************************************************************/
+unsigned int cp1251_to_unicode(unsigned char character)
+{
+    static const unsigned short upper_half[64] = {
+        0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+        0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0xFFFD, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+        0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+        0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+        0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+        0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457
+    };
+
+    if (character < 0x80)
+    {
+        return character;
+    }
+    if (character >= 0xC0)
+    {
+        return 0x410 + (character - 0xC0);
+    }
+
+    return upper_half[character - 0x80];
+}
+
+/******************************************************************************
+ * Функция: is_utf8_text
+ *
+ * Описание: Проверяет, является ли строка корректной последовательностью
+ *           UTF-8 с символами вне ASCII. Русский текст в CP1251 почти
+ *           никогда не образует корректный UTF-8.
+ *
+ * Параметры:
+ *   text - проверяемая строка
+ *
+ * Возвращает: 1 если строка в UTF-8, 0 если нет
+ ******************************************************************************/
+int is_utf8_text(const char* text)
+{
+    const unsigned char* position = (const unsigned char*)text;
+    int has_multibyte = 0;
+
+    while (*position != '\0')
+    {
+        int continuation_count = 0;
+        int i = 0;
+
+        if (*position < 0x80)
+        {
+            position++;
+            continue;
+        }
+
+        if ((*position & 0xE0) == 0xC0 && *position >= 0xC2)
+        {
+            continuation_count = 1;
+        }
+        else if ((*position & 0xF0) == 0xE0)
+        {
+            continuation_count = 2;
+        }
+        else if ((*position & 0xF8) == 0xF0 && *position <= 0xF4)
+        {
+            continuation_count = 3;
+        }
+        else
+        {
+            return 0;
+        }
+
+        for (i = 1; i <= continuation_count; i++)
+        {
+            if ((position[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+        }
+
+        position += continuation_count + 1;
+        has_multibyte = 1;
+    }
+
+    return has_multibyte;
+}
+
+/******************************************************************************
+ * Функция: fold_search_text
+ *
+ * Описание: Приводит строку к ключу поиска без учета регистра: латиница и
+ *           кириллица переводятся в нижний регистр, Ё - в Е. Строка может
+ *           быть в CP1251 или в UTF-8; результат всегда в CP1251, поэтому
+ *           запрос в любой из кодировок совпадает с ключами записей.
+ *           Длина результата не превышает длину исходной строки.
+ *
+ * Параметры:
+ *   text - исходная строка
+ *   folded - буфер для ключа
+ *   folded_size - размер буфера
+ *
+ * Возвращает: длину ключа
+ ******************************************************************************/
+int fold_search_text(const char* text, char* folded, size_t folded_size)
+{
+    const unsigned char* position = (const unsigned char*)text;
+    size_t length = 0;
+    int utf8_input = is_utf8_text(text);
+
+    while (*position != '\0' && length + 1 < folded_size)
+    {
+        unsigned char character = *position;
+
+        if (character < 0x80)
+        {
+            folded[length++] = (char)((character >= 'A' && character <= 'Z')
+                ? character + ('a' - 'A') : character);
+            position++;
+        }
+        else if (utf8_input)
+        {
+            int byte_count = 1;
+            int lower_letter = decode_utf8_cyrillic(position, &byte_count);
+
+            if (lower_letter >= 0)
+            {
+                folded[length++] = (char)lower_letter;
+            }
+            else if (length + (size_t)byte_count < folded_size)
+            {
+                memcpy(folded + length, position, (size_t)byte_count);
+                length += (size_t)byte_count;
+            }
+            else
+            {
+                break;
+            }
+            position += byte_count;
+        }
+        else
+        {
+            /* CP1251: А-Я (0xC0-0xDF) -> а-я (0xE0-0xFF), Ё/ё (0xA8/0xB8) -> е */
+            if (character >= 0xC0 && character <= 0xDF)
+            {
+                character = (unsigned char)(character + 0x20);
+            }
+            else if (character == 0xA8 || character == 0xB8)
+            {
+                character = 0xE5;
+            }
+            folded[length++] = (char)character;
+            position++;
+        }
+    }
+
+    folded[length] = '\0';
+    return (int)length;
+}
+
+/******************************************************************************
+ * Функция: photo_refresh_search_keys
+ *
+ * Описание: Вычисляет свернутые ключи поиска записи. Вызывается при
+ *           загрузке и при добавлении записи.
+ *
+ * Параметры:
+ *   photo - запись
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int photo_refresh_search_keys(Photo* photo)
+{
+    if (photo == NULL)
+    {
+        return -1;
+    }
+
+    fold_search_text(photo->name, photo->name_key, sizeof(photo->name_key));
+    fold_search_text(photo->place, photo->place_key, sizeof(photo->place_key));
+    fold_search_text(photo->tags, photo->tags_key, sizeof(photo->tags_key));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: compare_integers
+ *
+ * Описание: Функция сравнения целых чисел для qsort.
+ *
+ * Параметры:
+ *   first_value - указатель на первое число
+ *   second_value - указатель на второе число
+ *
+ * Возвращает: результат сравнения для qsort
+ ******************************************************************************/
+int compare_integers(const void* first_value, const void* second_value)
+{
+    int value_a = *(const int*)first_value;
+    int value_b = *(const int*)second_value;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+/******************************************************************************
+ * Функция: posting_list_insert
+ *
+ * Описание: Вставляет индекс записи в список с сохранением порядка
+ *           возрастания. Обычный случай - добавление в конец - выполняется
+ *           без поиска; повторная вставка того же индекса пропускается.
+ *
+ * Параметры:
+ *   list - список индексов
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int posting_list_insert(PostingList* list, int record_index)
+{
+    int position = list->count;
+
+    if (list->count > 0 && list->record_indices[list->count - 1] >= record_index)
+    {
+        /* Ячейка повторно занята после удаления - ищем место вставки */
+        int low = 0;
+        int high = list->count;
+
+        while (low < high)
+        {
+            int middle = low + (high - low) / 2;
+            if (list->record_indices[middle] < record_index)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        if (list->record_indices[low] == record_index)
+        {
+            return 0;
+        }
+        position = low;
+    }
+
+    if (list->count == list->capacity)
+    {
+        int new_capacity = list->capacity > 0 ? list->capacity * 2 : 4;
+        if (grow_array((void**)&list->record_indices, sizeof(int), new_capacity) != 0)
+        {
+            return -1;
+        }
+        list->capacity = new_capacity;
+    }
+
+    memmove(list->record_indices + position + 1, list->record_indices + position,
+        (size_t)(list->count - position) * sizeof(int));
+    list->record_indices[position] = record_index;
+    list->count++;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: posting_list_remove
+ *
+ * Описание: Удаляет индекс записи из упорядоченного списка.
+ *
+ * Параметры:
+ *   list - список индексов
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 если индекса в списке нет
+ ******************************************************************************/
+int posting_list_remove(PostingList* list, int record_index)
+{
+    int low = 0;
+    int high = list->count;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (list->record_indices[middle] < record_index)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low == list->count || list->record_indices[low] != record_index)
+    {
+        return -1;
+    }
+
+    memmove(list->record_indices + low, list->record_indices + low + 1,
+        (size_t)(list->count - low - 1) * sizeof(int));
+    list->count--;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: trigram_index_initialize
+ *
+ * Описание: Инициализирует пустой индекс триграмм.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int trigram_index_initialize(TrigramIndex* index)
+{
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    memset(index, 0, sizeof(*index));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: trigram_index_release
+ *
+ * Описание: Освобождает память индекса триграмм.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int trigram_index_release(TrigramIndex* index)
+{
+    int i = 0;
+
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < index->slot_count; i++)
+    {
+        memory_release(index->postings[i].record_indices);
+    }
+    memory_release(index->trigram_keys);
+    memory_release(index->postings);
+    return trigram_index_initialize(index);
+}
+
+/******************************************************************************
+ * Функция: trigram_index_find
+ *
+ * Описание: Ищет список записей, содержащих триграмму.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *   trigram - триграмма в виде трехбайтового числа
+ *
+ * Возвращает: список записей или NULL, если триграмма не встречается
+ ******************************************************************************/
+PostingList* trigram_index_find(const TrigramIndex* index, int trigram)
+{
+    unsigned int slot = 0;
+
+    if (index == NULL || index->slot_count == 0)
+    {
+        return NULL;
+    }
+
+    slot = ((unsigned int)trigram * 2654435761u) & (unsigned int)(index->slot_count - 1);
+    while (index->trigram_keys[slot] >= 0)
+    {
+        if (index->trigram_keys[slot] == trigram)
+        {
+            return &index->postings[slot];
+        }
+        slot = (slot + 1) & (unsigned int)(index->slot_count - 1);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Функция: trigram_index_get
+ *
+ * Описание: Возвращает список записей триграммы, добавляя ее в хеш-таблицу
+ *           при необходимости. Таблица перестраивается вдвое большей при
+ *           заполнении наполовину.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *   trigram - триграмма в виде трехбайтового числа
+ *
+ * Возвращает: список записей, NULL при нехватке памяти
+ ******************************************************************************/
+PostingList* trigram_index_get(TrigramIndex* index, int trigram)
+{
+    PostingList* list = trigram_index_find(index, trigram);
+    unsigned int slot = 0;
+
+    if (list != NULL)
+    {
+        return list;
+    }
+
+    if ((index->used_count + 1) * 2 > index->slot_count)
+    {
+        TrigramIndex grown;
+        int new_slot_count = index->slot_count > 0 ? index->slot_count * 2 : INITIAL_TRIGRAM_SLOTS;
+        int j = 0;
+
+        grown.slot_count = new_slot_count;
+        grown.used_count = index->used_count;
+        grown.trigram_keys = (int*)memory_allocate((size_t)new_slot_count * sizeof(int));
+        grown.postings = (PostingList*)memory_allocate_zeroed((size_t)new_slot_count,
+            sizeof(PostingList));
+        if (grown.trigram_keys == NULL || grown.postings == NULL)
+        {
+            memory_release(grown.trigram_keys);
+            memory_release(grown.postings);
+            return NULL;
+        }
+
+        for (j = 0; j < new_slot_count; j++)
+        {
+            grown.trigram_keys[j] = -1;
+        }
+        for (j = 0; j < index->slot_count; j++)
+        {
+            if (index->trigram_keys[j] >= 0)
+            {
+                slot = ((unsigned int)index->trigram_keys[j] * 2654435761u) &
+                    (unsigned int)(new_slot_count - 1);
+                while (grown.trigram_keys[slot] >= 0)
+                {
+                    slot = (slot + 1) & (unsigned int)(new_slot_count - 1);
+                }
+                grown.trigram_keys[slot] = index->trigram_keys[j];
+                grown.postings[slot] = index->postings[j];
+            }
+        }
+
+        memory_release(index->trigram_keys);
+        memory_release(index->postings);
+        *index = grown;
+    }
+
+    slot = ((unsigned int)trigram * 2654435761u) & (unsigned int)(index->slot_count - 1);
+    while (index->trigram_keys[slot] >= 0)
+    {
+        slot = (slot + 1) & (unsigned int)(index->slot_count - 1);
+    }
+    index->trigram_keys[slot] = trigram;
+    index->used_count++;
+    return &index->postings[slot];
+}
+
+/******************************************************************************
+ * Функция: trigram_index_add
+ *
+ * Описание: Добавляет запись в списки всех триграмм ее свернутого ключа.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *   folded_text - свернутый ключ записи
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int trigram_index_add(TrigramIndex* index, const char* folded_text, int record_index)
+{
+    const unsigned char* text = (const unsigned char*)folded_text;
+    size_t text_length = strlen(folded_text);
+    size_t i = 0;
+    int previous_subsystem = memory_enter(MEMORY_TRIGRAMS);
+
+    for (i = 0; i + TRIGRAM_LENGTH <= text_length; i++)
+    {
+        int trigram = (text[i] << 16) | (text[i + 1] << 8) | text[i + 2];
+        PostingList* list = trigram_index_get(index, trigram);
+
+        if (list == NULL || posting_list_insert(list, record_index) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+    }
+
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: trigram_index_remove
+ *
+ * Описание: Убирает запись из списков всех триграмм ее свернутого ключа.
+ *           Пустые списки остаются в таблице и заполняются снова при
+ *           следующих добавлениях.
+ *
+ * Параметры:
+ *   index - индекс триграмм
+ *   folded_text - свернутый ключ записи до изменения
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int trigram_index_remove(TrigramIndex* index, const char* folded_text, int record_index)
+{
+    const unsigned char* text = (const unsigned char*)folded_text;
+    size_t text_length = strlen(folded_text);
+    size_t i = 0;
+
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i + TRIGRAM_LENGTH <= text_length; i++)
+    {
+        int trigram = (text[i] << 16) | (text[i + 1] << 8) | text[i + 2];
+        PostingList* list = trigram_index_find(index, trigram);
+
+        if (list != NULL)
+        {
+            posting_list_remove(list, record_index);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: tag_index_initialize
+ *
+ * Описание: Инициализирует пустой индекс тегов.
+ *
+ * Параметры:
+ *   index - индекс тегов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int tag_index_initialize(TagIndex* index)
+{
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    memset(index, 0, sizeof(*index));
+    return string_dictionary_initialize(&index->tags);
+}
+
+/******************************************************************************
+ * Функция: tag_index_release
+ *
+ * Описание: Освобождает память индекса тегов.
+ *
+ * Параметры:
+ *   index - индекс тегов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int tag_index_release(TagIndex* index)
+{
+    int i = 0;
+
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < index->tags.value_count; i++)
+    {
+        memory_release(index->postings[i].record_indices);
+    }
+    memory_release(index->postings);
+    string_dictionary_release(&index->tags);
+    return tag_index_initialize(index);
+}
+
+/******************************************************************************
+ * Функция: tag_index_get
+ *
+ * Описание: Возвращает список записей нормализованного тега, добавляя тег
+ *           в словарь при необходимости.
+ *
+ * Параметры:
+ *   index - индекс тегов
+ *   tag - нормализованный свернутый тег
+ *
+ * Возвращает: список записей, NULL при нехватке памяти
+ ******************************************************************************/
+PostingList* tag_index_get(TagIndex* index, const char* tag)
+{
+    int tag_id = string_dictionary_intern(&index->tags, tag);
+
+    if (tag_id < 0)
+    {
+        return NULL;
+    }
+
+    if (tag_id >= index->posting_capacity)
+    {
+        int new_capacity = index->posting_capacity > 0 ? index->posting_capacity * 2 : 16;
+        if (grow_array((void**)&index->postings, sizeof(PostingList), new_capacity) != 0)
+        {
+            return NULL;
+        }
+        memset(index->postings + index->posting_capacity, 0,
+            (size_t)(new_capacity - index->posting_capacity) * sizeof(PostingList));
+        index->posting_capacity = new_capacity;
+    }
+
+    return &index->postings[tag_id];
+}
+
+/******************************************************************************
+ * Функция: tag_index_add
+ *
+ * Описание: Разбивает свернутые теги записи по запятым и добавляет запись
+ *           в списки каждого тега.
+ *
+ * Параметры:
+ *   index - индекс тегов
+ *   folded_tags - свернутое поле тегов записи
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int tag_index_add(TagIndex* index, const char* folded_tags, int record_index)
+{
+    char tag[MAX_TAGS_LEN];
+
+    while (*folded_tags != '\0')
+    {
+        size_t tag_length = strcspn(folded_tags, TAG_SEPARATORS);
+        PostingList* list = NULL;
+
+        memcpy(tag, folded_tags, tag_length);
+        tag[tag_length] = '\0';
+        folded_tags += tag_length;
+        if (*folded_tags != '\0')
+        {
+            folded_tags++;
+        }
+
+        if (normalize_query_text(tag, tag, sizeof(tag)) == 0)
+        {
+            continue;
+        }
+
+        list = tag_index_get(index, tag);
+        if (list == NULL || posting_list_insert(list, record_index) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: tag_index_remove
+ *
+ * Описание: Убирает запись из списков всех ее тегов.
+ *
+ * Параметры:
+ *   index - индекс тегов
+ *   folded_tags - свернутое поле тегов записи до изменения
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int tag_index_remove(TagIndex* index, const char* folded_tags, int record_index)
+{
+    char tag[MAX_TAGS_LEN];
+
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    while (*folded_tags != '\0')
+    {
+        size_t tag_length = strcspn(folded_tags, TAG_SEPARATORS);
+        int tag_id = 0;
+
+        memcpy(tag, folded_tags, tag_length);
+        tag[tag_length] = '\0';
+        folded_tags += tag_length;
+        if (*folded_tags != '\0')
+        {
+            folded_tags++;
+        }
+
+        if (normalize_query_text(tag, tag, sizeof(tag)) == 0)
+        {
+            continue;
+        }
+
+        tag_id = string_dictionary_find(&index->tags, tag);
+        if (tag_id >= 0)
+        {
+            posting_list_remove(&index->postings[tag_id], record_index);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: search_index_ready
+ *
+ * Описание: Проверяет, можно ли отвечать на запросы по индексу: он не
+ *           освобожден из-за лимита памяти и не перестраивается.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   index_flag - индекс поиска (SEARCH_INDEX_...)
+ *
+ * Возвращает: 1 если индекс готов, 0 если запрос нужно выполнить без него
+ ******************************************************************************/
+int search_index_ready(const ArchiveIndexes* indexes, int index_flag)
+{
+    return ((indexes->suspended_indexes | indexes->pending_indexes) & index_flag) == 0;
+}
+
+/******************************************************************************
+ * Функция: search_indexes_maintained
+ *
+ * Описание: Определяет индексы, которые уже содержат записи с заданным
+ *           индексом и должны обновляться при ее изменении. Перестраиваемый
+ *           индекс содержит только записи до позиции перестройки; более
+ *           поздние он получит при перестройке.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   record_index - индекс записи
+ *
+ * Возвращает: набор индексов поиска (SEARCH_INDEX_...)
+ ******************************************************************************/
+int search_indexes_maintained(const ArchiveIndexes* indexes, int record_index)
+{
+    int maintained = ~indexes->suspended_indexes;
+
+    if (record_index >= indexes->rebuild_position)
+    {
+        maintained &= ~indexes->pending_indexes;
+    }
+
+    return maintained;
+}
+
+/******************************************************************************
+ * Функция: search_indexes_add_record
+ *
+ * Описание: Добавляет запись в индекс триграмм, раздел месяца и индексы
+ *           нечеткого поиска из заданного набора. Повторное добавление
+ *           записи ничего не меняет.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   photo - запись
+ *   record_index - индекс записи
+ *   index_mask - набор индексов поиска (SEARCH_INDEX_...)
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int search_indexes_add_record(ArchiveIndexes* indexes, const Photo* photo, int record_index,
+    int index_mask)
+{
+    if (((index_mask & SEARCH_INDEX_TRIGRAMS) != 0 &&
+            trigram_index_add(&indexes->place_trigrams, photo->place_key, record_index) != 0) ||
+        ((index_mask & SEARCH_INDEX_PARTITIONS) != 0 &&
+            partition_table_add(&indexes->partitions, photo, record_index) != 0) ||
+        ((index_mask & SEARCH_INDEX_FUZZY) != 0 &&
+            (fuzzy_index_add(&indexes->name_fuzzy, photo->name_key, record_index) != 0 ||
+            fuzzy_index_add(&indexes->place_fuzzy, photo->place_key, record_index) != 0)))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: search_indexes_rebuild_step
+ *
+ * Описание: Продолжает перестройку индексов в паузе между операциями:
+ *           вносит в них очередные записи, начиная с позиции перестройки.
+ *           Пока перестройка не закончена, запросы выполняются без этих
+ *           индексов, а изменения записей до позиции вносятся в них сразу.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   batch_size - наибольшее число записей за один шаг
+ *
+ * Возвращает: 1 если перестройка закончена, 0 если продолжится на следующем
+ *             шаге, -1 при нехватке памяти
+ ******************************************************************************/
+int search_indexes_rebuild_step(ArchiveIndexes* indexes, const Photo database[], int record_count,
+    int batch_size)
+{
+    int building = indexes->pending_indexes & ~indexes->suspended_indexes;
+    int last_record = indexes->rebuild_position + batch_size;
+    int i = 0;
+
+    if (indexes->pending_indexes == 0)
+    {
+        return 1;
+    }
+
+    if (last_record > record_count || batch_size <= 0)
+    {
+        last_record = record_count;
+    }
+
+    for (i = indexes->rebuild_position; i < last_record; i++)
+    {
+        if (!database[i].is_deleted &&
+            search_indexes_add_record(indexes, &database[i], i, building) != 0)
+        {
+            /* Запись будет внесена повторно на следующем шаге */
+            indexes->rebuild_position = i;
+            return -1;
+        }
+    }
+
+    indexes->rebuild_position = last_record;
+    if (last_record < record_count)
+    {
+        return 0;
+    }
+
+    indexes->pending_indexes = 0;
+    return 1;
+}
+
+/******************************************************************************
+ * Функция: search_indexes_build
+ *
+ * Описание: Заново строит индекс триграмм места, разделы по месяцам
+ *           с индексами тегов, индексы нечеткого поиска по свернутым
+ *           ключам всех записей и индекс размеров. Индексы, освобожденные
+ *           из-за лимита памяти, остаются пустыми; перестраиваемые в паузах
+ *           между операциями начинают перестройку заново.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int search_indexes_build(ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    int building = ~(indexes->suspended_indexes | indexes->pending_indexes);
+    int i = 0;
+
+    trigram_index_release(&indexes->place_trigrams);
+    partition_table_release(&indexes->partitions);
+    fuzzy_index_release(&indexes->name_fuzzy);
+    fuzzy_index_release(&indexes->place_fuzzy);
+    indexes->rebuild_position = 0;
+
+    for (i = 0; i < record_count; i++)
+    {
+        if (!database[i].is_deleted &&
+            search_indexes_add_record(indexes, &database[i], i, building) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (indexes->suspended_indexes & SEARCH_INDEX_DIMENSIONS)
+    {
+        return kd_tree_release(&indexes->dimensions);
+    }
+
+    return kd_tree_build(&indexes->dimensions, database, record_count);
+}
+
+/******************************************************************************
+ * Функция: collect_index_candidates
+ *
+ * Описание: Отбирает по индексам записи, которые могут удовлетворять
+ *           запросу. Для места берется самый короткий список среди триграмм
+ *           запроса. Для даты и тега просматривается только раздел месяца
+ *           из запроса: объединение списков его тегов, содержащих строку
+ *           запроса, или все записи раздела. Кандидаты затем проверяются
+ *           полностью.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   query_kind - вид запроса (QUERY_KIND_...)
+ *   date - дата из запроса
+ *   text - свернутое место или тег из запроса
+ *   candidates - указатель для возврата массива кандидатов (освобождает
+ *                вызывающая функция)
+ *
+ * Возвращает: количество кандидатов по возрастанию индекса, -1 если индекс
+ *             неприменим и нужен полный просмотр
+ ******************************************************************************/
+int collect_index_candidates(const ArchiveIndexes* indexes, int query_kind, const char* date,
+    const char* text, int** candidates)
+{
+    const unsigned char* query = (const unsigned char*)text;
+    size_t query_length = strlen(text);
+    const PostingList* shortest_list = NULL;
+    const MonthPartition* partition = NULL;
+    int candidate_count = 0;
+    int candidate_capacity = 0;
+    size_t i = 0;
+
+    *candidates = NULL;
+
+    if (query_kind == QUERY_KIND_LOCATION)
+    {
+        if (query_length < TRIGRAM_LENGTH || !search_index_ready(indexes, SEARCH_INDEX_TRIGRAMS))
+        {
+            return -1;
+        }
+
+        for (i = 0; i + TRIGRAM_LENGTH <= query_length; i++)
+        {
+            int trigram = (query[i] << 16) | (query[i + 1] << 8) | query[i + 2];
+            const PostingList* list = trigram_index_find(&indexes->place_trigrams, trigram);
+
+            if (list == NULL)
+            {
+                return 0;
+            }
+            if (shortest_list == NULL || list->count < shortest_list->count)
+            {
+                shortest_list = list;
+            }
+        }
+
+        *candidates = (int*)memory_allocate((size_t)shortest_list->count * sizeof(int));
+        if (*candidates == NULL)
+        {
+            return -1;
+        }
+        memcpy(*candidates, shortest_list->record_indices, (size_t)shortest_list->count * sizeof(int));
+        return shortest_list->count;
+    }
+
+    if (query_kind != QUERY_KIND_DATE_AND_TAG || !search_index_ready(indexes, SEARCH_INDEX_PARTITIONS))
+    {
+        return -1;
+    }
+
+    /* Отсечение разделов: записи других месяцев не просматриваются */
+    partition = partition_table_find(&indexes->partitions, parse_date_key(date) / 100);
+    if (partition == NULL)
+    {
+        return 0;
+    }
+
+    /* Запрос с запятой может совпасть через границу тегов - весь раздел */
+    if (query_length == 0 || strpbrk(text, TAG_SEPARATORS) != NULL)
+    {
+        if (partition->records.count == 0)
+        {
+            return 0;
+        }
+
+        *candidates = (int*)memory_allocate((size_t)partition->records.count * sizeof(int));
+        if (*candidates == NULL)
+        {
+            return -1;
+        }
+        memcpy(*candidates, partition->records.record_indices,
+            (size_t)partition->records.count * sizeof(int));
+        return partition->records.count;
+    }
+
+    for (i = 0; i < (size_t)partition->tags.tags.value_count; i++)
+    {
+        const PostingList* list = &partition->tags.postings[i];
+
+        if (list->count == 0 || strstr(partition->tags.tags.values[i], text) == NULL)
+        {
+            continue;
+        }
+
+        if (candidate_count + list->count > candidate_capacity)
+        {
+            int new_capacity = (candidate_count + list->count) * 2;
+            if (grow_array((void**)candidates, sizeof(int), new_capacity) != 0)
+            {
+                memory_release(*candidates);
+                *candidates = NULL;
+                return -1;
+            }
+            candidate_capacity = new_capacity;
+        }
+
+        memcpy(*candidates + candidate_count, list->record_indices, (size_t)list->count * sizeof(int));
+        candidate_count += list->count;
+    }
+
+    if (candidate_count > 1)
+    {
+        int unique_count = 1;
+        int j = 0;
+
+        qsort(*candidates, candidate_count, sizeof(int), compare_integers);
+        for (j = 1; j < candidate_count; j++)
+        {
+            if ((*candidates)[j] != (*candidates)[unique_count - 1])
+            {
+                (*candidates)[unique_count++] = (*candidates)[j];
+            }
+        }
+        candidate_count = unique_count;
+    }
+
+    return candidate_count;
+}
+
+/******************************************************************************
+ * Функция: partition_table_initialize
+ *
+ * Описание: Инициализирует пустую таблицу разделов по месяцам.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int partition_table_initialize(PartitionTable* table)
+{
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    memset(table, 0, sizeof(*table));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: partition_table_release
+ *
+ * Описание: Освобождает память всех разделов и их индексов тегов.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int partition_table_release(PartitionTable* table)
+{
+    int i = 0;
+
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < table->count; i++)
+    {
+        memory_release(table->partitions[i].records.record_indices);
+        tag_index_release(&table->partitions[i].tags);
+    }
+    memory_release(table->partitions);
+    return partition_table_initialize(table);
+}
+
+/******************************************************************************
+ * Функция: partition_table_find
+ *
+ * Описание: Ищет раздел месяца двоичным поиском.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *   month_key - месяц в виде ГГГГММ
+ *
+ * Возвращает: указатель на раздел или NULL, если записей за месяц нет
+ ******************************************************************************/
+MonthPartition* partition_table_find(const PartitionTable* table, int month_key)
+{
+    int low = 0;
+    int high = table->count;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (table->partitions[middle].month_key < month_key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low < table->count && table->partitions[low].month_key == month_key)
+    {
+        return &table->partitions[low];
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Функция: partition_table_get
+ *
+ * Описание: Возвращает раздел месяца, создавая его на своем месте в
+ *           упорядоченном массиве при необходимости.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *   month_key - месяц в виде ГГГГММ
+ *
+ * Возвращает: указатель на раздел, NULL при нехватке памяти
+ ******************************************************************************/
+MonthPartition* partition_table_get(PartitionTable* table, int month_key)
+{
+    MonthPartition* partition = partition_table_find(table, month_key);
+    int position = 0;
+
+    if (partition != NULL)
+    {
+        return partition;
+    }
+
+    if (table->count == table->capacity)
+    {
+        int new_capacity = table->capacity > 0 ? table->capacity * 2 : 16;
+        if (grow_array((void**)&table->partitions, sizeof(MonthPartition), new_capacity) != 0)
+        {
+            return NULL;
+        }
+        table->capacity = new_capacity;
+    }
+
+    while (position < table->count && table->partitions[position].month_key < month_key)
+    {
+        position++;
+    }
+
+    memmove(table->partitions + position + 1, table->partitions + position,
+        (size_t)(table->count - position) * sizeof(MonthPartition));
+    table->count++;
+
+    partition = &table->partitions[position];
+    memset(partition, 0, sizeof(*partition));
+    partition->month_key = month_key;
+    if (tag_index_initialize(&partition->tags) != 0)
+    {
+        return NULL;
+    }
+
+    return partition;
+}
+
+/******************************************************************************
+ * Функция: partition_table_add
+ *
+ * Описание: Добавляет запись в раздел месяца ее даты съемки.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *   photo - запись
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int partition_table_add(PartitionTable* table, const Photo* photo, int record_index)
+{
+    int previous_subsystem = memory_enter(MEMORY_PARTITIONS);
+    MonthPartition* partition = partition_table_get(table, parse_date_key(photo->date) / 100);
+
+    if (partition == NULL ||
+        posting_list_insert(&partition->records, record_index) != 0 ||
+        tag_index_add(&partition->tags, photo->tags_key, record_index) != 0)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: partition_table_remove
+ *
+ * Описание: Убирает запись из раздела месяца. Опустевший раздел остается
+ *           в таблице и заполняется снова при следующих добавлениях.
+ *
+ * Параметры:
+ *   table - таблица разделов
+ *   photo - запись до изменения
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 если раздела нет
+ ******************************************************************************/
+int partition_table_remove(PartitionTable* table, const Photo* photo, int record_index)
+{
+    MonthPartition* partition = partition_table_find(table, parse_date_key(photo->date) / 100);
+
+    if (partition == NULL)
+    {
+        return -1;
+    }
+
+    posting_list_remove(&partition->records, record_index);
+    return tag_index_remove(&partition->tags, photo->tags_key, record_index);
+}
+
+/******************************************************************************
+ * Функция: segment_directory_initialize
+ *
+ * Описание: Инициализирует пустой перечень запечатанных годов.
+ *
+ * Параметры:
+ *   directory - перечень разделов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int segment_directory_initialize(SegmentDirectory* directory)
+{
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    memset(directory, 0, sizeof(*directory));
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: segment_directory_release
+ *
+ * Описание: Освобождает память перечня запечатанных годов.
+ *
+ * Параметры:
+ *   directory - перечень разделов
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int segment_directory_release(SegmentDirectory* directory)
+{
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    memory_release(directory->segments);
+    return segment_directory_initialize(directory);
+}
+
+/******************************************************************************
+ * Функция: segment_directory_find
+ *
+ * Описание: Ищет запечатанный год в перечне.
+ *
+ * Параметры:
+ *   directory - перечень разделов
+ *   year - год
+ *
+ * Возвращает: указатель на раздел или NULL, если год не запечатан
+ ******************************************************************************/
+SealedSegment* segment_directory_find(const SegmentDirectory* directory, int year)
+{
+    int i = 0;
+
+    for (i = 0; i < directory->count; i++)
+    {
+        if (directory->segments[i].year == year)
+        {
+            return &directory->segments[i];
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Функция: segment_directory_add
+ *
+ * Описание: Добавляет год в перечень с сохранением порядка по возрастанию.
+ *
+ * Параметры:
+ *   directory - перечень разделов
+ *   year - год
+ *   record_count - количество записей в файле раздела
+ *
+ * Возвращает: указатель на раздел, NULL при нехватке памяти
+ ******************************************************************************/
+SealedSegment* segment_directory_add(SegmentDirectory* directory, int year, int record_count)
+{
+    int position = directory->count;
+
+    if (directory->count == directory->capacity)
+    {
+        int new_capacity = directory->capacity > 0 ? directory->capacity * 2 : 8;
+        int previous_subsystem = memory_enter(MEMORY_RECORDS);
+        if (memory_leave(previous_subsystem,
+            grow_array((void**)&directory->segments, sizeof(SealedSegment), new_capacity)) != 0)
+        {
+            return NULL;
+        }
+        directory->capacity = new_capacity;
+    }
+
+    while (position > 0 && directory->segments[position - 1].year > year)
+    {
+        directory->segments[position] = directory->segments[position - 1];
+        position--;
+    }
+
+    directory->segments[position].year = year;
+    directory->segments[position].record_count = record_count;
+    directory->segments[position].is_loaded = 0;
+    directory->count++;
+    return &directory->segments[position];
+}
+
+/******************************************************************************
+ * Функция: segment_directory_load
+ *
+ * Описание: Читает перечень запечатанных годов из файла-перечня. Сами
+ *           записи разделов не загружаются.
+ *
+ * Параметры:
+ *   directory - перечень разделов (прежнее содержимое заменяется)
+ *
+ * Возвращает: количество запечатанных годов, 0 если перечня нет,
+ *             -1 при нехватке памяти
+ ******************************************************************************/
+int segment_directory_load(SegmentDirectory* directory)
+{
+    FILE* file_handle = NULL;
+    int year = 0;
+    int record_count = 0;
+
+    segment_directory_release(directory);
+
+    file_handle = fopen(SEGMENT_MANIFEST_FILENAME, "r");
+    if (file_handle == NULL)
+    {
+        return 0;
+    }
+
+    while (fscanf(file_handle, "%d|%d", &year, &record_count) == 2)
+    {
+        if (segment_directory_find(directory, year) == NULL &&
+            segment_directory_add(directory, year, record_count) == NULL)
+        {
+            fclose(file_handle);
+            return -1;
+        }
+    }
+
+    fclose(file_handle);
+    return directory->count;
+}
+
+/******************************************************************************
+ * Функция: segment_directory_save
+ *
+ * Описание: Записывает перечень запечатанных годов. Если запечатанных
+ *           годов нет, файл-перечень не создается.
+ *
+ * Параметры:
+ *   directory - перечень разделов
+ *
+ * Возвращает: 0 при успешной записи, -1 при ошибке
+ ******************************************************************************/
+int segment_directory_save(const SegmentDirectory* directory)
+{
+    FILE* file_handle = NULL;
+    int i = 0;
+
+    if (directory->count == 0)
+    {
+        return 0;
+    }
+
+    file_handle = fopen(SEGMENT_MANIFEST_FILENAME, "w");
+    if (file_handle == NULL)
+    {
+        printf("Ошибка: Не удалось открыть файл '%s' для записи.\n", SEGMENT_MANIFEST_FILENAME);
+        return -1;
+    }
+
+    for (i = 0; i < directory->count; i++)
+    {
+        if (fprintf(file_handle, "%d|%d\n",
+            directory->segments[i].year, directory->segments[i].record_count) < 0)
+        {
+            fclose(file_handle);
+            printf("Ошибка записи в файл.\n");
+            return -1;
+        }
+    }
+
+    fclose(file_handle);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: load_sealed_segments
+ *
+ * Описание: Загружает записи еще не загруженных запечатанных годов из
+ *           заданного диапазона и добавляет их во вспомогательные
+ *           структуры. Годы вне диапазона не читаются.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - указатель на количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
+ *   first_year - первый год диапазона
+ *   last_year - последний год диапазона
+ *
+ * Возвращает: количество загруженных записей, -1 при ошибке
+ ******************************************************************************/
+int load_sealed_segments(Photo database[], int* record_count, ArchiveIndexes* indexes,
+    int first_year, int last_year)
+{
+    char filename[MAX_SEGMENT_FILENAME_LEN];
+    int loaded_total = 0;
+    int i = 0;
+
+    for (i = 0; i < indexes->segments.count; i++)
+    {
+        SealedSegment* segment = &indexes->segments.segments[i];
+        int first_new = *record_count;
+        int j = 0;
+
+        if (segment->is_loaded || segment->year < first_year || segment->year > last_year)
+        {
+            continue;
+        }
+
+        /* Раздел отмечается загруженным и при ошибке, чтобы не читать его повторно */
+        segment->is_loaded = 1;
+        snprintf(filename, sizeof(filename), BLOCK_FILENAME_FORMAT, segment->year);
+        if (read_block_file(filename, database, record_count, segment->year) != 0)
+        {
+            /* Годы, запечатанные до появления блоков, хранятся текстом */
+            *record_count = first_new;
+            snprintf(filename, sizeof(filename), SEGMENT_FILENAME_FORMAT, segment->year);
+            if (read_records_from_file(filename, database, record_count, segment->year) != 0)
+            {
+                fprintf(stderr, "Внимание: Не удалось открыть файл раздела года %d.\n", segment->year);
+                continue;
+            }
+        }
+
+        if (*record_count - first_new < segment->record_count)
+        {
+            fprintf(stderr, "Внимание: Раздел %d загружен не полностью (%d из %d записей).\n",
+                segment->year, *record_count - first_new, segment->record_count);
+        }
+
+        for (j = first_new; j < *record_count; j++)
+        {
+            if (archive_indexes_on_insert(indexes, database, j) != 0)
+            {
+                return -1;
+            }
+        }
+        loaded_total += *record_count - first_new;
+    }
+
+    return loaded_total;
+}
+
+/******************************************************************************
+ * Функция: seal_old_years
+ *
+ * Описание: Запечатывает годы, которые старше текущего на SEAL_AGE_YEARS
+ *           и более: их записи из активного файла переносятся в отдельный
+ *           сжатый блок года, который больше не перезаписывается. Записи уже
+ *           запечатанного года, добавленные позже, остаются в активном
+ *           файле.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   indexes - вспомогательные структуры архива (перечень разделов)
+ *
+ * Возвращает: количество запечатанных годов, -1 при ошибке
+ ******************************************************************************/
+int seal_old_years(Photo database[], int record_count, ArchiveIndexes* indexes)
+{
+    char filename[MAX_SEGMENT_FILENAME_LEN];
+    time_t now = time(NULL);
+    struct tm* local_time = localtime(&now);
+    int seal_before_year = 0;
+    int sealed_years = 0;
+    int write_result = 0;
+    int i = 0;
+
+    if (local_time == NULL)
+    {
+        return 0;
+    }
+    seal_before_year = local_time->tm_year + 1900 - SEAL_AGE_YEARS + 1;
+
+    for (i = 0; i < record_count; i++)
+    {
+        int year = parse_date_key(database[i].date) / 10000;
+        SealedSegment* segment = NULL;
+        int segment_records = 0;
+        int j = 0;
+
+        if (database[i].is_deleted || database[i].segment_year != 0 || year <= 0 ||
+            year >= seal_before_year || segment_directory_find(&indexes->segments, year) != NULL)
+        {
+            continue;
+        }
+
+        /* Все активные записи года переходят в его раздел */
+        for (j = i; j < record_count; j++)
+        {
+            if (!database[j].is_deleted && database[j].segment_year == 0 &&
+                parse_date_key(database[j].date) / 10000 == year)
+            {
+                database[j].segment_year = year;
+                segment_records++;
+            }
+        }
+
+        segment = segment_directory_add(&indexes->segments, year, segment_records);
+        snprintf(filename, sizeof(filename), BLOCK_FILENAME_FORMAT, year);
+        write_result = (segment == NULL) ? -1 : write_block_file(filename, database, record_count, year);
+        if (write_result == 1)
+        {
+            /* Даты вне формата ГГГГ-ММ-ДД блок не сохранит без потерь */
+            snprintf(filename, sizeof(filename), SEGMENT_FILENAME_FORMAT, year);
+            write_result = write_records_to_file(filename, database, record_count, year);
+        }
+        if (write_result != 0)
+        {
+            /* Записи возвращаются в активный файл, чтобы не потерять их */
+            for (j = i; j < record_count; j++)
+            {
+                if (database[j].segment_year == year)
+                {
+                    database[j].segment_year = 0;
+                }
+            }
+            if (segment != NULL)
+            {
+                indexes->segments.count--;
+                memmove(segment, segment + 1,
+                    (size_t)(indexes->segments.segments + indexes->segments.count - segment) *
+                    sizeof(SealedSegment));
+            }
+            return -1;
+        }
+
+        segment->is_loaded = 1;
+        sealed_years++;
+        printf("Год %d запечатан: %d записей перенесено в файл '%s'.\n",
+            year, segment_records, filename);
+    }
+
+    return sealed_years;
+}
+
+/******************************************************************************
+ * Функция: check_record_writable
+ *
+ * Описание: Проверяет, что запись не относится к запечатанному году.
+ *
+ * Параметры:
+ *   photo - запись
+ *
+ * Возвращает: 0 если запись можно изменять, -1 если она только для чтения
+ ******************************************************************************/
+int check_record_writable(const Photo* photo)
+{
+    if (photo->segment_year != 0)
+    {
+        printf("Ошибка: Запись относится к запечатанному %d году и доступна только для чтения.\n",
+            photo->segment_year);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_reserve
+ *
+ * Описание: Гарантирует место для дописывания заданного числа байт.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   extra_length - количество байт, которые будут дописаны
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_reserve(ByteBuffer* buffer, size_t extra_length)
+{
+    size_t new_capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+    unsigned char* new_data = NULL;
+    int previous_subsystem = memory_enter(MEMORY_IO);
+
+    if (buffer->error)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    if (buffer->length + extra_length <= buffer->capacity)
+    {
+        return memory_leave(previous_subsystem, 0);
+    }
+
+    while (new_capacity < buffer->length + extra_length)
+    {
+        new_capacity *= 2;
+    }
+
+    new_data = (unsigned char*)memory_reallocate(buffer->data, new_capacity);
+    if (new_data == NULL)
+    {
+        buffer->error = 1;
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_append
+ *
+ * Описание: Дописывает байты в конец массива.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   bytes - данные
+ *   length - количество байт
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_append(ByteBuffer* buffer, const void* bytes, size_t length)
+{
+    if (byte_buffer_reserve(buffer, length) != 0)
+    {
+        return -1;
+    }
+
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_append_uint32
+ *
+ * Описание: Дописывает 32-разрядное число в порядке от младшего байта,
+ *           независимо от порядка байт процессора.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   value - число
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_append_uint32(ByteBuffer* buffer, unsigned int value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = (unsigned char)(value & 0xFF);
+    bytes[1] = (unsigned char)((value >> 8) & 0xFF);
+    bytes[2] = (unsigned char)((value >> 16) & 0xFF);
+    bytes[3] = (unsigned char)((value >> 24) & 0xFF);
+    return byte_buffer_append(buffer, bytes, sizeof(bytes));
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_append_varint
+ *
+ * Описание: Дописывает число переменной длины: по 7 бит в байте, старший
+ *           бит байта означает продолжение. Малые числа занимают 1 байт.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   value - число
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_append_varint(ByteBuffer* buffer, unsigned int value)
+{
+    unsigned char bytes[5];
+    size_t length = 0;
+
+    do {
+        unsigned char byte = (unsigned char)(value & 0x7F);
+        value >>= 7;
+        bytes[length++] = (unsigned char)(value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
+
+    return byte_buffer_append(buffer, bytes, length);
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_append_string
+ *
+ * Описание: Дописывает строку: длина числом переменной длины, затем байты
+ *           без завершающего нуля.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   text - строка
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_append_string(ByteBuffer* buffer, const char* text)
+{
+    size_t length = strlen(text);
+
+    if (byte_buffer_append_varint(buffer, (unsigned int)length) != 0)
+    {
+        return -1;
+    }
+
+    return byte_buffer_append(buffer, text, length);
+}
+
+/******************************************************************************
+ * Функция: byte_reader_read_uint32
+ *
+ * Описание: Читает 32-разрядное число, записанное от младшего байта.
+ *
+ * Параметры:
+ *   reader - источник данных
+ *
+ * Возвращает: прочитанное число, 0 при выходе за границу (ставит error)
+ ******************************************************************************/
+unsigned int byte_reader_read_uint32(ByteReader* reader)
+{
+    const unsigned char* bytes = NULL;
+
+    if (reader->error || reader->length - reader->position < 4)
+    {
+        reader->error = 1;
+        return 0;
+    }
+
+    bytes = reader->data + reader->position;
+    reader->position += 4;
+    return (unsigned int)bytes[0] | ((unsigned int)bytes[1] << 8) |
+        ((unsigned int)bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+/******************************************************************************
+ * Функция: byte_reader_read_varint
+ *
+ * Описание: Читает число переменной длины.
+ *
+ * Параметры:
+ *   reader - источник данных
+ *
+ * Возвращает: прочитанное число, 0 при ошибке (ставит error)
+ ******************************************************************************/
+unsigned int byte_reader_read_varint(ByteReader* reader)
+{
+    unsigned int value = 0;
+    int shift = 0;
+
+    while (!reader->error)
+    {
+        unsigned char byte = 0;
+
+        if (reader->position >= reader->length || shift > 28)
+        {
+            reader->error = 1;
+            break;
+        }
+
+        byte = reader->data[reader->position++];
+        value |= (unsigned int)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: byte_reader_read_string
+ *
+ * Описание: Читает строку, записанную byte_buffer_append_string.
+ *
+ * Параметры:
+ *   reader - источник данных
+ *   text - буфер для строки
+ *   text_size - размер буфера
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке или слишком длинной строке
+ ******************************************************************************/
+int byte_reader_read_string(ByteReader* reader, char* text, size_t text_size)
+{
+    size_t length = byte_reader_read_varint(reader);
+
+    if (reader->error || length >= text_size || reader->length - reader->position < length)
+    {
+        reader->error = 1;
+        text[0] = '\0';
+        return -1;
+    }
+
+    memcpy(text, reader->data + reader->position, length);
+    text[length] = '\0';
+    reader->position += length;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: bits_required
+ *
+ * Описание: Вычисляет количество бит, достаточное для записи числа.
+ *
+ * Параметры:
+ *   max_value - наибольшее записываемое число
+ *
+ * Возвращает: количество бит (0 для нуля)
+ ******************************************************************************/
+int bits_required(unsigned int max_value)
+{
+    int bit_count = 0;
+
+    while (max_value != 0)
+    {
+        bit_count++;
+        max_value >>= 1;
+    }
+
+    return bit_count;
+}
+
+/******************************************************************************
+ * Функция: bit_pack_values
+ *
+ * Описание: Записывает массив чисел плотной упаковкой: каждое число
+ *           занимает ровно столько бит, сколько нужно наибольшему из них.
+ *           Разрядность записывается перед данными.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   values - числа
+ *   count - количество чисел
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int bit_pack_values(ByteBuffer* buffer, const unsigned int values[], int count)
+{
+    unsigned int max_value = 0;
+    unsigned long long accumulator = 0;
+    int pending_bits = 0;
+    int bit_width = 0;
+    int i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (values[i] > max_value)
+        {
+            max_value = values[i];
+        }
+    }
+
+    bit_width = bits_required(max_value);
+    if (byte_buffer_append_varint(buffer, (unsigned int)bit_width) != 0 ||
+        byte_buffer_reserve(buffer, ((size_t)count * (size_t)bit_width + 7) / 8) != 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < count && bit_width > 0; i++)
+    {
+        accumulator |= (unsigned long long)values[i] << pending_bits;
+        pending_bits += bit_width;
+        while (pending_bits >= 8)
+        {
+            buffer->data[buffer->length++] = (unsigned char)(accumulator & 0xFF);
+            accumulator >>= 8;
+            pending_bits -= 8;
+        }
+    }
+
+    if (pending_bits > 0)
+    {
+        buffer->data[buffer->length++] = (unsigned char)(accumulator & 0xFF);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: bit_unpack_values
+ *
+ * Описание: Читает массив чисел, записанный bit_pack_values.
+ *
+ * Параметры:
+ *   reader - источник данных
+ *   values - массив для чисел
+ *   count - количество чисел
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных
+ ******************************************************************************/
+int bit_unpack_values(ByteReader* reader, unsigned int values[], int count)
+{
+    unsigned long long accumulator = 0;
+    unsigned int mask = 0;
+    int available_bits = 0;
+    int bit_width = (int)byte_reader_read_varint(reader);
+    int i = 0;
+
+    if (reader->error || bit_width > 32 ||
+        reader->length - reader->position < ((size_t)count * (size_t)bit_width + 7) / 8)
+    {
+        reader->error = 1;
+        return -1;
+    }
+
+    mask = (bit_width == 32) ? 0xFFFFFFFFu : ((1u << bit_width) - 1u);
+    for (i = 0; i < count; i++)
+    {
+        while (available_bits < bit_width)
+        {
+            accumulator |= (unsigned long long)reader->data[reader->position++] << available_bits;
+            available_bits += 8;
+        }
+
+        values[i] = (unsigned int)(accumulator & mask);
+        accumulator >>= bit_width;
+        available_bits -= bit_width;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: block_checksum
+ *
+ * Описание: Вычисляет контрольную сумму FNV-1a для проверки целостности
+ *           распакованного блока.
+ *
+ * Параметры:
+ *   data - данные
+ *   length - размер данных
+ *
+ * Возвращает: 32-разрядная контрольная сумма
+ ******************************************************************************/
+unsigned int block_checksum(const unsigned char* data, size_t length)
+{
+    unsigned int checksum = 2166136261u;
+    size_t i = 0;
+
+    for (i = 0; i < length; i++)
+    {
+        checksum ^= data[i];
+        checksum *= 16777619u;
+    }
+
+    return checksum;
+}
+
+/******************************************************************************
+ * Функция: lz_compress
+ *
+ * Описание: Сжимает данные кодеком семейства LZ77 в духе LZ4. Поток
+ *           состоит из последовательностей: байт-маркер (длина литералов
+ *           и длина совпадения по 4 бита, значение 15 продолжается байтами
+ *           по 255), литералы, 2 байта расстояния до совпадения. Последняя
+ *           последовательность содержит только литералы. Совпадения ищутся
+ *           по хеш-таблице четырехбайтовых префиксов.
+ *
+ * Параметры:
+ *   source - исходные данные
+ *   source_length - размер исходных данных
+ *   output - массив для сжатых данных (дописывается)
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int lz_compress(const unsigned char* source, size_t source_length, ByteBuffer* output)
+{
+    static long hash_table[1 << LZ_HASH_BITS];
+    size_t anchor = 0;
+    size_t position = 0;
+    int i = 0;
+
+    for (i = 0; i < (1 << LZ_HASH_BITS); i++)
+    {
+        hash_table[i] = -1;
+    }
+
+    while (position + LZ_MIN_MATCH <= source_length)
+    {
+        unsigned int sequence = (unsigned int)source[position] | ((unsigned int)source[position + 1] << 8) |
+            ((unsigned int)source[position + 2] << 16) | ((unsigned int)source[position + 3] << 24);
+        unsigned int hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        long candidate = hash_table[hash];
+        size_t match_length = 0;
+        size_t literal_length = 0;
+        size_t offset = 0;
+        unsigned char token = 0;
+        unsigned char tail[2];
+
+        hash_table[hash] = (long)position;
+        if (candidate < 0 || position - (size_t)candidate > LZ_MAX_OFFSET ||
+            memcmp(source + candidate, source + position, LZ_MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        match_length = LZ_MIN_MATCH;
+        while (position + match_length < source_length &&
+            source[candidate + match_length] == source[position + match_length])
+        {
+            match_length++;
+        }
+
+        literal_length = position - anchor;
+        offset = position - (size_t)candidate;
+        token = (unsigned char)(((literal_length < 15 ? literal_length : 15) << 4) |
+            (match_length - LZ_MIN_MATCH < 15 ? match_length - LZ_MIN_MATCH : 15));
+        byte_buffer_append(output, &token, 1);
+        if (literal_length >= 15)
+        {
+            size_t rest = literal_length - 15;
+            unsigned char extension = 255;
+            for (; rest >= 255; rest -= 255)
+            {
+                byte_buffer_append(output, &extension, 1);
+            }
+            extension = (unsigned char)rest;
+            byte_buffer_append(output, &extension, 1);
+        }
+        byte_buffer_append(output, source + anchor, literal_length);
+
+        tail[0] = (unsigned char)(offset & 0xFF);
+        tail[1] = (unsigned char)(offset >> 8);
+        byte_buffer_append(output, tail, 2);
+        if (match_length - LZ_MIN_MATCH >= 15)
+        {
+            size_t rest = match_length - LZ_MIN_MATCH - 15;
+            unsigned char extension = 255;
+            for (; rest >= 255; rest -= 255)
+            {
+                byte_buffer_append(output, &extension, 1);
+            }
+            extension = (unsigned char)rest;
+            byte_buffer_append(output, &extension, 1);
+        }
+
+        position += match_length;
+        anchor = position;
+    }
+
+    /* Завершающие литералы */
+    {
+        size_t literal_length = source_length - anchor;
+        unsigned char token = (unsigned char)((literal_length < 15 ? literal_length : 15) << 4);
+
+        byte_buffer_append(output, &token, 1);
+        if (literal_length >= 15)
+        {
+            size_t rest = literal_length - 15;
+            unsigned char extension = 255;
+            for (; rest >= 255; rest -= 255)
+            {
+                byte_buffer_append(output, &extension, 1);
+            }
+            extension = (unsigned char)rest;
+            byte_buffer_append(output, &extension, 1);
+        }
+        byte_buffer_append(output, source + anchor, literal_length);
+    }
+
+    return output->error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: lz_decompress
+ *
+ * Описание: Распаковывает данные, сжатые lz_compress, с проверкой всех
+ *           длин и расстояний.
+ *
+ * Параметры:
+ *   source - сжатые данные
+ *   source_length - размер сжатых данных
+ *   destination - буфер для распакованных данных
+ *   destination_length - ожидаемый размер распакованных данных
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных
+ ******************************************************************************/
+int lz_decompress(const unsigned char* source, size_t source_length,
+    unsigned char* destination, size_t destination_length)
+{
+    size_t input = 0;
+    size_t output = 0;
+
+    while (input < source_length)
+    {
+        unsigned char token = source[input++];
+        size_t literal_length = token >> 4;
+        size_t match_length = token & 0x0F;
+        size_t offset = 0;
+
+        if (literal_length == 15)
+        {
+            unsigned char extension = 255;
+            while (extension == 255)
+            {
+                if (input >= source_length)
+                {
+                    return -1;
+                }
+                extension = source[input++];
+                literal_length += extension;
+            }
+        }
+
+        if (source_length - input < literal_length || destination_length - output < literal_length)
+        {
+            return -1;
+        }
+        memcpy(destination + output, source + input, literal_length);
+        input += literal_length;
+        output += literal_length;
+
+        if (input == source_length)
+        {
+            break;
+        }
+
+        if (source_length - input < 2)
+        {
+            return -1;
+        }
+        offset = (size_t)source[input] | ((size_t)source[input + 1] << 8);
+        input += 2;
+
+        if (match_length == 15)
+        {
+            unsigned char extension = 255;
+            while (extension == 255)
+            {
+                if (input >= source_length)
+                {
+                    return -1;
+                }
+                extension = source[input++];
+                match_length += extension;
+            }
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > output || destination_length - output < match_length)
+        {
+            return -1;
+        }
+
+        /* Побайтовое копирование: совпадение может перекрывать само себя */
+        for (; match_length > 0; match_length--, output++)
+        {
+            destination[output] = destination[output - offset];
+        }
+    }
+
+    return output == destination_length ? 0 : -1;
+}
+
+/******************************************************************************
+ * Функция: encode_record_block
+ *
+ * Описание: Кодирует записи года в блок. Строки категорий, форматов и мест
+ *           заменяются номерами в словарях блока; даты, размеры (в сотых
+ *           долях МБ), ширины и высоты записываются отступом от минимума
+ *           блока (frame of reference); все номера и отступы упаковываются
+ *           по битам. Названия и теги записываются строками. Полученные
+ *           данные сжимаются lz_compress, если это уменьшает размер.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   segment_year - год, записи которого кодируются
+ *   block - массив для блока с заголовком (дописывается)
+ *
+ * Возвращает: 0 при успехе, 1 если дата записи не в формате ГГГГ-ММ-ДД и
+ *             блок не сохранит ее без потерь, -1 при нехватке памяти
+ ******************************************************************************/
+int encode_record_block(const Photo database[], int record_count, int segment_year,
+    ByteBuffer* block)
+{
+    ByteBuffer payload = { NULL, 0, 0, 0 };
+    unsigned int* values = NULL;
+    int* rows = NULL;
+    int row_count = 0;
+    int result = 0;
+    int i = 0;
+
+    rows = (int*)memory_allocate((size_t)(record_count > 0 ? record_count : 1) * sizeof(int));
+    values = (unsigned int*)memory_allocate((size_t)(record_count > 0 ? record_count : 1) * sizeof(unsigned int));
+    if (rows == NULL || values == NULL)
+    {
+        memory_release(rows);
+        memory_release(values);
+        return -1;
+    }
+
+    for (i = 0; i < record_count && result == 0; i++)
+    {
+        char formatted_date[16];
+        int date_key = 0;
+
+        if (database[i].is_deleted || database[i].segment_year != segment_year)
+        {
+            continue;
+        }
+
+        date_key = parse_date_key(database[i].date);
+        snprintf(formatted_date, sizeof(formatted_date), "%04d-%02d-%02d",
+            date_key / 10000, date_key / 100 % 100, date_key % 100);
+        if (date_key == 0 || strcmp(formatted_date, database[i].date) != 0)
+        {
+            result = 1;
+        }
+        rows[row_count++] = i;
+    }
+
+    if (result == 0)
+    {
+        result = encode_block_payload(database, rows, row_count, values, &payload);
+    }
+
+    /* Заголовок, затем данные в сжатом или исходном виде */
+    if (result == 0)
+    {
+        size_t header_position = block->length;
+        size_t data_position = 0;
+        size_t stored_length = 0;
+        unsigned char flags = BLOCK_FLAG_COMPRESSED;
+        unsigned char version = BLOCK_FORMAT_VERSION;
+
+        byte_buffer_append(block, BLOCK_MAGIC, 4);
+        byte_buffer_append(block, &version, 1);
+        byte_buffer_append(block, &flags, 1);
+        byte_buffer_append_uint32(block, (unsigned int)row_count);
+        byte_buffer_append_uint32(block, (unsigned int)payload.length);
+        byte_buffer_append_uint32(block, 0);
+        byte_buffer_append_uint32(block, block_checksum(payload.data, payload.length));
+        data_position = block->length;
+
+        lz_compress(payload.data, payload.length, block);
+        if (!block->error && block->length - data_position >= payload.length)
+        {
+            block->length = data_position;
+            block->data[header_position + 5] = 0;
+            byte_buffer_append(block, payload.data, payload.length);
+        }
+
+        /* Размер хранимых данных дописывается в заголовок после сжатия */
+        if (!block->error)
+        {
+            stored_length = block->length - data_position;
+            block->data[header_position + 14] = (unsigned char)(stored_length & 0xFF);
+            block->data[header_position + 15] = (unsigned char)((stored_length >> 8) & 0xFF);
+            block->data[header_position + 16] = (unsigned char)((stored_length >> 16) & 0xFF);
+            block->data[header_position + 17] = (unsigned char)((stored_length >> 24) & 0xFF);
+        }
+        result = block->error ? -1 : 0;
+    }
+
+    memory_release(payload.data);
+    memory_release(values);
+    memory_release(rows);
+    return result;
+}
+
+/******************************************************************************
+ * Функция: encode_block_payload
+ *
+ * Описание: Формирует несжатые данные блока: количество записей, три
+ *           словаря строк с упакованными номерами, четыре числовых столбца
+ *           с минимумом и упакованными отступами, затем названия и теги.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   rows - индексы кодируемых записей
+ *   row_count - количество кодируемых записей
+ *   values - рабочий массив на row_count чисел
+ *   payload - массив для данных блока (дописывается)
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int encode_block_payload(const Photo database[], const int rows[], int row_count,
+    unsigned int values[], ByteBuffer* payload)
+{
+    StringDictionary dictionary;
+    int field = 0;
+    int i = 0;
+
+    byte_buffer_append_varint(payload, (unsigned int)row_count);
+
+    /* Словари строк: номер записывается вместо каждого повторения */
+    for (field = 0; field < 3; field++)
+    {
+        string_dictionary_initialize(&dictionary);
+        for (i = 0; i < row_count; i++)
+        {
+            const Photo* photo = &database[rows[i]];
+            const char* text = field == 0 ? photo->category : (field == 1 ? photo->format : photo->place);
+            int value_id = string_dictionary_intern(&dictionary, text);
+
+            if (value_id < 0)
+            {
+                string_dictionary_release(&dictionary);
+                return -1;
+            }
+            values[i] = (unsigned int)value_id;
+        }
+
+        byte_buffer_append_varint(payload, (unsigned int)dictionary.value_count);
+        for (i = 0; i < dictionary.value_count; i++)
+        {
+            byte_buffer_append_string(payload, dictionary.values[i]);
+        }
+        bit_pack_values(payload, values, row_count);
+        string_dictionary_release(&dictionary);
+    }
+
+    /* Числовые поля: минимум блока и упакованные отступы от него */
+    for (field = 0; field < 4; field++)
+    {
+        long long minimum = 0;
+
+        for (i = 0; i < row_count; i++)
+        {
+            const Photo* photo = &database[rows[i]];
+            long long value = field == 0 ? parse_date_key(photo->date) :
+                field == 1 ? (long long)(photo->size * 100.0 + (photo->size >= 0 ? 0.5 : -0.5)) :
+                field == 2 ? photo->width : photo->height;
+
+            if (i == 0 || value < minimum)
+            {
+                minimum = value;
+            }
+            values[i] = (unsigned int)value;
+        }
+
+        for (i = 0; i < row_count; i++)
+        {
+            values[i] = (unsigned int)((long long)(int)values[i] - minimum);
+        }
+
+        /* Минимум может быть отрицательным - знак переносится в младший бит */
+        byte_buffer_append_varint(payload, minimum < 0 ?
+            (unsigned int)(((unsigned long long)(-minimum) << 1) - 1) :
+            (unsigned int)((unsigned long long)minimum << 1));
+        bit_pack_values(payload, values, row_count);
+    }
+
+    for (i = 0; i < row_count; i++)
+    {
+        byte_buffer_append_string(payload, database[rows[i]].name);
+        byte_buffer_append_string(payload, database[rows[i]].tags);
+    }
+
+    return payload->error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: decode_record_block
+ *
+ * Описание: Декодирует распакованный блок. Словари и числовые поля
+ *           читаются по столбцу за проход и сразу раскладываются в поля
+ *           новых записей в конце массива; промежуточное столбцовое
+ *           представление не строится.
+ *
+ * Параметры:
+ *   payload - распакованные данные блока
+ *   payload_length - размер данных
+ *   database - массив структур Photo
+ *   record_count - указатель на количество записей, увеличивается на
+ *                  число декодированных
+ *   segment_year - год запечатанного раздела
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных или нехватке места
+ ******************************************************************************/
+int decode_record_block(const unsigned char* payload, size_t payload_length,
+    Photo database[], int* record_count, int segment_year)
+{
+    ByteReader reader = { NULL, 0, 0, 0 };
+    StringDictionary dictionaries[3];
+    const size_t text_sizes[3] = {
+        sizeof(database->category), sizeof(database->format), sizeof(database->place)
+    };
+    Photo* rows = database + *record_count;
+    unsigned int* values = NULL;
+    char text[MAX_TAGS_LEN];
+    int row_count = 0;
+    int field = 0;
+    int i = 0;
+
+    reader.data = payload;
+    reader.length = payload_length;
+    row_count = (int)byte_reader_read_varint(&reader);
+    if (reader.error || row_count < 0 || row_count > MAX_PHOTOS - *record_count)
+    {
+        return -1;
+    }
+
+    values = (unsigned int*)memory_allocate((size_t)(row_count > 0 ? row_count : 1) * sizeof(unsigned int));
+    if (values == NULL)
+    {
+        return -1;
+    }
+
+    for (field = 0; field < 3; field++)
+    {
+        string_dictionary_initialize(&dictionaries[field]);
+    }
+
+    /* Категория, формат и место: словарь, затем номера строк */
+    for (field = 0; field < 3 && !reader.error; field++)
+    {
+        int value_count = (int)byte_reader_read_varint(&reader);
+
+        for (i = 0; i < value_count && !reader.error; i++)
+        {
+            if (byte_reader_read_string(&reader, text, sizeof(text)) != 0 ||
+                strlen(text) >= text_sizes[field] ||
+                string_dictionary_intern(&dictionaries[field], text) != i)
+            {
+                reader.error = 1;
+            }
+        }
+
+        if (!reader.error && bit_unpack_values(&reader, values, row_count) == 0)
+        {
+            for (i = 0; i < row_count; i++)
+            {
+                const char* value = NULL;
+
+                if (values[i] >= (unsigned int)value_count)
+                {
+                    reader.error = 1;
+                    break;
+                }
+
+                value = dictionaries[field].values[values[i]];
+                switch (field)
+                {
+                case 0:
+                    strcpy(rows[i].category, value);
+                    break;
+                case 1:
+                    strcpy(rows[i].format, value);
+                    break;
+                default:
+                    strcpy(rows[i].place, value);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (field = 0; field < 4 && !reader.error; field++)
+    {
+        unsigned int encoded_minimum = byte_reader_read_varint(&reader);
+        long long minimum = (encoded_minimum & 1) ?
+            -(long long)((encoded_minimum >> 1) + 1) : (long long)(encoded_minimum >> 1);
+
+        if (bit_unpack_values(&reader, values, row_count) != 0)
+        {
+            break;
+        }
+
+        for (i = 0; i < row_count; i++)
+        {
+            long long value = minimum + values[i];
+            unsigned int date_key = (unsigned int)value;
+
+            switch (field)
+            {
+            case 0:
+                snprintf(rows[i].date, sizeof(rows[i].date), "%04u-%02u-%02u",
+                    date_key / 10000 % 10000, date_key / 100 % 100, date_key % 100);
+                break;
+            case 1:
+                rows[i].size = (double)value / 100.0;
+                break;
+            case 2:
+                rows[i].width = (int)value;
+                break;
+            default:
+                rows[i].height = (int)value;
+                break;
+            }
+        }
+    }
+
+    for (field = 0; field < 3; field++)
+    {
+        string_dictionary_release(&dictionaries[field]);
+    }
+    memory_release(values);
+    if (reader.error)
+    {
+        return -1;
+    }
+
+    /* Названия и теги идут построчно в конце блока */
+    for (i = 0; i < row_count; i++)
+    {
+        if (byte_reader_read_string(&reader, rows[i].name, sizeof(rows[i].name)) != 0 ||
+            byte_reader_read_string(&reader, rows[i].tags, sizeof(rows[i].tags)) != 0)
+        {
+            return -1;
+        }
+
+        photo_refresh_search_keys(&rows[i]);
+        rows[i].is_deleted = 0;
+        rows[i].version = 0;
+        rows[i].segment_year = segment_year;
+    }
+
+    *record_count += row_count;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: write_block_file
+ *
+ * Описание: Кодирует записи года в сжатый блок и записывает его в файл.
+ *
+ * Параметры:
+ *   filename - имя файла блока
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   segment_year - год запечатанного раздела
+ *
+ * Возвращает: 0 при успехе, 1 если записи года нельзя закодировать без
+ *             потерь, -1 при ошибке записи или нехватке памяти
+ ******************************************************************************/
+int write_block_file(const char* filename, const Photo database[], int record_count,
+    int segment_year)
+{
+    ByteBuffer block = { NULL, 0, 0, 0 };
+    FILE* file_handle = NULL;
+    int result = encode_record_block(database, record_count, segment_year, &block);
+
+    if (result != 0)
+    {
+        memory_release(block.data);
+        return result;
+    }
+
+    file_handle = fopen(filename, "wb");
+    if (file_handle == NULL)
+    {
+        printf("Ошибка: Не удалось открыть файл '%s' для записи.\n", filename);
+        memory_release(block.data);
+        return -1;
+    }
+
+    if (fwrite(block.data, 1, block.length, file_handle) != block.length)
+    {
+        printf("Ошибка записи в файл.\n");
+        result = -1;
+    }
+
+    fclose(file_handle);
+    memory_release(block.data);
+    return result;
+}
+
+/******************************************************************************
+ * Функция: read_block_file
+ *
+ * Описание: Читает файл сжатого блока за одну операцию, проверяет
+ *           заголовок и контрольную сумму, распаковывает и декодирует
+ *           записи в конец массива.
+ *
+ * Параметры:
+ *   filename - имя файла блока
+ *   database - массив структур Photo
+ *   record_count - указатель на количество записей
+ *   segment_year - год запечатанного раздела
+ *
+ * Возвращает: 0 при успехе, -1 если файла нет или он поврежден
+ ******************************************************************************/
+int read_block_file(const char* filename, Photo database[], int* record_count, int segment_year)
+{
+    ByteReader header = { NULL, 0, 0, 0 };
+    FILE* file_handle = NULL;
+    unsigned char* file_data = NULL;
+    unsigned char* payload = NULL;
+    long file_length = 0;
+    unsigned int payload_length = 0;
+    unsigned int stored_length = 0;
+    unsigned int checksum = 0;
+    int first_record = *record_count;
+    int result = -1;
+    int previous_subsystem = memory_enter(MEMORY_IO);
+
+    file_handle = fopen(filename, "rb");
+    if (file_handle == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    if (fseek(file_handle, 0, SEEK_END) == 0)
+    {
+        file_length = ftell(file_handle);
+    }
+    if (file_length < BLOCK_HEADER_SIZE || fseek(file_handle, 0, SEEK_SET) != 0)
+    {
+        fclose(file_handle);
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    file_data = (unsigned char*)memory_allocate((size_t)file_length);
+    if (file_data == NULL || fread(file_data, 1, (size_t)file_length, file_handle) != (size_t)file_length)
+    {
+        fclose(file_handle);
+        memory_release(file_data);
+        return memory_leave(previous_subsystem, -1);
+    }
+    fclose(file_handle);
+
+    header.data = file_data;
+    header.length = (size_t)file_length;
+    header.position = 6;
+    byte_reader_read_uint32(&header);
+    payload_length = byte_reader_read_uint32(&header);
+    stored_length = byte_reader_read_uint32(&header);
+    checksum = byte_reader_read_uint32(&header);
+
+    /* Размер распакованных данных берется из заголовка и ограничивается,
+       чтобы поврежденный файл не мог запросить произвольно большой буфер */
+    if (memcmp(file_data, BLOCK_MAGIC, 4) == 0 && file_data[4] == BLOCK_FORMAT_VERSION &&
+        stored_length == (unsigned long)file_length - BLOCK_HEADER_SIZE &&
+        payload_length <= MAX_BLOCK_PAYLOAD_LEN)
+    {
+        if ((file_data[5] & BLOCK_FLAG_COMPRESSED) == 0)
+        {
+            payload = file_data + BLOCK_HEADER_SIZE;
+            result = (stored_length == payload_length) ? 0 : -1;
+        }
+        else
+        {
+            payload = (unsigned char*)memory_allocate(payload_length > 0 ? payload_length : 1);
+            result = (payload == NULL) ? -1 :
+                lz_decompress(file_data + BLOCK_HEADER_SIZE, stored_length, payload, payload_length);
+        }
+
+        if (result == 0 && block_checksum(payload, payload_length) != checksum)
+        {
+            result = -1;
+        }
+        if (result == 0)
+        {
+            result = decode_record_block(payload, payload_length,
+                database, record_count, segment_year);
+        }
+    }
+
+    if (result != 0)
+    {
+        *record_count = first_record;
+    }
+
+    if (payload != file_data + BLOCK_HEADER_SIZE)
+    {
+        memory_release(payload);
+    }
+    memory_release(file_data);
+    return memory_leave(previous_subsystem, result);
+}
+
+/******************************************************************************
+ * Функция: myers_next_symbol
+ *
+ * Описание: Выделяет очередной символ свернутой строки. Кириллица после
+ *           свертки занимает один байт CP1251, а прочие символы вне ASCII
+ *           остаются последовательностями UTF-8; такая последовательность
+ *           считается одним символом, чтобы опечатка в ней стоила 1, а не
+ *           число ее байт. Байт, за которым нет нужного числа байт
+ *           продолжения, считается одиночным символом CP1251.
+ *
+ * Параметры:
+ *   text - позиция в строке
+ *   byte_count - для длины символа в байтах
+ *
+ * Возвращает: номер символа: байт (0-255) или кодовая точка UTF-8 плюс 256
+ ******************************************************************************/
+unsigned int myers_next_symbol(const unsigned char* text, int* byte_count)
+{
+    unsigned int code_point = 0;
+    int length = 0;
+    int i = 0;
+
+    if (text[0] >= 0xC2 && text[0] <= 0xDF)
+    {
+        length = 2;
+        code_point = text[0] & 0x1F;
+    }
+    else if ((text[0] & 0xF0) == 0xE0)
+    {
+        length = 3;
+        code_point = text[0] & 0x0F;
+    }
+    else if (text[0] >= 0xF0 && text[0] <= 0xF4)
+    {
+        length = 4;
+        code_point = text[0] & 0x07;
+    }
+
+    for (i = 1; i < length; i++)
+    {
+        if ((text[i] & 0xC0) != 0x80)
+        {
+            length = 0;
+            break;
+        }
+        code_point = (code_point << 6) | (text[i] & 0x3F);
+    }
+
+    if (length == 0)
+    {
+        *byte_count = 1;
+        return text[0];
+    }
+
+    *byte_count = length;
+    return code_point + 256;
+}
+
+/******************************************************************************
+ * Функция: myers_symbol_mask
+ *
+ * Описание: Возвращает маску позиций символа в образце.
+ *
+ * Параметры:
+ *   pattern - подготовленный образец
+ *   symbol - номер символа (см. myers_next_symbol)
+ *
+ * Возвращает: маску позиций, 0 если символа в образце нет
+ ******************************************************************************/
+unsigned long long myers_symbol_mask(const MyersPattern* pattern, unsigned int symbol)
+{
+    int i = 0;
+
+    if (symbol < 256)
+    {
+        return pattern->masks[symbol];
+    }
+
+    for (i = 0; i < pattern->wide_count; i++)
+    {
+        if (pattern->wide_symbols[i] == symbol)
+        {
+            return pattern->wide_masks[i];
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: myers_prepare
+ *
+ * Описание: Строит битовые маски образца для алгоритма Майерса: для
+ *           каждого символа - множество позиций образца, где он встречается.
+ *           Образец длиннее MYERS_MAX_PATTERN символов не усекается, а
+ *           отвергается: по усеченному образцу расстояние перестало бы
+ *           быть симметричным, и BK-дерево отсекало бы нужные ветви.
+ *
+ * Параметры:
+ *   pattern - образец (свернутая строка)
+ *   prepared - структура для масок
+ *
+ * Возвращает: длину образца в символах, -1 если образец слишком длинный
+ ******************************************************************************/
+int myers_prepare(const char* pattern, MyersPattern* prepared)
+{
+    const unsigned char* bytes = (const unsigned char*)pattern;
+    int byte_count = 1;
+    int length = 0;
+    int i = 0;
+
+    memset(prepared->masks, 0, sizeof(prepared->masks));
+    prepared->wide_count = 0;
+    for (i = 0; bytes[i] != '\0'; i += byte_count)
+    {
+        unsigned int symbol = myers_next_symbol(bytes + i, &byte_count);
+        int j = 0;
+
+        if (length == MYERS_MAX_PATTERN)
+        {
+            prepared->length = 0;
+            return -1;
+        }
+
+        if (symbol < 256)
+        {
+            prepared->masks[symbol] |= 1ULL << length;
+        }
+        else
+        {
+            for (j = 0; j < prepared->wide_count && prepared->wide_symbols[j] != symbol; j++)
+                ;
+            if (j == prepared->wide_count)
+            {
+                prepared->wide_symbols[j] = symbol;
+                prepared->wide_masks[j] = 0;
+                prepared->wide_count++;
+            }
+            prepared->wide_masks[j] |= 1ULL << length;
+        }
+        length++;
+    }
+
+    prepared->length = length;
+    return length;
+}
+
+/******************************************************************************
+ * Функция: myers_edit_distance
+ *
+ * Описание: Вычисляет расстояние Левенштейна между образцом и строкой
+ *           бит-параллельным алгоритмом Майерса (в формулировке Хююрё):
+ *           столбец матрицы динамического программирования хранится как
+ *           два битовых вектора приращений, и каждый символ строки
+ *           обрабатывается за несколько машинных операций. Расстояние
+ *           считается в символах (см. myers_next_symbol), а не в байтах.
+ *
+ * Параметры:
+ *   pattern - подготовленный образец
+ *   text - строка
+ *
+ * Возвращает: расстояние редактирования
+ ******************************************************************************/
+int myers_edit_distance(const MyersPattern* pattern, const char* text)
+{
+    const unsigned char* bytes = (const unsigned char*)text;
+    unsigned long long positive_vertical = ~0ULL;
+    unsigned long long negative_vertical = 0;
+    unsigned long long last_bit = 0;
+    int score = pattern->length;
+    int byte_count = 1;
+    int i = 0;
+
+    if (pattern->length == 0)
+    {
+        for (i = 0; bytes[i] != '\0'; i += byte_count)
+        {
+            myers_next_symbol(bytes + i, &byte_count);
+            score++;
+        }
+        return score;
+    }
+
+    last_bit = 1ULL << (pattern->length - 1);
+    for (i = 0; bytes[i] != '\0'; i += byte_count)
+    {
+        unsigned long long equal = myers_symbol_mask(pattern, myers_next_symbol(bytes + i, &byte_count));
+        unsigned long long cross_vertical = equal | negative_vertical;
+        unsigned long long cross_horizontal =
+            (((equal & positive_vertical) + positive_vertical) ^ positive_vertical) | equal;
+        unsigned long long positive_horizontal = negative_vertical | ~(cross_horizontal | positive_vertical);
+        unsigned long long negative_horizontal = positive_vertical & cross_horizontal;
+
+        if (positive_horizontal & last_bit)
+        {
+            score++;
+        }
+        else if (negative_horizontal & last_bit)
+        {
+            score--;
+        }
+
+        /* Верхняя строка матрицы растет на 1 с каждым символом строки */
+        positive_horizontal = (positive_horizontal << 1) | 1ULL;
+        negative_horizontal <<= 1;
+        positive_vertical = negative_horizontal | ~(cross_vertical | positive_horizontal);
+        negative_vertical = positive_horizontal & cross_vertical;
+    }
+
+    return score;
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_initialize
+ *
+ * Описание: Инициализирует пустой индекс нечеткого поиска.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int fuzzy_index_initialize(FuzzyIndex* index)
+{
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    memset(index, 0, sizeof(*index));
+    return string_dictionary_initialize(&index->values);
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_release
+ *
+ * Описание: Освобождает память индекса нечеткого поиска.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int fuzzy_index_release(FuzzyIndex* index)
+{
+    int i = 0;
+
+    if (index == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < index->values.value_count; i++)
+    {
+        memory_release(index->postings[i].record_indices);
+    }
+    memory_release(index->postings);
+    memory_release(index->nodes);
+    string_dictionary_release(&index->values);
+    return fuzzy_index_initialize(index);
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_reserve
+ *
+ * Описание: Гарантирует место для списка записей и узла BK-дерева
+ *           значения с заданным номером.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *   value_id - номер значения в словаре
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int fuzzy_index_reserve(FuzzyIndex* index, int value_id)
+{
+    int new_capacity = index->posting_capacity > 0 ? index->posting_capacity : 16;
+
+    if (value_id < index->posting_capacity)
+    {
+        return 0;
+    }
+
+    while (new_capacity <= value_id)
+    {
+        new_capacity *= 2;
+    }
+
+    if (grow_array((void**)&index->postings, sizeof(PostingList), new_capacity) != 0 ||
+        grow_array((void**)&index->nodes, sizeof(BkTreeNode), new_capacity) != 0)
+    {
+        return -1;
+    }
+    memset(index->postings + index->posting_capacity, 0,
+        (size_t)(new_capacity - index->posting_capacity) * sizeof(PostingList));
+    index->posting_capacity = new_capacity;
+    index->node_capacity = new_capacity;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_add
+ *
+ * Описание: Добавляет запись в список ее значения. Новое различное
+ *           значение вставляется в BK-дерево: спуск идет по ребрам с
+ *           меткой, равной расстоянию до очередного узла, пока не
+ *           найдется свободное место.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *   folded_value - свернутое значение поля записи
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти или если значение
+ *             длиннее MYERS_MAX_PATTERN символов
+ ******************************************************************************/
+int fuzzy_index_add(FuzzyIndex* index, const char* folded_value, int record_index)
+{
+    char value[MAX_TAGS_LEN];
+    int value_id = 0;
+    int previous_subsystem = memory_enter(MEMORY_FUZZY);
+
+    if (normalize_query_text(folded_value, value, sizeof(value)) == 0)
+    {
+        return memory_leave(previous_subsystem, 0);
+    }
+
+    value_id = string_dictionary_find(&index->values, value);
+    if (value_id < 0)
+    {
+        MyersPattern pattern;
+        int node = 0;
+
+        if (myers_prepare(value, &pattern) < 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+
+        value_id = string_dictionary_intern(&index->values, value);
+        if (value_id < 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+
+        if (fuzzy_index_reserve(index, value_id) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+
+        index->nodes[value_id].edge_distance = 0;
+        index->nodes[value_id].first_child = -1;
+        index->nodes[value_id].next_sibling = -1;
+
+        /* Узел 0 - корень; остальные подвешиваются по расстоянию */
+        while (value_id > 0)
+        {
+            int distance = myers_edit_distance(&pattern, index->values.values[node]);
+            int child = index->nodes[node].first_child;
+
+            while (child >= 0 && index->nodes[child].edge_distance != distance)
+            {
+                child = index->nodes[child].next_sibling;
+            }
+
+            if (child < 0)
+            {
+                index->nodes[value_id].edge_distance = distance;
+                index->nodes[value_id].next_sibling = index->nodes[node].first_child;
+                index->nodes[node].first_child = value_id;
+                break;
+            }
+            node = child;
+        }
+    }
+
+    return memory_leave(previous_subsystem,
+        posting_list_insert(&index->postings[value_id], record_index));
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_remove
+ *
+ * Описание: Убирает запись из списка ее значения. Значение остается в
+ *           дереве; значения без записей пропускаются при поиске.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *   folded_value - свернутое значение поля записи до изменения
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 если значения нет
+ ******************************************************************************/
+int fuzzy_index_remove(FuzzyIndex* index, const char* folded_value, int record_index)
+{
+    char value[MAX_TAGS_LEN];
+    int value_id = 0;
+
+    normalize_query_text(folded_value, value, sizeof(value));
+    value_id = string_dictionary_find(&index->values, value);
+    if (value_id < 0)
+    {
+        return -1;
+    }
+
+    return posting_list_remove(&index->postings[value_id], record_index);
+}
+
+/******************************************************************************
+ * Функция: fuzzy_index_search
+ *
+ * Описание: Находит значения на расстоянии редактирования не больше
+ *           заданного. По неравенству треугольника у узла на расстоянии d
+ *           от запроса нужно проверять только ребра с метками от d - k до
+ *           d + k, поэтому просматривается малая часть дерева.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *   folded_query - нормализованный свернутый запрос
+ *   max_distance - допустимое число опечаток
+ *   matches - указатель для возврата массива найденных значений,
+ *             упорядоченного по расстоянию (освобождает вызывающая функция)
+ *
+ * Возвращает: количество найденных значений, -1 при нехватке памяти или
+ *             если запрос длиннее MYERS_MAX_PATTERN символов
+ ******************************************************************************/
+int fuzzy_index_search(const FuzzyIndex* index, const char* folded_query, int max_distance,
+    FuzzyMatch** matches)
+{
+    MyersPattern pattern;
+    int* stack = NULL;
+    int stack_size = 0;
+    int match_count = 0;
+
+    *matches = NULL;
+    if (myers_prepare(folded_query, &pattern) < 0)
+    {
+        return -1;
+    }
+    if (index->values.value_count == 0)
+    {
+        return 0;
+    }
+
+    stack = (int*)memory_allocate((size_t)index->values.value_count * sizeof(int));
+    *matches = (FuzzyMatch*)memory_allocate((size_t)index->values.value_count * sizeof(FuzzyMatch));
+    if (stack == NULL || *matches == NULL)
+    {
+        memory_release(stack);
+        memory_release(*matches);
+        *matches = NULL;
+        return -1;
+    }
+
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        int node = stack[--stack_size];
+        int distance = myers_edit_distance(&pattern, index->values.values[node]);
+        int child = 0;
+
+        if (distance <= max_distance && index->postings[node].count > 0)
+        {
+            (*matches)[match_count].value_id = node;
+            (*matches)[match_count].distance = distance;
+            match_count++;
+        }
+
+        for (child = index->nodes[node].first_child; child >= 0; child = index->nodes[child].next_sibling)
+        {
+            if (index->nodes[child].edge_distance >= distance - max_distance &&
+                index->nodes[child].edge_distance <= distance + max_distance)
+            {
+                stack[stack_size++] = child;
+            }
+        }
+    }
+
+    memory_release(stack);
+    qsort(*matches, (size_t)match_count, sizeof(FuzzyMatch), compare_fuzzy_matches);
+    return match_count;
+}
+
+/******************************************************************************
+ * Функция: compare_fuzzy_matches
+ *
+ * Описание: Функция сравнения для qsort: по расстоянию, затем по номеру
+ *           значения (порядку появления).
+ *
+ * Параметры:
+ *   first_match - указатель на первое значение
+ *   second_match - указатель на второе значение
+ *
+ * Возвращает: результат сравнения для qsort
+ ******************************************************************************/
+int compare_fuzzy_matches(const void* first_match, const void* second_match)
+{
+    const FuzzyMatch* match_a = (const FuzzyMatch*)first_match;
+    const FuzzyMatch* match_b = (const FuzzyMatch*)second_match;
+
+    if (match_a->distance != match_b->distance)
+    {
+        return match_a->distance - match_b->distance;
+    }
+
+    return (match_a->value_id > match_b->value_id) - (match_a->value_id < match_b->value_id);
+}
+
+/******************************************************************************
+ * Функция: suggest_similar_places
+ *
+ * Описание: Выводит места съемки, похожие на запрос, когда поиск по месту
+ *           ничего не нашел.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   folded_query - свернутый запрос
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество выведенных подсказок, -1 при нехватке памяти
+ ******************************************************************************/
+int suggest_similar_places(const Photo database[], const char* folded_query,
+    const ArchiveIndexes* indexes)
+{
+    FuzzyMatch* matches = NULL;
+    char query[MAX_TAGS_LEN];
+    int match_count = 0;
+    int i = 0;
+
+    /* Без индекса подсказки не выводятся, чтобы не просматривать весь архив */
+    if (!search_index_ready(indexes, SEARCH_INDEX_FUZZY))
+    {
+        return 0;
+    }
+
+    normalize_query_text(folded_query, query, sizeof(query));
+    match_count = fuzzy_index_search(&indexes->place_fuzzy, query, FUZZY_DEFAULT_DISTANCE, &matches);
+    if (match_count <= 0)
+    {
+        memory_release(matches);
+        return match_count;
+    }
+
+    if (match_count > FUZZY_SUGGESTION_LIMIT)
+    {
+        match_count = FUZZY_SUGGESTION_LIMIT;
+    }
+
+    printf("Возможно, вы имели в виду:\n");
+    for (i = 0; i < match_count; i++)
+    {
+        const PostingList* records = &indexes->place_fuzzy.postings[matches[i].value_id];
+        printf("  %s (фотографий: %d)\n", database[records->record_indices[0]].place, records->count);
+    }
+
+    memory_release(matches);
+    return match_count;
+}
+
+/******************************************************************************
+ * Функция: find_photos_fuzzy
+ *
+ * Описание: Ищет записи, у которых название или место съемки отличается
+ *           от запроса не более чем на заданное число опечаток (вставок,
+ *           удалений и замен символов). Результаты упорядочены по
+ *           наименьшему расстоянию, затем по номеру записи. Если индексы
+ *           освобождены из-за лимита памяти или еще перестраиваются, они
+ *           строятся на время запроса.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
+ *   text - строка запроса
+ *   max_distance - допустимое число опечаток
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество найденных фотографий, -1 при ошибке
+ ******************************************************************************/
+int find_photos_fuzzy(const Photo database[], int record_count, const char* text,
+    int max_distance, const ArchiveIndexes* indexes)
+{
+    const FuzzyIndex* fields[2];
+    FuzzyIndex transient_indexes[2];
+    MyersPattern pattern;
+    int use_transient = !search_index_ready(indexes, SEARCH_INDEX_FUZZY);
+    int transient_built = 0;
+    char search_text[MAX_TAGS_LEN];
+    char folded_text[MAX_TAGS_LEN];
+    int* best_distance = NULL;
+    FuzzyMatch* ranked = NULL;
+    int found_records = 0;
+    int field = 0;
+    int i = 0;
+
+    if (count_live_records(database, record_count) <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    if (text == NULL || normalize_query_text(text, search_text, sizeof(search_text)) == 0)
+    {
+        printf("Ошибка: Не задана строка для поиска.\n");
+        return -1;
+    }
+
+    fold_search_text(search_text, folded_text, sizeof(folded_text));
+    if (myers_prepare(folded_text, &pattern) < 0)
+    {
+        printf("Ошибка: Строка для поиска длиннее %d символов.\n", MYERS_MAX_PATTERN);
+        return -1;
+    }
+
+    fields[0] = &indexes->name_fuzzy;
+    fields[1] = &indexes->place_fuzzy;
+    if (use_transient)
+    {
+        fuzzy_index_initialize(&transient_indexes[0]);
+        fuzzy_index_initialize(&transient_indexes[1]);
+        transient_built = 1;
+        for (i = 0; i < record_count && transient_built; i++)
+        {
+            if (!database[i].is_deleted &&
+                (fuzzy_index_add(&transient_indexes[0], database[i].name_key, i) != 0 ||
+                fuzzy_index_add(&transient_indexes[1], database[i].place_key, i) != 0))
+            {
+                transient_built = 0;
+            }
+        }
+        fields[0] = &transient_indexes[0];
+        fields[1] = &transient_indexes[1];
+    }
+
+    best_distance = (int*)memory_allocate((size_t)record_count * sizeof(int));
+    ranked = (FuzzyMatch*)memory_allocate((size_t)record_count * sizeof(FuzzyMatch));
+    if (best_distance == NULL || ranked == NULL ||
+        (use_transient && !transient_built))
+    {
+        memory_release(best_distance);
+        memory_release(ranked);
+        if (use_transient)
+        {
+            fuzzy_index_release(&transient_indexes[0]);
+            fuzzy_index_release(&transient_indexes[1]);
+        }
+        printf("Ошибка: Недостаточно памяти для поиска.\n");
+        return -1;
+    }
+
+    for (i = 0; i < record_count; i++)
+    {
+        best_distance[i] = -1;
+    }
+
+    /* Для каждой записи берется лучшее из расстояний по названию и месту */
+    for (field = 0; field < 2; field++)
+    {
+        FuzzyMatch* matches = NULL;
+        int match_count = fuzzy_index_search(fields[field], folded_text, max_distance, &matches);
+        int j = 0;
+
+        for (i = 0; i < match_count; i++)
+        {
+            const PostingList* records = &fields[field]->postings[matches[i].value_id];
+            for (j = 0; j < records->count; j++)
+            {
+                int record_index = records->record_indices[j];
+                if (best_distance[record_index] < 0 || matches[i].distance < best_distance[record_index])
+                {
+                    best_distance[record_index] = matches[i].distance;
+                }
+            }
+        }
+        memory_release(matches);
+    }
+
+    for (i = 0; i < record_count; i++)
+    {
+        if (best_distance[i] >= 0)
+        {
+            ranked[found_records].value_id = i;
+            ranked[found_records].distance = best_distance[i];
+            found_records++;
+        }
+    }
+    qsort(ranked, (size_t)found_records, sizeof(FuzzyMatch), compare_fuzzy_matches);
+
+    printf("\nРезультаты нечеткого поиска для '%s' (опечаток не больше %d):\n",
+        search_text, max_distance);
+    print_horizontal_separator();
+
+    for (i = 0; i < found_records; i++)
+    {
+        const Photo* photo = &database[ranked[i].value_id];
+        printf("%d. %s (Место: %s, Дата: %s) - опечаток: %d\n",
+            i + 1,
+            photo->name,
+            photo->place,
+            photo->date,
+            ranked[i].distance);
+    }
+
+    print_horizontal_separator();
+
+    if (found_records == 0)
+    {
+        printf("Похожие названия и места съемки не найдены.\n");
+    }
+    else
+    {
+        printf("\nНайдено фотографий: %d\n", found_records);
+    }
+
+    memory_release(best_distance);
+    memory_release(ranked);
+    if (use_transient)
+    {
+        fuzzy_index_release(&transient_indexes[0]);
+        fuzzy_index_release(&transient_indexes[1]);
+    }
+    return found_records;
+}
+
+/******************************************************************************
+ * Функция: find_photos_fuzzy_interactive
+ *
+ * Описание: Запрашивает строку и допустимое число опечаток и выполняет
+ *           нечеткий поиск по названию и месту съемки.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество найденных фотографий, -1 при ошибке
+ ******************************************************************************/
+int find_photos_fuzzy_interactive(const Photo database[], int record_count,
+    const ArchiveIndexes* indexes)
+{
+    char search_text[MAX_PLACE_LEN];
+    char distance_text[16];
+    int max_distance = FUZZY_DEFAULT_DISTANCE;
+
+    printf("Введите название или место съемки: ");
+    if (fgets(search_text, sizeof(search_text), stdin) == NULL)
+    {
+        return -1;
+    }
+    if (strchr(search_text, '\n') == NULL)
+    {
+        clear_stdin_buffer();
+    }
+    search_text[strcspn(search_text, "\n")] = '\0';
+
+    printf("Допустимое число опечаток (0-%d, по умолчанию %d): ",
+        FUZZY_MAX_DISTANCE, FUZZY_DEFAULT_DISTANCE);
+    if (fgets(distance_text, sizeof(distance_text), stdin) == NULL)
+    {
+        return -1;
+    }
+    if (strchr(distance_text, '\n') == NULL)
+    {
+        clear_stdin_buffer();
+    }
+
+    /* Пустой или неверный ввод означает значение по умолчанию */
+    if (sscanf(distance_text, "%d", &max_distance) != 1 ||
+        max_distance < 0 || max_distance > FUZZY_MAX_DISTANCE)
+    {
+        max_distance = FUZZY_DEFAULT_DISTANCE;
+    }
+
+    return find_photos_fuzzy(database, record_count, search_text, max_distance, indexes);
+}
+
+/******************************************************************************
+ * Функция: kd_photo_point
+ *
+ * Описание: Вычисляет точку записи в пространстве размеров: ширина,
+ *           высота, размер файла и соотношение сторон.
+ *
+ * Параметры:
+ *   photo - запись
+ *   point - массив из KD_DIMENSIONS координат
+ *
+ * Возвращает: 0
+ ******************************************************************************/
+int kd_photo_point(const Photo* photo, double point[])
+{
+    point[KD_AXIS_WIDTH] = (double)photo->width;
+    point[KD_AXIS_HEIGHT] = (double)photo->height;
+    point[KD_AXIS_SIZE] = photo->size;
+    point[KD_AXIS_ASPECT] = photo->height > 0 ? (double)photo->width / (double)photo->height : 0.0;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_initialize
+ *
+ * Описание: Инициализирует пустое k-d дерево.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int kd_tree_initialize(KdTree* tree)
+{
+    int axis = 0;
+
+    if (tree == NULL)
+    {
+        return -1;
+    }
+
+    memset(tree, 0, sizeof(*tree));
+    tree->root = -1;
+    for (axis = 0; axis < KD_DIMENSIONS; axis++)
+    {
+        tree->scale[axis] = 1.0;
+    }
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_release
+ *
+ * Описание: Освобождает память k-d дерева.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int kd_tree_release(KdTree* tree)
+{
+    if (tree == NULL)
+    {
+        return -1;
+    }
+
+    memory_release(tree->nodes);
+    return kd_tree_initialize(tree);
+}
+
+/******************************************************************************
+ * Функция: kd_select_nth
+ *
+ * Описание: Переставляет узлы диапазона так, что на месте nth оказывается
+ *           узел, который стоял бы там после сортировки по оси, левее -
+ *           не большие, правее - не меньшие (алгоритм Хоара, в среднем
+ *           линейное время). Разбиение Хоара не вырождается при большом
+ *           числе одинаковых значений, типичном для ширины и высоты.
+ *
+ * Параметры:
+ *   nodes - массив узлов
+ *   first - первый узел диапазона
+ *   last - последний узел диапазона
+ *   nth - искомая позиция
+ *   axis - ось сравнения
+ *
+ * Возвращает: nth
+ ******************************************************************************/
+int kd_select_nth(KdTreeNode nodes[], int first, int last, int nth, int axis)
+{
+    while (first < last)
+    {
+        double pivot = nodes[first + (last - first) / 2].point[axis];
+        int low = first;
+        int high = last;
+
+        while (low <= high)
+        {
+            while (nodes[low].point[axis] < pivot)
+            {
+                low++;
+            }
+            while (nodes[high].point[axis] > pivot)
+            {
+                high--;
+            }
+            if (low <= high)
+            {
+                KdTreeNode swapped = nodes[low];
+                nodes[low] = nodes[high];
+                nodes[high] = swapped;
+                low++;
+                high--;
+            }
+        }
+
+        if (nth <= high)
+        {
+            last = high;
+        }
+        else if (nth >= low)
+        {
+            first = low;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return nth;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_build_range
+ *
+ * Описание: Строит сбалансированное поддерево из узлов диапазона: медиана
+ *           по оси уровня становится корнем, половины - поддеревьями.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   first - первый узел диапазона
+ *   last - последний узел диапазона
+ *   depth - глубина поддерева
+ *
+ * Возвращает: номер корня поддерева, -1 для пустого диапазона
+ ******************************************************************************/
+int kd_tree_build_range(KdTree* tree, int first, int last, int depth)
+{
+    int middle = 0;
+    int axis = depth % KD_DIMENSIONS;
+
+    if (first > last)
+    {
+        return -1;
+    }
+
+    middle = kd_select_nth(tree->nodes, first, last, first + (last - first) / 2, axis);
+    tree->nodes[middle].axis = axis;
+    tree->nodes[middle].left = kd_tree_build_range(tree, first, middle - 1, depth + 1);
+    tree->nodes[middle].right = kd_tree_build_range(tree, middle + 1, last, depth + 1);
+    return middle;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_rebuild
+ *
+ * Описание: Выбрасывает убранные узлы и заново строит сбалансированное
+ *           дерево из оставшихся. Заодно пересчитывает разброс значений
+ *           по осям для метрики поиска ближайших.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *
+ * Возвращает: 0
+ ******************************************************************************/
+int kd_tree_rebuild(KdTree* tree)
+{
+    double low[KD_DIMENSIONS];
+    double high[KD_DIMENSIONS];
+    int live_count = 0;
+    int axis = 0;
+    int i = 0;
+
+    for (i = 0; i < tree->node_count; i++)
+    {
+        if (tree->nodes[i].record_index >= 0)
+        {
+            tree->nodes[live_count++] = tree->nodes[i];
+        }
+    }
+
+    for (axis = 0; axis < KD_DIMENSIONS; axis++)
+    {
+        low[axis] = KD_UNBOUNDED;
+        high[axis] = -KD_UNBOUNDED;
+        for (i = 0; i < live_count; i++)
+        {
+            if (tree->nodes[i].point[axis] < low[axis])
+            {
+                low[axis] = tree->nodes[i].point[axis];
+            }
+            if (tree->nodes[i].point[axis] > high[axis])
+            {
+                high[axis] = tree->nodes[i].point[axis];
+            }
+        }
+        tree->scale[axis] = high[axis] > low[axis] ? high[axis] - low[axis] : 1.0;
+    }
+
+    tree->node_count = live_count;
+    tree->built_count = live_count;
+    tree->change_count = 0;
+    tree->removed_count = 0;
+    tree->root = kd_tree_build_range(tree, 0, live_count - 1, 0);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_build
+ *
+ * Описание: Строит k-d дерево по всем существующим записям за один проход
+ *           (O(n log n)).
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int kd_tree_build(KdTree* tree, const Photo database[], int record_count)
+{
+    int i = 0;
+    int previous_subsystem = memory_enter(MEMORY_DIMENSIONS);
+
+    if (record_count > tree->node_capacity)
+    {
+        if (grow_array((void**)&tree->nodes, sizeof(KdTreeNode), record_count) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+        tree->node_capacity = record_count;
+    }
+
+    tree->node_count = 0;
+    for (i = 0; i < record_count; i++)
+    {
+        if (!database[i].is_deleted)
+        {
+            KdTreeNode* node = &tree->nodes[tree->node_count++];
+            kd_photo_point(&database[i], node->point);
+            node->record_index = i;
+        }
+    }
+
+    return memory_leave(previous_subsystem, kd_tree_rebuild(tree));
+}
+
+/******************************************************************************
+ * Функция: kd_tree_after_change
+ *
+ * Описание: Учитывает вставку или удаление. Вставки без перестройки
+ *           удлиняют ветви, а убранные узлы остаются в дереве, поэтому
+ *           после заметной доли изменений дерево собирается заново - так
+ *           глубина остается логарифмической, а затраты на перестройку
+ *           распределяются по изменениям.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *
+ * Возвращает: 1 если дерево перестроено, 0 иначе
+ ******************************************************************************/
+int kd_tree_after_change(KdTree* tree)
+{
+    int threshold = tree->built_count * KD_REBUILD_PERCENT / 100;
+
+    tree->change_count++;
+    if (threshold < KD_REBUILD_MIN_CHANGES)
+    {
+        threshold = KD_REBUILD_MIN_CHANGES;
+    }
+
+    if (tree->change_count < threshold)
+    {
+        return 0;
+    }
+
+    kd_tree_rebuild(tree);
+    return 1;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_insert
+ *
+ * Описание: Добавляет запись в дерево: спуск от корня по осям узлов до
+ *           свободного места.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   photo - добавленная запись
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int kd_tree_insert(KdTree* tree, const Photo* photo, int record_index)
+{
+    KdTreeNode* node = NULL;
+    int node_index = tree->node_count;
+    int parent = tree->root;
+    int previous_subsystem = memory_enter(MEMORY_DIMENSIONS);
+
+    if (tree->node_count == tree->node_capacity)
+    {
+        int new_capacity = tree->node_capacity > 0 ? tree->node_capacity * 2 : 16;
+        if (grow_array((void**)&tree->nodes, sizeof(KdTreeNode), new_capacity) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+        tree->node_capacity = new_capacity;
+    }
+
+    node = &tree->nodes[node_index];
+    kd_photo_point(photo, node->point);
+    node->record_index = record_index;
+    node->axis = 0;
+    node->left = -1;
+    node->right = -1;
+    tree->node_count++;
+
+    if (parent < 0)
+    {
+        tree->root = node_index;
+    }
+
+    while (parent >= 0)
+    {
+        KdTreeNode* current = &tree->nodes[parent];
+        int* child = node->point[current->axis] < current->point[current->axis] ?
+            &current->left : &current->right;
+
+        if (*child < 0)
+        {
+            *child = node_index;
+            node->axis = (current->axis + 1) % KD_DIMENSIONS;
+            break;
+        }
+        parent = *child;
+    }
+
+    kd_tree_after_change(tree);
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: kd_tree_remove
+ *
+ * Описание: Убирает запись из дерева. Узел ищется запросом по точке записи
+ *           и помечается убранным; память освобождается при перестройке.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   photo - запись в том виде, в каком она была добавлена
+ *   record_index - индекс записи
+ *
+ * Возвращает: 0 при успехе, -1 если записи нет в дереве
+ ******************************************************************************/
+int kd_tree_remove(KdTree* tree, const Photo* photo, int record_index)
+{
+    double point[KD_DIMENSIONS];
+    int* stack = NULL;
+    int stack_size = 0;
+    int result = -1;
+
+    if (tree->root < 0)
+    {
+        return -1;
+    }
+
+    stack = (int*)memory_allocate((size_t)tree->node_count * sizeof(int));
+    if (stack == NULL)
+    {
+        return -1;
+    }
+
+    kd_photo_point(photo, point);
+    stack[stack_size++] = tree->root;
+    while (stack_size > 0)
+    {
+        KdTreeNode* current = &tree->nodes[stack[--stack_size]];
+        int axis = current->axis;
+
+        if (current->record_index == record_index &&
+            memcmp(current->point, point, sizeof(point)) == 0)
+        {
+            current->record_index = -1;
+            tree->removed_count++;
+            result = 0;
+            break;
+        }
+
+        /* Точки, равные узлу по его оси, при сборке попадают в обе стороны */
+        if (point[axis] <= current->point[axis] && current->left >= 0)
+        {
+            stack[stack_size++] = current->left;
+        }
+        if (point[axis] >= current->point[axis] && current->right >= 0)
+        {
+            stack[stack_size++] = current->right;
+        }
+    }
+
+    memory_release(stack);
+    if (result == 0)
+    {
+        kd_tree_after_change(tree);
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_range
+ *
+ * Описание: Находит записи, все координаты которых лежат в границах
+ *           области. Поддерево просматривается, только если его
+ *           полупространство пересекается с областью.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   box - область запроса
+ *   record_indices - указатель для возврата массива индексов по
+ *                    возрастанию (освобождает вызывающая функция)
+ *
+ * Возвращает: количество найденных записей, -1 при нехватке памяти
+ ******************************************************************************/
+int kd_tree_range(const KdTree* tree, const KdBox* box, int** record_indices)
+{
+    int* stack = NULL;
+    int stack_size = 0;
+    int found_count = 0;
+
+    *record_indices = NULL;
+    if (tree->root < 0)
+    {
+        return 0;
+    }
+
+    stack = (int*)memory_allocate((size_t)tree->node_count * sizeof(int));
+    *record_indices = (int*)memory_allocate((size_t)tree->node_count * sizeof(int));
+    if (stack == NULL || *record_indices == NULL)
+    {
+        memory_release(stack);
+        memory_release(*record_indices);
+        *record_indices = NULL;
+        return -1;
+    }
+
+    stack[stack_size++] = tree->root;
+    while (stack_size > 0)
+    {
+        const KdTreeNode* current = &tree->nodes[stack[--stack_size]];
+        int axis = current->axis;
+        int inside = current->record_index >= 0;
+        int i = 0;
+
+        for (i = 0; i < KD_DIMENSIONS && inside; i++)
+        {
+            inside = current->point[i] >= box->low[i] && current->point[i] <= box->high[i];
+        }
+        if (inside)
+        {
+            (*record_indices)[found_count++] = current->record_index;
+        }
+
+        if (box->low[axis] <= current->point[axis] && current->left >= 0)
+        {
+            stack[stack_size++] = current->left;
+        }
+        if (box->high[axis] >= current->point[axis] && current->right >= 0)
+        {
+            stack[stack_size++] = current->right;
+        }
+    }
+
+    memory_release(stack);
+    qsort(*record_indices, (size_t)found_count, sizeof(int), compare_integers);
+    return found_count;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_nearest_visit
+ *
+ * Описание: Рекурсивно обходит поддерево в поиске ближайших к образцу
+ *           записей. Сначала просматривается сторона образца; другая
+ *           сторона - только если разделяющая плоскость ближе худшей из
+ *           уже найденных записей.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   node - корень поддерева
+ *   target - точка образца
+ *   limit - сколько записей искать
+ *   neighbors - найденные записи по возрастанию расстояния
+ *   found - количество найденных записей
+ *
+ * Возвращает: 0
+ ******************************************************************************/
+int kd_tree_nearest_visit(const KdTree* tree, int node, const double target[], int limit,
+    KdNeighbor neighbors[], int* found)
+{
+    const KdTreeNode* current = NULL;
+    double offset = 0.0;
+    int axis = 0;
+
+    if (node < 0)
+    {
+        return 0;
+    }
+
+    current = &tree->nodes[node];
+    if (current->record_index >= 0)
+    {
+        double distance = 0.0;
+        int position = 0;
+
+        /* Оси в разных единицах приводятся к разбросу значений по архиву */
+        for (axis = 0; axis < KD_DIMENSIONS; axis++)
+        {
+            double delta = (current->point[axis] - target[axis]) / tree->scale[axis];
+            distance += delta * delta;
+        }
+
+        if (*found < limit || distance < neighbors[*found - 1].distance)
+        {
+            position = *found < limit ? (*found)++ : limit - 1;
+            while (position > 0 && neighbors[position - 1].distance > distance)
+            {
+                neighbors[position] = neighbors[position - 1];
+                position--;
+            }
+            neighbors[position].record_index = current->record_index;
+            neighbors[position].distance = distance;
+        }
+    }
+
+    axis = current->axis;
+    offset = (target[axis] - current->point[axis]) / tree->scale[axis];
+    kd_tree_nearest_visit(tree, offset < 0.0 ? current->left : current->right, target, limit,
+        neighbors, found);
+    if (*found < limit || offset * offset < neighbors[*found - 1].distance)
+    {
+        kd_tree_nearest_visit(tree, offset < 0.0 ? current->right : current->left, target, limit,
+            neighbors, found);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: kd_tree_nearest
+ *
+ * Описание: Находит записи, ближайшие к образцу по ширине, высоте,
+ *           размеру и соотношению сторон.
+ *
+ * Параметры:
+ *   tree - k-d дерево
+ *   sample - образец (используются только размеры)
+ *   limit - сколько записей искать
+ *   neighbors - массив не меньше limit элементов для результата
+ *
+ * Возвращает: количество найденных записей
+ ******************************************************************************/
+int kd_tree_nearest(const KdTree* tree, const Photo* sample, int limit, KdNeighbor neighbors[])
+{
+    double target[KD_DIMENSIONS];
+    int found = 0;
+
+    kd_photo_point(sample, target);
+    kd_tree_nearest_visit(tree, tree->root, target, limit, neighbors, &found);
+    return found;
+}
+
+/******************************************************************************
+ * Функция: read_optional_number
+ *
+ * Описание: Запрашивает число; пустая строка оставляет значение прежним.
+ *
+ * Параметры:
+ *   label - подсказка
+ *   value - значение по умолчанию и результат
+ *
+ * Возвращает: 1 если число введено, 0 если оставлено прежнее, -1 при
+ *             ошибке ввода
+ ******************************************************************************/
+int read_optional_number(const char* label, double* value)
+{
+    char line[64];
+
+    printf("%s: ", label);
+    if (fgets(line, sizeof(line), stdin) == NULL)
+    {
+        return -1;
+    }
+    if (strchr(line, '\n') == NULL)
+    {
+        clear_stdin_buffer();
+    }
+
+    return sscanf(line, "%lf", value) == 1 ? 1 : 0;
+}
+
+/******************************************************************************
+ * Функция: find_photos_in_dimension_tree
+ *
+ * Описание: Запрашивает условия и ищет по размерам кадра через k-d дерево:
+ *           либо все записи в заданных границах ширины, высоты, размера и
+ *           ориентации (например, "не уже 3840, альбомные, до 10 МБ"), либо
+ *           записи, ближайшие к заданным размерам.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   tree - k-d дерево по размерам записей
+ *
+ * Возвращает: количество найденных фотографий, -1 при ошибке
+ ******************************************************************************/
+int find_photos_in_dimension_tree(const Photo database[], const KdTree* tree)
+{
+    KdNeighbor neighbors[KD_NEAREST_MAX];
+    int* record_indices = NULL;
+    double mode = 1.0;
+    int found_records = 0;
+    int i = 0;
+
+    printf("\n1. Все фотографии в заданных границах\n");
+    printf("2. Фотографии, ближайшие к заданным размерам\n");
+    if (read_optional_number("Вид поиска (по умолчанию 1)", &mode) < 0)
+    {
+        return -1;
+    }
+
+    if (mode == 2.0)
+    {
+        Photo sample;
+        double width = 0.0;
+        double height = 0.0;
+        double limit = KD_NEAREST_DEFAULT;
+
+        memset(&sample, 0, sizeof(sample));
+        if (read_optional_number("Ширина (пиксели)", &width) != 1 ||
+            read_optional_number("Высота (пиксели)", &height) != 1 ||
+            read_optional_number("Размер (МБ)", &sample.size) != 1)
+        {
+            printf("Ошибка: Нужно указать ширину, высоту и размер.\n");
+            return -1;
+        }
+        if (read_optional_number("Количество фотографий (по умолчанию 5)", &limit) < 0)
+        {
+            return -1;
+        }
+        if (limit < 1.0 || limit > KD_NEAREST_MAX)
+        {
+            limit = KD_NEAREST_DEFAULT;
+        }
+
+        sample.width = (int)width;
+        sample.height = (int)height;
+        found_records = kd_tree_nearest(tree, &sample, (int)limit, neighbors);
+
+        printf("\nФотографии, ближайшие к %dx%d, %.2f МБ:\n", sample.width, sample.height, sample.size);
+        print_horizontal_separator();
+        for (i = 0; i < found_records; i++)
+        {
+            const Photo* photo = &database[neighbors[i].record_index];
+            printf("%d. %s (%dx%d, %.2f МБ, %s)\n",
+                i + 1, photo->name, photo->width, photo->height, photo->size, photo->format);
+        }
+        print_horizontal_separator();
+        return found_records;
+    }
+    else
+    {
+        KdBox box;
+        double orientation = 0.0;
+        int axis = 0;
+
+        for (axis = 0; axis < KD_DIMENSIONS; axis++)
+        {
+            box.low[axis] = -KD_UNBOUNDED;
+            box.high[axis] = KD_UNBOUNDED;
+        }
+
+        printf("Пустая строка - без ограничения.\n");
+        if (read_optional_number("Ширина от (пиксели)", &box.low[KD_AXIS_WIDTH]) < 0 ||
+            read_optional_number("Ширина до (пиксели)", &box.high[KD_AXIS_WIDTH]) < 0 ||
+            read_optional_number("Высота от (пиксели)", &box.low[KD_AXIS_HEIGHT]) < 0 ||
+            read_optional_number("Высота до (пиксели)", &box.high[KD_AXIS_HEIGHT]) < 0 ||
+            read_optional_number("Размер от (МБ)", &box.low[KD_AXIS_SIZE]) < 0 ||
+            read_optional_number("Размер до (МБ)", &box.high[KD_AXIS_SIZE]) < 0 ||
+            read_optional_number("Ориентация (0 - любая, 1 - альбомная, 2 - книжная, 3 - квадратная)",
+                &orientation) < 0)
+        {
+            return -1;
+        }
+
+        if (orientation == 1.0)
+        {
+            box.low[KD_AXIS_ASPECT] = 1.0 + KD_SQUARE_TOLERANCE;
+        }
+        else if (orientation == 2.0)
+        {
+            box.high[KD_AXIS_ASPECT] = 1.0 - KD_SQUARE_TOLERANCE;
+        }
+        else if (orientation == 3.0)
+        {
+            box.low[KD_AXIS_ASPECT] = 1.0 - KD_SQUARE_TOLERANCE;
+            box.high[KD_AXIS_ASPECT] = 1.0 + KD_SQUARE_TOLERANCE;
+        }
+
+        found_records = kd_tree_range(tree, &box, &record_indices);
+        if (found_records < 0)
+        {
+            printf("Ошибка: Недостаточно памяти для поиска.\n");
+            return -1;
+        }
+
+        printf("\nФотографии в заданных границах:\n");
+        print_horizontal_separator();
+        for (i = 0; i < found_records; i++)
+        {
+            const Photo* photo = &database[record_indices[i]];
+            printf("%d. %s (%dx%d, %.2f МБ, %s)\n",
+                i + 1, photo->name, photo->width, photo->height, photo->size, photo->format);
+        }
+        print_horizontal_separator();
+
+        if (found_records == 0)
+        {
+            printf("Фотографии с такими размерами не найдены.\n");
+        }
+        else
+        {
+            printf("\nНайдено фотографий: %d\n", found_records);
+        }
+
+        memory_release(record_indices);
+        return found_records;
+    }
+}
+
+/******************************************************************************
+ * Функция: find_photos_by_dimensions_interactive
+ *
+ * Описание: Поиск по размерам кадра. Если индекс размеров недоступен
+ *           (освобожден из-за лимита памяти), дерево строится на время
+ *           запроса.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество занятых ячеек массива
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество найденных фотографий, -1 при ошибке
+ ******************************************************************************/
+int find_photos_by_dimensions_interactive(const Photo database[], int record_count,
+    const ArchiveIndexes* indexes)
+{
+    KdTree transient_tree;
+    int found_records = 0;
+
+    if (count_live_records(database, record_count) <= 0)
+    {
+        printf("База данных пуста.\n");
+        return -1;
+    }
+
+    if (search_index_ready(indexes, SEARCH_INDEX_DIMENSIONS))
+    {
+        return find_photos_in_dimension_tree(database, &indexes->dimensions);
+    }
+
+    kd_tree_initialize(&transient_tree);
+    if (kd_tree_build(&transient_tree, database, record_count) != 0)
+    {
+        kd_tree_release(&transient_tree);
+        printf("Ошибка: Недостаточно памяти для поиска.\n");
+        return -1;
+    }
+
+    found_records = find_photos_in_dimension_tree(database, &transient_tree);
+    kd_tree_release(&transient_tree);
+    return found_records;
+}
+
+/******************************************************************************
+ * Функция: schema_next_token
+ *
+ * Описание: Выделяет очередное поле строки файла архива: текст до
+ *           разделителя '|' или конца строки.
+ *
+ * Параметры:
+ *   cursor - позиция в строке; после поля указывает на следующее поле
+ *            или равна NULL, если строка закончилась
+ *
+ * Возвращает: поле (строка с завершающим нулем), NULL если полей больше нет
+ ******************************************************************************/
+char* schema_next_token(char** cursor)
+{
+    char* token = *cursor;
+    size_t length = 0;
+
+    if (token == NULL)
+    {
+        return NULL;
+    }
+
+    length = strcspn(token, "|\r\n");
+    *cursor = token[length] == '|' ? token + length + 1 : NULL;
+    token[length] = '\0';
+    return token;
+}
+
+/******************************************************************************
+ * Функция: schema_parse_text
+ *
+ * Описание: Читает текстовое поле. Пустое или не помещающееся в поле
+ *           записи значение считается ошибкой.
+ *
+ * Параметры:
+ *   cursor - позиция в строке
+ *   value - поле записи
+ *   value_size - размер поля записи
+ *
+ * Возвращает: 0 при успехе, -1 если поля нет, оно пустое или слишком длинное
+ ******************************************************************************/
+int schema_parse_text(char** cursor, char* value, size_t value_size)
+{
+    const char* token = schema_next_token(cursor);
+
+    if (token == NULL || token[0] == '\0' || strlen(token) >= value_size)
+    {
+        return -1;
+    }
+
+    strcpy(value, token);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: schema_parse_real
+ *
+ * Описание: Читает вещественное поле (с десятичным разделителем локали,
+ *           как его записывает fprintf).
+ *
+ * Параметры:
+ *   cursor - позиция в строке
+ *   value - поле записи
+ *
+ * Возвращает: 0 при успехе, -1 если поля нет или это не число
+ ******************************************************************************/
+int schema_parse_real(char** cursor, double* value)
+{
+    const char* token = schema_next_token(cursor);
+    char* end = NULL;
+
+    if (token == NULL)
+    {
+        return -1;
+    }
+
+    *value = strtod(token, &end);
+    return (end == token || *end != '\0') ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: schema_parse_integer
+ *
+ * Описание: Читает целое поле.
+ *
+ * Параметры:
+ *   cursor - позиция в строке
+ *   value - поле записи
+ *
+ * Возвращает: 0 при успехе, -1 если поля нет или это не число
+ ******************************************************************************/
+int schema_parse_integer(char** cursor, int* value)
+{
+    const char* token = schema_next_token(cursor);
+    char* end = NULL;
+
+    if (token == NULL)
+    {
+        return -1;
+    }
+
+    *value = (int)strtol(token, &end, 10);
+    return (end == token || *end != '\0') ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: parse_photo_record
+ *
+ * Описание: Разбирает строку файла архива в поля записи по схеме
+ *           PHOTO_SCHEMA. Пробелы в конце строки не учитываются. Строка
+ *           изменяется (разделители заменяются нулями).
+ *
+ * Параметры:
+ *   line - строка файла
+ *   photo - запись для заполнения
+ *
+ * Возвращает: 0 при успехе, -1 если прочитаны не все поля
+ ******************************************************************************/
+int parse_photo_record(char* line, Photo* photo)
+{
+    char* cursor = line;
+    size_t length = strlen(line);
+    int result = 0;
+
+    while (length > 0 && strchr(" \t\r\n", line[length - 1]) != NULL)
+    {
+        line[--length] = '\0';
+    }
+
+#define SCHEMA_PARSE_TEXT(field, length, label) \
+    result |= schema_parse_text(&cursor, photo->field, sizeof(photo->field));
+#define SCHEMA_PARSE_REAL(field, label, view_label, view_suffix) \
+    result |= schema_parse_real(&cursor, &photo->field);
+#define SCHEMA_PARSE_INTEGER(field, label, view_label, view_suffix) \
+    result |= schema_parse_integer(&cursor, &photo->field);
+    PHOTO_SCHEMA(SCHEMA_PARSE_TEXT, SCHEMA_PARSE_REAL, SCHEMA_PARSE_INTEGER)
+#undef SCHEMA_PARSE_TEXT
+#undef SCHEMA_PARSE_REAL
+#undef SCHEMA_PARSE_INTEGER
+
+    return result != 0 ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: write_photo_record
+ *
+ * Описание: Записывает поля записи строкой файла архива по схеме
+ *           PHOTO_SCHEMA (через '|').
+ *
+ * Параметры:
+ *   stream - файл архива
+ *   photo - запись
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int write_photo_record(FILE* stream, const Photo* photo)
+{
+    const char* separator = "";
+    int result = 0;
+
+#define SCHEMA_WRITE_TEXT(field, length, label) \
+    result |= fprintf(stream, "%s%s", separator, photo->field) < 0; \
+    separator = "|";
+#define SCHEMA_WRITE_REAL(field, label, view_label, view_suffix) \
+    result |= fprintf(stream, "%s%.2f", separator, photo->field) < 0; \
+    separator = "|";
+#define SCHEMA_WRITE_INTEGER(field, label, view_label, view_suffix) \
+    result |= fprintf(stream, "%s%d", separator, photo->field) < 0; \
+    separator = "|";
+    PHOTO_SCHEMA(SCHEMA_WRITE_TEXT, SCHEMA_WRITE_REAL, SCHEMA_WRITE_INTEGER)
+#undef SCHEMA_WRITE_TEXT
+#undef SCHEMA_WRITE_REAL
+#undef SCHEMA_WRITE_INTEGER
+
+    result |= fputc('\n', stream) == EOF;
+    return result != 0 ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: format_csv_header
+ *
+ * Описание: Форматирует строку заголовка CSV из имен полей схемы.
+ *
+ * Параметры:
+ *   buffer - буфер вывода
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи
+ ******************************************************************************/
+int format_csv_header(OutputBuffer* buffer)
+{
+    const char* separator = "";
+
+#define SCHEMA_HEADER_TEXT(field, length, label) \
+    output_append_string(buffer, separator); \
+    output_append_string(buffer, #field); \
+    separator = ",";
+#define SCHEMA_HEADER_NUMBER(field, label, view_label, view_suffix) \
+    output_append_string(buffer, separator); \
+    output_append_string(buffer, #field); \
+    separator = ",";
+    PHOTO_SCHEMA(SCHEMA_HEADER_TEXT, SCHEMA_HEADER_NUMBER, SCHEMA_HEADER_NUMBER)
+#undef SCHEMA_HEADER_TEXT
+#undef SCHEMA_HEADER_NUMBER
+
+    return output_append_repeated(buffer, '\n', 1);
+}
+
+/******************************************************************************
+ * Функция: print_schema_fields
+ *
+ * Описание: Выводит пронумерованный (с 1) список полей схемы.
+ *
+ * Возвращает: количество полей
+ ******************************************************************************/
+int print_schema_fields(void)
+{
+    int number = 0;
+
+#define SCHEMA_PRINT_TEXT(field, length, label) \
+    printf("%d. %s\n", ++number, label);
+#define SCHEMA_PRINT_NUMBER(field, label, view_label, view_suffix) \
+    printf("%d. %s\n", ++number, label);
+    PHOTO_SCHEMA(SCHEMA_PRINT_TEXT, SCHEMA_PRINT_NUMBER, SCHEMA_PRINT_NUMBER)
+#undef SCHEMA_PRINT_TEXT
+#undef SCHEMA_PRINT_NUMBER
+
+    return number;
+}
+
+/******************************************************************************
+ * Функция: encode_real_sort_key
+ *
+ * Описание: Кодирует вещественное число 8 байтами так, что побайтовое
+ *           сравнение совпадает со сравнением чисел: у положительных
+ *           инвертируется знаковый бит, у отрицательных - все биты.
+ *
+ * Параметры:
+ *   key - место в ключе
+ *   value - число
+ *
+ * Возвращает: количество записанных байт
+ ******************************************************************************/
+int encode_real_sort_key(unsigned char key[], double value)
+{
+    unsigned long long bits = 0;
+    int i = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    bits = (bits >> 63) != 0 ? ~bits : bits | (1ULL << 63);
+    for (i = 7; i >= 0; i--)
+    {
+        key[i] = (unsigned char)(bits & 0xFF);
+        bits >>= 8;
+    }
+
+    return 8;
+}
+
+/******************************************************************************
+ * Функция: encode_integer_sort_key
+ *
+ * Описание: Кодирует целое число 4 байтами со старшего, инвертируя
+ *           знаковый бит, чтобы отрицательные числа шли раньше.
+ *
+ * Параметры:
+ *   key - место в ключе
+ *   value - число
+ *
+ * Возвращает: количество записанных байт
+ ******************************************************************************/
+int encode_integer_sort_key(unsigned char key[], int value)
+{
+    unsigned int bits = (unsigned int)value ^ 0x80000000U;
+
+    key[0] = (unsigned char)(bits >> 24);
+    key[1] = (unsigned char)(bits >> 16);
+    key[2] = (unsigned char)(bits >> 8);
+    key[3] = (unsigned char)bits;
+    return 4;
+}
+
+/******************************************************************************
+ * Функция: append_field_sort_key
+ *
+ * Описание: Дописывает в ключ закодированное поле записи. Строки
+ *           дополняются нулями до длины поля, поэтому побайтовое сравнение
+ *           ключей дает тот же порядок, что strcmp.
+ *
+ * Параметры:
+ *   key - место в ключе
+ *   photo - запись
+ *   field - номер поля схемы (PHOTO_FIELD_...)
+ *
+ * Возвращает: количество записанных байт
+ ******************************************************************************/
+int append_field_sort_key(unsigned char key[], const Photo* photo, int field)
+{
+    switch (field)
+    {
+#define SCHEMA_SORT_KEY_TEXT(field, length, label) \
+    case PHOTO_FIELD_##field: \
+        strncpy((char*)key, photo->field, length); \
+        return length;
+#define SCHEMA_SORT_KEY_REAL(field, label, view_label, view_suffix) \
+    case PHOTO_FIELD_##field: \
+        return encode_real_sort_key(key, photo->field);
+#define SCHEMA_SORT_KEY_INTEGER(field, label, view_label, view_suffix) \
+    case PHOTO_FIELD_##field: \
+        return encode_integer_sort_key(key, photo->field);
+    PHOTO_SCHEMA(SCHEMA_SORT_KEY_TEXT, SCHEMA_SORT_KEY_REAL, SCHEMA_SORT_KEY_INTEGER)
+#undef SCHEMA_SORT_KEY_TEXT
+#undef SCHEMA_SORT_KEY_REAL
+#undef SCHEMA_SORT_KEY_INTEGER
+    default:
+        return 0;
+    }
+}
+
+/******************************************************************************
+ * Функция: build_photo_sort_key
+ *
+ * Описание: Строит ключ сортировки записи: поля в заданном порядке,
+ *           поля по убыванию - с инвертированными байтами. Порядок записей
+ *           определяется одним memcmp ключей вместо цепочки сравнений полей.
+ *
+ * Параметры:
+ *   photo - запись
+ *   order - поля сортировки (без повторов)
+ *   order_length - количество полей
+ *   key - ключ длиной PHOTO_SORT_KEY_LEN
+ *
+ * Возвращает: количество значащих байт ключа
+ ******************************************************************************/
+int build_photo_sort_key(const Photo* photo, const SortKeyField order[], int order_length,
+    unsigned char key[])
+{
+    int offset = 0;
+    int i = 0;
+
+    memset(key, 0, PHOTO_SORT_KEY_LEN);
+    for (i = 0; i < order_length; i++)
+    {
+        int length = append_field_sort_key(key + offset, photo, order[i].field);
+
+        if (order[i].descending)
+        {
+            int j = 0;
+            for (j = 0; j < length; j++)
+            {
+                key[offset + j] = (unsigned char)~key[offset + j];
+            }
+        }
+        offset += length;
+    }
+
+    return offset;
+}
+
+/******************************************************************************
+ * Функция: compare_sort_entries
+ *
+ * Описание: Функция сравнения для qsort: по значащим байтам ключа, при
+ *           равенстве - по исходному положению записи (сортировка
+ *           устойчива).
+ *
+ * Параметры:
+ *   first_entry - указатель на первый ключ
+ *   second_entry - указатель на второй ключ
+ *
+ * Возвращает: результат сравнения для qsort
+ ******************************************************************************/
+int compare_sort_entries(const void* first_entry, const void* second_entry)
+{
+    const SortKeyEntry* entry_a = (const SortKeyEntry*)first_entry;
+    const SortKeyEntry* entry_b = (const SortKeyEntry*)second_entry;
+    int length = entry_a->key_length < entry_b->key_length ?
+        entry_a->key_length : entry_b->key_length;
+    int comparison = memcmp(entry_a->key, entry_b->key, (size_t)length);
+
+    if (comparison != 0)
+    {
+        return comparison;
+    }
+    if (entry_a->key_length != entry_b->key_length)
+    {
+        return entry_a->key_length - entry_b->key_length;
+    }
+
+    return (entry_a->record_index > entry_b->record_index) -
+        (entry_a->record_index < entry_b->record_index);
+}
+
+/******************************************************************************
+ * Функция: sort_database_by_fields
+ *
+ * Описание: Сортирует записи в заданном порядке полей. Ключи строятся один
+ *           раз на запись, затем сортируются ключи с индексами, и записи
+ *           переставляются за один проход.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   order - поля сортировки (без повторов)
+ *   order_length - количество полей
+ *
+ * Возвращает: 0 при успешной сортировке, -1 при нехватке памяти
+ ******************************************************************************/
+int sort_database_by_fields(Photo database[], int record_count, const SortKeyField order[],
+    int order_length)
+{
+    SortKeyEntry* entries = NULL;
+    Photo* sorted = NULL;
+    int i = 0;
+
+    if (record_count <= 1)
+    {
+        return 0;
+    }
+
+    entries = (SortKeyEntry*)memory_allocate((size_t)record_count * sizeof(SortKeyEntry));
+    sorted = (Photo*)memory_allocate((size_t)record_count * sizeof(Photo));
+    if (entries == NULL || sorted == NULL)
+    {
+        memory_release(entries);
+        memory_release(sorted);
+        return -1;
+    }
+
+    for (i = 0; i < record_count; i++)
+    {
+        entries[i].key_length = build_photo_sort_key(&database[i], order, order_length,
+            entries[i].key);
+        entries[i].record_index = i;
+    }
+
+    qsort(entries, (size_t)record_count, sizeof(SortKeyEntry), compare_sort_entries);
+    for (i = 0; i < record_count; i++)
+    {
+        sorted[i] = database[entries[i].record_index];
+    }
+    memcpy(database, sorted, (size_t)record_count * sizeof(Photo));
+
+    memory_release(entries);
+    memory_release(sorted);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: read_sort_order
+ *
+ * Описание: Запрашивает порядок сортировки: номера полей схемы через
+ *           пробел, знак минус означает сортировку по убыванию.
+ *
+ * Параметры:
+ *   order - массив не меньше PHOTO_FIELD_COUNT элементов для результата
+ *   order_length - количество выбранных полей (0 - порядок по умолчанию)
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке ввода
+ ******************************************************************************/
+int read_sort_order(SortKeyField order[], int* order_length)
+{
+    char line[MAX_TAGS_LEN];
+    char* cursor = line;
+
+    *order_length = 0;
+    printf("\nПоля записи:\n");
+    print_schema_fields();
+    printf("Номера полей через пробел, минус - по убыванию (например: 2 -6 1).\n");
+    printf("Пустая строка - дата, категория, разрешение: ");
+    if (fgets(line, sizeof(line), stdin) == NULL)
+    {
+        return -1;
+    }
+    if (strchr(line, '\n') == NULL)
+    {
+        clear_stdin_buffer();
+    }
+
+    while (1)
+    {
+        char* end = NULL;
+        long number = strtol(cursor, &end, 10);
+        long field = number < 0 ? -number : number;
+        int i = 0;
+
+        if (end == cursor)
+        {
+            break;
+        }
+        cursor = end;
+
+        if (field < 1 || field > PHOTO_FIELD_COUNT)
+        {
+            printf("Ошибка: Номер поля должен быть от 1 до %d.\n", PHOTO_FIELD_COUNT);
+            return -1;
+        }
+
+        for (i = 0; i < *order_length; i++)
+        {
+            if (order[i].field == field - 1)
+            {
+                printf("Ошибка: Поле %ld указано дважды.\n", field);
+                return -1;
+            }
+        }
+
+        order[*order_length].field = (int)field - 1;
+        order[*order_length].descending = number < 0;
+        (*order_length)++;
+    }
+
+    if (strspn(cursor, " \t\r\n") != strlen(cursor))
+    {
+        printf("Ошибка: Ожидаются номера полей.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: sort_database_interactive
+ *
+ * Описание: Запрашивает порядок сортировки и сортирует записи. Без
+ *           выбранных полей используется многоуровневая сортировка по
+ *           умолчанию.
+ *
+ * Параметры:
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успешной сортировке, -1 при ошибке
+ ******************************************************************************/
+int sort_database_interactive(Photo database[], int record_count)
+{
+    SortKeyField order[PHOTO_FIELD_COUNT];
+    int order_length = 0;
+
+    if (record_count <= 1)
+    {
+        printf("Нечего сортировать. В базе данных %d записей.\n", record_count);
+        return -1;
+    }
+
+    if (read_sort_order(order, &order_length) != 0)
+    {
+        return -1;
+    }
+
+    if (order_length == 0)
+    {
+        return sort_database_multi_level(database, record_count);
+    }
+
+    return sort_database_by_fields(database, record_count, order, order_length);
+}
+
+/******************************************************************************
+ * Функция: memory_accounting_initialize
+ *
+ * Описание: Обнуляет счетчики памяти и задает лимит: из переменной
+ *           окружения PHOTO_ARCHIVE_MEMORY_KB (в килобайтах, 0 - без
+ *           лимита) или значение по умолчанию.
+ *
+ * Параметры: нет
+ *
+ * Возвращает: 0 при успехе
+ ******************************************************************************/
+int memory_accounting_initialize(void)
+{
+    const char* budget_text = getenv(MEMORY_BUDGET_VARIABLE);
+    char* end = NULL;
+    long budget_kb = 0;
+
+    memset(&memory_accounting, 0, sizeof(memory_accounting));
+    memory_accounting.active_subsystem = MEMORY_TEMPORARY;
+    memory_accounting.budget_bytes = MEMORY_BUDGET_BYTES;
+
+    if (budget_text != NULL)
+    {
+        budget_kb = strtol(budget_text, &end, 10);
+        if (end != budget_text && *end == '\0' && budget_kb >= 0)
+        {
+            memory_accounting.budget_bytes = (size_t)budget_kb * 1024;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: memory_account_change
+ *
+ * Описание: Учитывает изменение занятой подсистемой памяти и обновляет
+ *           пиковые значения.
+ *
+ * Параметры:
+ *   subsystem - подсистема (MEMORY_...)
+ *   added_bytes - выделено байт
+ *   removed_bytes - освобождено байт
+ *
+ * Возвращает: 0 при успехе
+ ******************************************************************************/
+int memory_account_change(int subsystem, size_t added_bytes, size_t removed_bytes)
+{
+    MemorySubsystem* counters = &memory_accounting.subsystems[subsystem];
+
+    counters->current_bytes = counters->current_bytes + added_bytes - removed_bytes;
+    if (counters->current_bytes > counters->peak_bytes)
+    {
+        counters->peak_bytes = counters->current_bytes;
+    }
+
+    memory_accounting.current_bytes = memory_accounting.current_bytes + added_bytes - removed_bytes;
+    if (memory_accounting.current_bytes > memory_accounting.peak_bytes)
+    {
+        memory_accounting.peak_bytes = memory_accounting.current_bytes;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: memory_register_static
+ *
+ * Описание: Учитывает статический массив подсистемы в общем объеме памяти.
+ *
+ * Параметры:
+ *   subsystem - подсистема (MEMORY_...)
+ *   size - размер массива в байтах
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int memory_register_static(int subsystem, size_t size)
+{
+    if (subsystem < 0 || subsystem >= MEMORY_SUBSYSTEM_COUNT)
+    {
+        return -1;
+    }
+
+    memory_accounting.subsystems[subsystem].static_bytes += size;
+    return memory_account_change(subsystem, size, 0);
+}
+
+/******************************************************************************
+ * Функция: memory_enter
+ *
+ * Описание: Делает подсистему текущей: новые блоки памяти учитываются за
+ *           ней до вызова memory_leave.
+ *
+ * Параметры:
+ *   subsystem - подсистема (MEMORY_...)
+ *
+ * Возвращает: прежнюю текущую подсистему
+ ******************************************************************************/
+int memory_enter(int subsystem)
+{
+    int previous_subsystem = memory_accounting.active_subsystem;
+
+    memory_accounting.active_subsystem = subsystem;
+    return previous_subsystem;
+}
+
+/******************************************************************************
+ * Функция: memory_leave
+ *
+ * Описание: Восстанавливает прежнюю текущую подсистему. Пропускает через
+ *           себя результат функции, чтобы им можно было завершить return.
+ *
+ * Параметры:
+ *   previous_subsystem - подсистема, возвращенная memory_enter
+ *   result - результат функции
+ *
+ * Возвращает: result
+ ******************************************************************************/
+int memory_leave(int previous_subsystem, int result)
+{
+    memory_accounting.active_subsystem = previous_subsystem;
+    return result;
+}
+
+/******************************************************************************
+ * Функция: memory_allocate
+ *
+ * Описание: Выделяет блок памяти и учитывает его за текущей подсистемой.
+ *           Перед данными хранится заголовок с размером блока и
+ *           подсистемой, поэтому освобождение не требует их передачи.
+ *
+ * Параметры:
+ *   size - размер блока в байтах
+ *
+ * Возвращает: указатель на блок, NULL при нехватке памяти
+ ******************************************************************************/
+void* memory_allocate(size_t size)
+{
+    MemoryBlockHeader* header = NULL;
+
+    if (size > (size_t)-1 - sizeof(MemoryBlockHeader))
+    {
+        memory_accounting.failed_count++;
+        return NULL;
+    }
+
+    header = (MemoryBlockHeader*)malloc(sizeof(MemoryBlockHeader) + size);
+    if (header == NULL)
+    {
+        memory_accounting.failed_count++;
+        return NULL;
+    }
+
+    header->info.size = size;
+    header->info.subsystem = memory_accounting.active_subsystem;
+    memory_accounting.subsystems[header->info.subsystem].allocation_count++;
+    memory_account_change(header->info.subsystem, size, 0);
+    return header + 1;
+}
+
+/******************************************************************************
+ * Функция: memory_allocate_zeroed
+ *
+ * Описание: Выделяет обнуленный массив и учитывает его за текущей
+ *           подсистемой.
+ *
+ * Параметры:
+ *   count - количество элементов
+ *   size - размер элемента в байтах
+ *
+ * Возвращает: указатель на массив, NULL при нехватке памяти
+ ******************************************************************************/
+void* memory_allocate_zeroed(size_t count, size_t size)
+{
+    void* block = NULL;
+
+    if (size != 0 && count > (size_t)-1 / size)
+    {
+        memory_accounting.failed_count++;
+        return NULL;
+    }
+
+    block = memory_allocate(count * size);
+    if (block != NULL)
+    {
+        memset(block, 0, count * size);
+    }
+
+    return block;
+}
+
+/******************************************************************************
+ * Функция: memory_reallocate
+ *
+ * Описание: Изменяет размер блока. Блок остается за подсистемой, которой
+ *           был выделен; новый блок (block = NULL) учитывается за текущей.
+ *
+ * Параметры:
+ *   block - блок, выделенный memory_allocate, или NULL
+ *   size - новый размер в байтах
+ *
+ * Возвращает: указатель на блок, NULL при нехватке памяти (прежний блок
+ *             при этом не освобождается)
+ ******************************************************************************/
+void* memory_reallocate(void* block, size_t size)
+{
+    MemoryBlockHeader* header = NULL;
+    MemoryBlockHeader* resized = NULL;
+    size_t old_size = 0;
+
+    if (block == NULL)
+    {
+        return memory_allocate(size);
+    }
+
+    if (size > (size_t)-1 - sizeof(MemoryBlockHeader))
+    {
+        memory_accounting.failed_count++;
+        return NULL;
+    }
+
+    header = (MemoryBlockHeader*)block - 1;
+    old_size = header->info.size;
+    resized = (MemoryBlockHeader*)realloc(header, sizeof(MemoryBlockHeader) + size);
+    if (resized == NULL)
+    {
+        memory_accounting.failed_count++;
+        return NULL;
+    }
+
+    resized->info.size = size;
+    memory_accounting.subsystems[resized->info.subsystem].allocation_count++;
+    memory_account_change(resized->info.subsystem, size, old_size);
+    return resized + 1;
+}
+
+/******************************************************************************
+ * Функция: memory_release
+ *
+ * Описание: Освобождает блок и вычитает его из счетчиков подсистемы.
+ *
+ * Параметры:
+ *   block - блок, выделенный memory_allocate, или NULL
+ *
+ * Возвращает: 0 при успехе
+ ******************************************************************************/
+int memory_release(void* block)
+{
+    MemoryBlockHeader* header = NULL;
+
+    if (block == NULL)
+    {
+        return 0;
+    }
+
+    header = (MemoryBlockHeader*)block - 1;
+    memory_account_change(header->info.subsystem, 0, header->info.size);
+    free(header);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: memory_over_budget
+ *
+ * Описание: Проверяет, превышен ли лимит памяти.
+ *
+ * Параметры: нет
+ *
+ * Возвращает: 1 если лимит превышен, 0 если нет или лимит не задан
+ ******************************************************************************/
+int memory_over_budget(void)
+{
+    return memory_accounting.budget_bytes != 0 &&
+        memory_accounting.current_bytes > memory_accounting.budget_bytes;
+}
+
+/******************************************************************************
+ * Функция: memory_subsystem_name
+ *
+ * Описание: Возвращает название подсистемы для вывода статистики.
+ *
+ * Параметры:
+ *   subsystem - подсистема (MEMORY_...)
+ *
+ * Возвращает: строку с названием
+ ******************************************************************************/
+const char* memory_subsystem_name(int subsystem)
+{
+    static const char* const names[MEMORY_SUBSYSTEM_COUNT] = {
+        "Временные массивы",
+        "Записи",
+        "Словари строк",
+        "Кэш запросов",
+        "Столбцы",
+        "Сводки",
+        "Триграммы места",
+        "Разделы и теги",
+        "Нечеткий поиск",
+        "Индекс размеров",
+        "Ввод-вывод",
+        "Автодополнение"
+    };
+
+    if (subsystem < 0 || subsystem >= MEMORY_SUBSYSTEM_COUNT)
+    {
+        return "?";
+    }
+
+    return names[subsystem];
+}
+
+/******************************************************************************
+ * Функция: print_memory_statistics
+ *
+ * Описание: Выводит занятую и пиковую память по подсистемам, общий объем,
+ *           лимит, индексы, освобожденные из-за лимита, и перестраиваемые
+ *           индексы.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: 0 при успешном выводе, -1 при ошибке
+ ******************************************************************************/
+int print_memory_statistics(const ArchiveIndexes* indexes)
+{
+    const MemorySubsystem* counters = NULL;
+    int subsystem = 0;
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    printf("\n");
+    print_horizontal_separator();
+    printf("          СТАТИСТИКА ПАМЯТИ, КБ          \n");
+    print_horizontal_separator();
+    /* Название в последнем столбце: ширина кириллицы в байтах не совпадает с экранной */
+    printf("    Занято        Пик    Статич.  Выделений  Подсистема\n");
+    for (subsystem = 0; subsystem < MEMORY_SUBSYSTEM_COUNT; subsystem++)
+    {
+        counters = &memory_accounting.subsystems[subsystem];
+        printf("%10.1f %10.1f %10.1f %10ld  %s\n",
+            counters->current_bytes / 1024.0,
+            counters->peak_bytes / 1024.0,
+            counters->static_bytes / 1024.0,
+            counters->allocation_count,
+            memory_subsystem_name(subsystem));
+    }
+    print_horizontal_separator();
+    printf("Всего занято: %.1f КБ, пик: %.1f КБ\n",
+        memory_accounting.current_bytes / 1024.0, memory_accounting.peak_bytes / 1024.0);
+    if (memory_accounting.budget_bytes == 0)
+    {
+        printf("Лимит памяти: не задан\n");
+    }
+    else
+    {
+        printf("Лимит памяти: %.1f КБ\n", memory_accounting.budget_bytes / 1024.0);
+    }
+    printf("Отказов в выделении памяти: %ld\n", memory_accounting.failed_count);
+
+    if (indexes->suspended_indexes != 0)
+    {
+        printf("Освобождены из-за лимита:%s%s%s\n",
+            (indexes->suspended_indexes & SEARCH_INDEX_TRIGRAMS) ? " триграммы места" : "",
+            (indexes->suspended_indexes & SEARCH_INDEX_FUZZY) ? " нечеткий поиск" : "",
+            (indexes->suspended_indexes & SEARCH_INDEX_DIMENSIONS) ? " индекс размеров" : "");
+    }
+    if (indexes->pending_indexes != 0)
+    {
+        printf("Перестраиваются (внесено записей: %d):%s%s%s\n",
+            indexes->rebuild_position,
+            (indexes->pending_indexes & SEARCH_INDEX_TRIGRAMS) ? " триграммы места" : "",
+            (indexes->pending_indexes & SEARCH_INDEX_PARTITIONS) ? " разделы и теги" : "",
+            (indexes->pending_indexes & SEARCH_INDEX_FUZZY) ? " нечеткий поиск" : "");
+    }
+    print_horizontal_separator();
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_enforce_budget
+ *
+ * Описание: При превышении лимита памяти освобождает необязательные
+ *           структуры, пока объем не уложится в лимит: сначала кэш
+ *           запросов, затем индекс триграмм места (поиск по месту
+ *           переходит на полный просмотр), индексы нечеткого поиска и
+ *           индекс размеров (они строятся на время запроса). Вызывается
+ *           между операциями пользователя.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *
+ * Возвращает: количество освобожденных индексов, -1 при ошибке
+ ******************************************************************************/
+int archive_indexes_enforce_budget(ArchiveIndexes* indexes)
+{
+    int released_count = 0;
+
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    if (!memory_over_budget())
+    {
+        return 0;
+    }
+
+    query_cache_clear(&indexes->query_cache);
+
+    if (memory_over_budget() && (indexes->suspended_indexes & SEARCH_INDEX_TRIGRAMS) == 0)
+    {
+        trigram_index_release(&indexes->place_trigrams);
+        indexes->suspended_indexes |= SEARCH_INDEX_TRIGRAMS;
+        indexes->pending_indexes &= ~SEARCH_INDEX_TRIGRAMS;
+        released_count++;
+    }
+
+    if (memory_over_budget() && (indexes->suspended_indexes & SEARCH_INDEX_FUZZY) == 0)
+    {
+        fuzzy_index_release(&indexes->name_fuzzy);
+        fuzzy_index_release(&indexes->place_fuzzy);
+        indexes->suspended_indexes |= SEARCH_INDEX_FUZZY;
+        indexes->pending_indexes &= ~SEARCH_INDEX_FUZZY;
+        released_count++;
+    }
+
+    if (memory_over_budget() && (indexes->suspended_indexes & SEARCH_INDEX_DIMENSIONS) == 0)
+    {
+        kd_tree_release(&indexes->dimensions);
+        indexes->suspended_indexes |= SEARCH_INDEX_DIMENSIONS;
+        released_count++;
+    }
+
+    return released_count;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_resume
+ *
+ * Описание: Заново строит индексы, освобожденные из-за лимита памяти.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_resume(ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    if (indexes == NULL)
+    {
+        return -1;
+    }
+
+    if (indexes->suspended_indexes == 0)
+    {
+        return 0;
+    }
+
+    indexes->suspended_indexes = 0;
+    return search_indexes_build(indexes, database, record_count);
+}
+
+/******************************************************************************
+ * Функция: change_memory_budget_interactive
+ *
+ * Описание: Запрашивает новый лимит памяти, заново строит освобожденные
+ *           индексы и снова применяет лимит.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int change_memory_budget_interactive(ArchiveIndexes* indexes, const Photo database[],
+    int record_count)
+{
+    double budget_kb = memory_accounting.budget_bytes / 1024.0;
+    int input_result = 0;
+
+    input_result = read_optional_number("Новый лимит памяти, КБ (0 - без лимита, "
+        "пустая строка - оставить)", &budget_kb);
+    if (input_result <= 0)
+    {
+        return input_result;
+    }
+
+    memory_accounting.budget_bytes = budget_kb > 0.0 ? (size_t)(budget_kb * 1024.0) : 0;
+    if (archive_indexes_resume(indexes, database, record_count) != 0)
+    {
+        printf("Внимание: Недостаточно памяти для построения индексов.\n");
+    }
+
+    if (archive_indexes_enforce_budget(indexes) > 0)
+    {
+        printf("Часть индексов освобождена, чтобы уложиться в лимит.\n");
+    }
+    printf("Лимит памяти изменен.\n");
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: read_file_bytes
+ *
+ * Описание: Читает файл целиком в память за одну операцию.
+ *
+ * Параметры:
+ *   filename - имя файла
+ *   data - указатель для возврата содержимого (освобождает вызывающая
+ *          функция)
+ *   length - указатель для возврата размера файла
+ *
+ * Возвращает: 0 при успехе, -1 если файла нет или его не удалось прочитать
+ ******************************************************************************/
+int read_file_bytes(const char* filename, unsigned char** data, size_t* length)
+{
+    FILE* file_handle = NULL;
+    long file_length = -1;
+    int previous_subsystem = memory_enter(MEMORY_IO);
+
+    *data = NULL;
+    *length = 0;
+    file_handle = fopen(filename, "rb");
+    if (file_handle == NULL)
+    {
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    if (fseek(file_handle, 0, SEEK_END) == 0)
+    {
+        file_length = ftell(file_handle);
+    }
+    if (file_length < 0 || fseek(file_handle, 0, SEEK_SET) != 0)
+    {
+        fclose(file_handle);
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    *data = (unsigned char*)memory_allocate((size_t)file_length);
+    if (*data == NULL || fread(*data, 1, (size_t)file_length, file_handle) != (size_t)file_length)
+    {
+        fclose(file_handle);
+        memory_release(*data);
+        *data = NULL;
+        return memory_leave(previous_subsystem, -1);
+    }
+
+    fclose(file_handle);
+    *length = (size_t)file_length;
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: byte_buffer_append_postings
+ *
+ * Описание: Дописывает список записей: количество, затем первый номер и
+ *           разности соседних номеров. Индексы массива переводятся в номера
+ *           строк файла архива; записи, которых нет в файле, пропускаются.
+ *
+ * Параметры:
+ *   buffer - массив байт
+ *   list - список индексов записей по возрастанию
+ *   positions - номер строки файла для каждого индекса или -1
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int byte_buffer_append_postings(ByteBuffer* buffer, const PostingList* list, const int positions[])
+{
+    int stored_count = 0;
+    int previous = 0;
+    int i = 0;
+
+    for (i = 0; i < list->count; i++)
+    {
+        if (positions[list->record_indices[i]] >= 0)
+        {
+            stored_count++;
+        }
+    }
+
+    byte_buffer_append_varint(buffer, (unsigned int)stored_count);
+    for (i = 0; i < list->count; i++)
+    {
+        int position = positions[list->record_indices[i]];
+        if (position >= 0)
+        {
+            byte_buffer_append_varint(buffer, (unsigned int)(position - previous));
+            previous = position;
+        }
+    }
+
+    return buffer->error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: byte_reader_read_postings
+ *
+ * Описание: Читает список записей, записанный byte_buffer_append_postings,
+ *           и проверяет, что номера возрастают и не выходят за число
+ *           записей файла.
+ *
+ * Параметры:
+ *   reader - чтение данных
+ *   list - пустой список для заполнения
+ *   record_limit - количество записей, покрытых файлом индексов
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных или нехватке памяти
+ ******************************************************************************/
+int byte_reader_read_postings(ByteReader* reader, PostingList* list, int record_limit)
+{
+    unsigned int stored_count = byte_reader_read_varint(reader);
+    unsigned int i = 0;
+    long record_index = -1;
+
+    if (reader->error || stored_count > (unsigned int)record_limit)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < stored_count; i++)
+    {
+        unsigned int delta = byte_reader_read_varint(reader);
+
+        if (reader->error || (i > 0 && delta == 0))
+        {
+            return -1;
+        }
+
+        record_index = (i == 0) ? (long)delta : record_index + (long)delta;
+        if (record_index >= record_limit || posting_list_insert(list, (int)record_index) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: encode_fuzzy_index
+ *
+ * Описание: Дописывает индекс нечеткого поиска: значения в порядке номеров
+ *           вместе с узлами BK-дерева и списками записей, чтобы при загрузке
+ *           не вычислять расстояния заново.
+ *
+ * Параметры:
+ *   index - индекс нечеткого поиска
+ *   positions - номер строки файла для каждого индекса записи или -1
+ *   payload - массив байт
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int encode_fuzzy_index(const FuzzyIndex* index, const int positions[], ByteBuffer* payload)
+{
+    int value_id = 0;
+
+    byte_buffer_append_varint(payload, (unsigned int)index->values.value_count);
+    for (value_id = 0; value_id < index->values.value_count; value_id++)
+    {
+        const BkTreeNode* node = &index->nodes[value_id];
+
+        byte_buffer_append_string(payload, index->values.values[value_id]);
+        byte_buffer_append_varint(payload, (unsigned int)node->edge_distance);
+        byte_buffer_append_varint(payload, (unsigned int)(node->first_child + 1));
+        byte_buffer_append_varint(payload, (unsigned int)(node->next_sibling + 1));
+        byte_buffer_append_postings(payload, &index->postings[value_id], positions);
+    }
+
+    return payload->error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: decode_fuzzy_index
+ *
+ * Описание: Восстанавливает индекс нечеткого поиска. Каждый узел дерева,
+ *           кроме корня, должен быть потомком не более одного узла, иначе
+ *           поиск по дереву мог бы не завершиться.
+ *
+ * Параметры:
+ *   reader - чтение данных
+ *   index - пустой индекс нечеткого поиска
+ *   record_limit - количество записей, покрытых файлом индексов
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных или нехватке памяти
+ ******************************************************************************/
+int decode_fuzzy_index(ByteReader* reader, FuzzyIndex* index, int record_limit)
+{
+    char value[MAX_TAGS_LEN];
+    int* reference_counts = NULL;
+    int value_count = (int)byte_reader_read_varint(reader);
+    int result = 0;
+    int value_id = 0;
+
+    if (reader->error || value_count < 0 || (size_t)value_count > reader->length)
+    {
+        return -1;
+    }
+
+    for (value_id = 0; value_id < value_count && result == 0; value_id++)
+    {
+        BkTreeNode* node = NULL;
+
+        if (byte_reader_read_string(reader, value, sizeof(value)) != 0 ||
+            string_dictionary_intern(&index->values, value) != value_id ||
+            fuzzy_index_reserve(index, value_id) != 0)
+        {
+            result = -1;
+            break;
+        }
+
+        node = &index->nodes[value_id];
+        node->edge_distance = (int)byte_reader_read_varint(reader);
+        node->first_child = (int)byte_reader_read_varint(reader) - 1;
+        node->next_sibling = (int)byte_reader_read_varint(reader) - 1;
+        result = byte_reader_read_postings(reader, &index->postings[value_id], record_limit);
+    }
+
+    if (result == 0 && value_count > 0)
+    {
+        reference_counts = (int*)memory_allocate_zeroed((size_t)value_count, sizeof(int));
+        result = (reference_counts == NULL) ? -1 : 0;
+    }
+
+    for (value_id = 0; value_id < value_count && result == 0; value_id++)
+    {
+        int links[2];
+        int k = 0;
+
+        links[0] = index->nodes[value_id].first_child;
+        links[1] = index->nodes[value_id].next_sibling;
+        for (k = 0; k < 2; k++)
+        {
+            if (links[k] != -1 &&
+                (links[k] <= 0 || links[k] >= value_count || ++reference_counts[links[k]] > 1))
+            {
+                result = -1;
+            }
+        }
+    }
+
+    memory_release(reference_counts);
+    return result;
+}
+
+/******************************************************************************
+ * Функция: encode_search_indexes
+ *
+ * Описание: Кодирует индекс триграмм места, разделы по месяцам с индексами
+ *           тегов и индексы нечеткого поиска по названию и месту.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   positions - номер строки файла для каждого индекса записи или -1
+ *   payload - массив байт
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int encode_search_indexes(const ArchiveIndexes* indexes, const int positions[], ByteBuffer* payload)
+{
+    const TrigramIndex* trigrams = &indexes->place_trigrams;
+    const PartitionTable* table = &indexes->partitions;
+    int i = 0;
+    int tag_id = 0;
+
+    byte_buffer_append_varint(payload, (unsigned int)trigrams->used_count);
+    for (i = 0; i < trigrams->slot_count; i++)
+    {
+        if (trigrams->trigram_keys[i] >= 0)
+        {
+            byte_buffer_append_varint(payload, (unsigned int)trigrams->trigram_keys[i]);
+            byte_buffer_append_postings(payload, &trigrams->postings[i], positions);
+        }
+    }
+
+    byte_buffer_append_varint(payload, (unsigned int)table->count);
+    for (i = 0; i < table->count; i++)
+    {
+        const MonthPartition* partition = &table->partitions[i];
+
+        byte_buffer_append_varint(payload, (unsigned int)partition->month_key);
+        byte_buffer_append_postings(payload, &partition->records, positions);
+        byte_buffer_append_varint(payload, (unsigned int)partition->tags.tags.value_count);
+        for (tag_id = 0; tag_id < partition->tags.tags.value_count; tag_id++)
+        {
+            byte_buffer_append_string(payload, partition->tags.tags.values[tag_id]);
+            byte_buffer_append_postings(payload, &partition->tags.postings[tag_id], positions);
+        }
+    }
+
+    if (encode_fuzzy_index(&indexes->name_fuzzy, positions, payload) != 0 ||
+        encode_fuzzy_index(&indexes->place_fuzzy, positions, payload) != 0)
+    {
+        return -1;
+    }
+
+    return payload->error ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: decode_search_indexes
+ *
+ * Описание: Восстанавливает индексы, закодированные encode_search_indexes,
+ *           в пустые структуры.
+ *
+ * Параметры:
+ *   reader - чтение данных
+ *   indexes - вспомогательные структуры архива
+ *   record_limit - количество записей, покрытых файлом индексов
+ *
+ * Возвращает: 0 при успехе, -1 при повреждении данных или нехватке памяти
+ ******************************************************************************/
+int decode_search_indexes(ByteReader* reader, ArchiveIndexes* indexes, int record_limit)
+{
+    char tag[MAX_TAGS_LEN];
+    unsigned int entry_count = 0;
+    unsigned int tag_count = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    int result = 0;
+    int previous_subsystem = memory_enter(MEMORY_TRIGRAMS);
+
+    entry_count = byte_reader_read_varint(reader);
+    for (i = 0; i < entry_count && result == 0; i++)
+    {
+        unsigned int trigram = byte_reader_read_varint(reader);
+        PostingList* list = NULL;
+
+        if (reader->error || trigram >= (1u << 24) ||
+            (list = trigram_index_get(&indexes->place_trigrams, (int)trigram)) == NULL)
+        {
+            result = -1;
+            break;
+        }
+        result = byte_reader_read_postings(reader, list, record_limit);
+    }
+
+    memory_enter(MEMORY_PARTITIONS);
+    entry_count = result == 0 ? byte_reader_read_varint(reader) : 0;
+    for (i = 0; i < entry_count && result == 0; i++)
+    {
+        unsigned int month_key = byte_reader_read_varint(reader);
+        MonthPartition* partition = NULL;
+
+        if (reader->error || month_key > ALL_YEARS_LAST * 100 + 12 ||
+            (partition = partition_table_get(&indexes->partitions, (int)month_key)) == NULL ||
+            byte_reader_read_postings(reader, &partition->records, record_limit) != 0)
+        {
+            result = -1;
+            break;
+        }
+
+        tag_count = byte_reader_read_varint(reader);
+        for (j = 0; j < tag_count && result == 0; j++)
+        {
+            PostingList* list = NULL;
+
+            if (byte_reader_read_string(reader, tag, sizeof(tag)) != 0 ||
+                (list = tag_index_get(&partition->tags, tag)) == NULL)
+            {
+                result = -1;
+                break;
+            }
+            result = byte_reader_read_postings(reader, list, record_limit);
+        }
+    }
+
+    memory_enter(MEMORY_FUZZY);
+    if (result == 0 &&
+        (decode_fuzzy_index(reader, &indexes->name_fuzzy, record_limit) != 0 ||
+        decode_fuzzy_index(reader, &indexes->place_fuzzy, record_limit) != 0))
+    {
+        result = -1;
+    }
+
+    if (reader->error || reader->position != reader->length)
+    {
+        result = -1;
+    }
+
+    return memory_leave(previous_subsystem, result);
+}
+
+/******************************************************************************
+ * Функция: search_indexes_save
+ *
+ * Описание: Сохраняет индексы поиска рядом с только что записанным файлом
+ *           архива. В заголовок входят отметка архива (число записей,
+ *           размер и контрольная сумма файла) и контрольная сумма данных.
+ *           Недостроенные индексы не сохраняются: прежний файл индексов
+ *           при этом остается верным только для прежнего файла архива.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 если файл записан, 1 если индексы не готовы, -1 при ошибке
+ ******************************************************************************/
+int search_indexes_save(const ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    ByteBuffer payload = { NULL, 0, 0, 0 };
+    ByteBuffer header = { NULL, 0, 0, 0 };
+    FILE* file_handle = NULL;
+    unsigned char* archive_data = NULL;
+    size_t archive_length = 0;
+    int* positions = NULL;
+    int stored_count = 0;
+    unsigned char version = INDEX_FORMAT_VERSION;
+    int result = 0;
+    int i = 0;
+
+    if (!search_index_ready(indexes, SEARCH_INDEX_PERSISTED))
+    {
+        return 1;
+    }
+
+    /* Номера строк активного файла: удаленные и запечатанные записи в него не попали */
+    positions = (int*)memory_allocate((size_t)(record_count > 0 ? record_count : 1) * sizeof(int));
+    if (positions == NULL || read_file_bytes(FILENAME, &archive_data, &archive_length) != 0)
+    {
+        memory_release(positions);
+        return -1;
+    }
+    for (i = 0; i < record_count; i++)
+    {
+        positions[i] = (database[i].is_deleted || database[i].segment_year != 0) ? -1 : stored_count++;
+    }
+
+    result = encode_search_indexes(indexes, positions, &payload);
+    byte_buffer_append(&header, INDEX_MAGIC, 4);
+    byte_buffer_append(&header, &version, 1);
+    byte_buffer_append_uint32(&header, (unsigned int)stored_count);
+    byte_buffer_append_uint32(&header, (unsigned int)archive_length);
+    byte_buffer_append_uint32(&header, block_checksum(archive_data, archive_length));
+    byte_buffer_append_uint32(&header, (unsigned int)payload.length);
+    byte_buffer_append_uint32(&header, block_checksum(payload.data, payload.length));
+    if (header.error)
+    {
+        result = -1;
+    }
+
+    if (result == 0)
+    {
+        file_handle = fopen(INDEX_FILENAME, "wb");
+        if (file_handle == NULL ||
+            fwrite(header.data, 1, header.length, file_handle) != header.length ||
+            fwrite(payload.data, 1, payload.length, file_handle) != payload.length)
+        {
+            result = -1;
+        }
+        if (file_handle != NULL)
+        {
+            fclose(file_handle);
+        }
+    }
+
+    memory_release(header.data);
+    memory_release(payload.data);
+    memory_release(archive_data);
+    memory_release(positions);
+    return result;
+}
+
+/******************************************************************************
+ * Функция: search_indexes_load
+ *
+ * Описание: Загружает индексы поиска из файла индексов, если он цел и
+ *           соответствует файлу архива: файл архива совпадает с отмеченным
+ *           при сохранении или начинается с него (после сохранения записи
+ *           только дописывались). Записи загружены из файла архива по
+ *           порядку, поэтому номера строк совпадают с индексами массива.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива (индексы поиска пусты)
+ *   record_count - количество загруженных записей
+ *
+ * Возвращает: количество записей, покрытых файлом индексов, -1 если файла
+ *             нет, он поврежден или не соответствует архиву
+ ******************************************************************************/
+int search_indexes_load(ArchiveIndexes* indexes, int record_count)
+{
+    ByteReader reader = { NULL, 0, 0, 0 };
+    unsigned char* index_data = NULL;
+    unsigned char* archive_data = NULL;
+    size_t index_length = 0;
+    size_t archive_length = 0;
+    unsigned int stored_count = 0;
+    unsigned int stored_length = 0;
+    unsigned int archive_checksum = 0;
+    unsigned int payload_length = 0;
+    unsigned int payload_checksum = 0;
+    int result = -1;
+
+    if (read_file_bytes(INDEX_FILENAME, &index_data, &index_length) != 0)
+    {
+        return -1;
+    }
+
+    reader.data = index_data;
+    reader.length = index_length;
+    reader.position = 5;
+    stored_count = byte_reader_read_uint32(&reader);
+    stored_length = byte_reader_read_uint32(&reader);
+    archive_checksum = byte_reader_read_uint32(&reader);
+    payload_length = byte_reader_read_uint32(&reader);
+    payload_checksum = byte_reader_read_uint32(&reader);
+
+    if (!reader.error && memcmp(index_data, INDEX_MAGIC, 4) == 0 &&
+        index_data[4] == INDEX_FORMAT_VERSION &&
+        payload_length == index_length - INDEX_HEADER_SIZE &&
+        block_checksum(index_data + INDEX_HEADER_SIZE, payload_length) == payload_checksum &&
+        stored_count <= (unsigned int)record_count &&
+        read_file_bytes(FILENAME, &archive_data, &archive_length) == 0 &&
+        stored_length <= archive_length &&
+        (stored_length < archive_length || stored_count == (unsigned int)record_count) &&
+        block_checksum(archive_data, stored_length) == archive_checksum)
+    {
+        reader.data = index_data + INDEX_HEADER_SIZE;
+        reader.length = payload_length;
+        reader.position = 0;
+        result = decode_search_indexes(&reader, indexes, (int)stored_count) == 0 ?
+            (int)stored_count : -1;
+    }
+
+    if (result < 0)
+    {
+        trigram_index_release(&indexes->place_trigrams);
+        partition_table_release(&indexes->partitions);
+        fuzzy_index_release(&indexes->name_fuzzy);
+        fuzzy_index_release(&indexes->place_fuzzy);
+    }
+
+    memory_release(archive_data);
+    memory_release(index_data);
+    return result;
+}
+
+/******************************************************************************
+ * Функция: archive_indexes_open
+ *
+ * Описание: Строит вспомогательные структуры по загруженному архиву.
+ *           Индексы поиска берутся из файла индексов, а дописанные после
+ *           сохранения записи вносятся в них сразу. Если файл индексов
+ *           непригоден, индексы перестраиваются в паузах между операциями,
+ *           а запросы до этого выполняются без них.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *   appended_count - указатель для возврата числа дописанных записей
+ *
+ * Возвращает: 0 если использован файл индексов, 1 если индексы
+ *             перестраиваются, -1 при нехватке памяти
+ ******************************************************************************/
+int archive_indexes_open(ArchiveIndexes* indexes, const Photo database[], int record_count,
+    int* appended_count)
+{
+    int indexed_count = 0;
+
+    *appended_count = 0;
+    indexes->pending_indexes = SEARCH_INDEX_PERSISTED;
+    if (archive_indexes_build(indexes, database, record_count) != 0)
+    {
+        return -1;
+    }
+
+    indexed_count = search_indexes_load(indexes, record_count);
+    if (indexed_count < 0)
+    {
+        return 1;
+    }
+
+    indexes->rebuild_position = indexed_count;
+    *appended_count = record_count - indexed_count;
+    return search_indexes_rebuild_step(indexes, database, record_count, 0) < 0 ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: merge_record_prepare
+ *
+ * Описание: Строит ключ всех полей записи в порядке схемы и его хеш.
+ *           По ним одинаковые записи разных файлов распознаются как одна.
+ *
+ * Параметры:
+ *   record - запись с заполненными полями
+ ******************************************************************************/
+void merge_record_prepare(MergeRecord* record)
+{
+    SortKeyField order[PHOTO_FIELD_COUNT];
+    int length = 0;
+    int i = 0;
+
+    for (i = 0; i < PHOTO_FIELD_COUNT; i++)
+    {
+        order[i].field = i;
+        order[i].descending = 0;
+    }
+
+    length = build_photo_sort_key(&record->photo, order, PHOTO_FIELD_COUNT, record->key);
+    record->identity = block_checksum(record->key, (size_t)length);
+}
+
+/******************************************************************************
+ * Функция: compare_merge_records
+ *
+ * Описание: Функция сравнения для qsort и слияния: порядок
+ *           compare_photos_for_sorting, при равенстве - по хешу записи,
+ *           при совпадении хешей - по ключу всех полей. Ноль означает
+ *           одинаковые записи.
+ *
+ * Параметры:
+ *   first_record - указатель на первую запись
+ *   second_record - указатель на вторую запись
+ *
+ * Возвращает: результат сравнения для qsort
+ ******************************************************************************/
+int compare_merge_records(const void* first_record, const void* second_record)
+{
+    const MergeRecord* record_a = (const MergeRecord*)first_record;
+    const MergeRecord* record_b = (const MergeRecord*)second_record;
+    int comparison = compare_photos_for_sorting(&record_a->photo, &record_b->photo);
+
+    if (comparison != 0)
+    {
+        return comparison;
+    }
+
+    if (record_a->identity != record_b->identity)
+    {
+        return record_a->identity < record_b->identity ? -1 : 1;
+    }
+
+    return memcmp(record_a->key, record_b->key, PHOTO_SORT_KEY_LEN);
+}
+
+/******************************************************************************
+ * Функция: read_merge_record
+ *
+ * Описание: Читает из потока следующую запись архива. Пустые строки
+ *           пропускаются, нераспознанные - пропускаются и подсчитываются.
+ *
+ * Параметры:
+ *   stream - файл архива или серии
+ *   record - запись для заполнения
+ *   skipped_lines - счетчик нераспознанных строк
+ *
+ * Возвращает: 1 если запись прочитана, 0 в конце файла
+ ******************************************************************************/
+int read_merge_record(FILE* stream, MergeRecord* record, int* skipped_lines)
+{
+    char line[PHOTO_RECORD_LINE_LEN];
+
+    while (fgets(line, sizeof(line), stream) != NULL)
+    {
+        /* Пропускаем оставшуюся часть слишком длинной строки */
+        if (strchr(line, '\n') == NULL)
+        {
+            int ch;
+            while ((ch = fgetc(stream)) != '\n' && ch != EOF)
+                ;
+        }
+
+        if (line[strspn(line, "\r\n")] == '\0')
+        {
+            continue;
+        }
+
+        memset(record, 0, sizeof(*record));
+        if (parse_photo_record(line, &record->photo) != 0)
+        {
+            (*skipped_lines)++;
+            continue;
+        }
+
+        merge_record_prepare(record);
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: run_merger_open
+ *
+ * Описание: Начинает слияние отсортированных серий: перематывает файлы
+ *           и читает первую запись каждой серии. Счетчики повторов и
+ *           пропущенных строк не сбрасываются.
+ *
+ * Параметры:
+ *   merger - состояние слияния
+ *   runs - файлы серий (не больше MERGE_FAN_IN), переходят к merger
+ *   run_count - количество серий
+ ******************************************************************************/
+void run_merger_open(RunMerger* merger, FILE* runs[], int run_count)
+{
+    int i = 0;
+
+    merger->run_count = run_count;
+    merger->has_last = 0;
+    for (i = 0; i < run_count; i++)
+    {
+        merger->runs[i] = runs[i];
+        rewind(runs[i]);
+        merger->has_head[i] = read_merge_record(runs[i], &merger->heads[i],
+            &merger->skipped_lines);
+    }
+}
+
+/******************************************************************************
+ * Функция: run_merger_next
+ *
+ * Описание: Выдает наименьшую из текущих записей серий. Запись, равная
+ *           предыдущей выданной, отбрасывается как повтор.
+ *
+ * Параметры:
+ *   merger - состояние слияния
+ *   record - запись для результата
+ *
+ * Возвращает: 1 если запись выдана, 0 если серии закончились
+ ******************************************************************************/
+int run_merger_next(RunMerger* merger, MergeRecord* record)
+{
+    while (1)
+    {
+        int smallest = -1;
+        int i = 0;
+
+        for (i = 0; i < merger->run_count; i++)
+        {
+            if (merger->has_head[i] && (smallest < 0 ||
+                compare_merge_records(&merger->heads[i], &merger->heads[smallest]) < 0))
+            {
+                smallest = i;
+            }
+        }
+
+        if (smallest < 0)
+        {
+            return 0;
+        }
+
+        *record = merger->heads[smallest];
+        merger->has_head[smallest] = read_merge_record(merger->runs[smallest],
+            &merger->heads[smallest], &merger->skipped_lines);
+
+        if (merger->has_last && compare_merge_records(record, &merger->last) == 0)
+        {
+            merger->duplicates++;
+            continue;
+        }
+
+        merger->last = *record;
+        merger->has_last = 1;
+        return 1;
+    }
+}
+
+/******************************************************************************
+ * Функция: run_merger_close
+ *
+ * Описание: Закрывает (и тем удаляет) временные файлы серий.
+ *
+ * Параметры:
+ *   merger - состояние слияния
+ ******************************************************************************/
+void run_merger_close(RunMerger* merger)
+{
+    int i = 0;
+
+    for (i = 0; i < merger->run_count; i++)
+    {
+        fclose(merger->runs[i]);
+    }
+    merger->run_count = 0;
+}
+
+/******************************************************************************
+ * Функция: write_sorted_runs
+ *
+ * Описание: Читает файл архива порциями по MERGE_RUN_RECORDS записей,
+ *           сортирует каждую порцию в памяти и записывает ее во временный
+ *           файл - отсортированную серию. Память ограничена одной порцией
+ *           при любом размере файла.
+ *
+ * Параметры:
+ *   input - файл архива
+ *   runs - указатель на массив файлов серий (освобождает вызывающая
+ *          функция, файлы закрываются и при ошибке)
+ *   run_count - указатель для возврата количества серий
+ *   skipped_lines - счетчик нераспознанных строк
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти или ошибке записи
+ ******************************************************************************/
+int write_sorted_runs(FILE* input, FILE*** runs, int* run_count, int* skipped_lines)
+{
+    MergeRecord* records = NULL;
+    int capacity = 0;
+    int record_count = MERGE_RUN_RECORDS;
+    int result = 0;
+    int i = 0;
+
+    *runs = NULL;
+    *run_count = 0;
+    records = (MergeRecord*)memory_allocate(MERGE_RUN_RECORDS * sizeof(MergeRecord));
+    if (records == NULL)
+    {
+        return -1;
+    }
+
+    while (result == 0 && record_count == MERGE_RUN_RECORDS)
+    {
+        FILE* run = NULL;
+
+        record_count = 0;
+        while (record_count < MERGE_RUN_RECORDS &&
+            read_merge_record(input, &records[record_count], skipped_lines))
+        {
+            record_count++;
+        }
+
+        if (record_count == 0)
+        {
+            break;
+        }
+
+        if (*run_count == capacity)
+        {
+            int new_capacity = capacity == 0 ? MERGE_FAN_IN : capacity * 2;
+            FILE** grown = (FILE**)memory_reallocate(*runs, (size_t)new_capacity * sizeof(FILE*));
+            if (grown == NULL)
+            {
+                result = -1;
+                break;
+            }
+            *runs = grown;
+            capacity = new_capacity;
+        }
+
+        run = tmpfile();
+        if (run == NULL)
+        {
+            result = -1;
+            break;
+        }
+        (*runs)[(*run_count)++] = run;
+
+        qsort(records, (size_t)record_count, sizeof(MergeRecord), compare_merge_records);
+        for (i = 0; i < record_count && result == 0; i++)
+        {
+            result = write_photo_record(run, &records[i].photo);
+        }
+    }
+
+    memory_release(records);
+    if (result != 0)
+    {
+        for (i = 0; i < *run_count; i++)
+        {
+            fclose((*runs)[i]);
+        }
+        *run_count = 0;
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Функция: merge_run_groups
+ *
+ * Описание: Один проход внешнего слияния: серии сливаются группами по
+ *           MERGE_FAN_IN в новые серии, число серий уменьшается в
+ *           MERGE_FAN_IN раз. Исходные файлы серий закрываются.
+ *
+ * Параметры:
+ *   merger - состояние слияния (накапливает счетчик повторов)
+ *   runs - файлы серий, заменяются слитыми
+ *   run_count - указатель на количество серий
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке записи (все серии закрыты)
+ ******************************************************************************/
+int merge_run_groups(RunMerger* merger, FILE* runs[], int* run_count)
+{
+    MergeRecord record;
+    int merged_count = 0;
+    int first = 0;
+    int result = 0;
+
+    for (first = 0; first < *run_count; first += MERGE_FAN_IN)
+    {
+        int group_size = *run_count - first < MERGE_FAN_IN ? *run_count - first : MERGE_FAN_IN;
+        FILE* merged = result == 0 ? tmpfile() : NULL;
+
+        run_merger_open(merger, runs + first, group_size);
+        if (merged == NULL)
+        {
+            result = -1;
+        }
+        while (result == 0 && run_merger_next(merger, &record))
+        {
+            result = write_photo_record(merged, &record.photo);
+        }
+        run_merger_close(merger);
+
+        if (merged != NULL)
+        {
+            runs[merged_count++] = merged;
+        }
+    }
+
+    if (result != 0)
+    {
+        for (first = 0; first < merged_count; first++)
+        {
+            fclose(runs[first]);
+        }
+        merged_count = 0;
+    }
+
+    *run_count = merged_count;
+    return result;
+}
+
+/******************************************************************************
+ * Функция: sort_archive_file
+ *
+ * Описание: Готовит файл архива к слиянию: разбивает его на
+ *           отсортированные серии и сливает их проходами, пока серий не
+ *           останется MERGE_FAN_IN или меньше. Оставшиеся серии читаются
+ *           потоком через merger.
+ *
+ * Параметры:
+ *   filename - имя файла архива
+ *   merger - состояние слияния для чтения отсортированного файла
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке (сообщение выведено)
+ ******************************************************************************/
+int sort_archive_file(const char* filename, RunMerger* merger)
+{
+    FILE* input = NULL;
+    FILE** runs = NULL;
+    int run_count = 0;
+    int result = 0;
+    int previous_subsystem = 0;
+
+    memset(merger, 0, sizeof(*merger));
+    input = fopen(filename, "r");
+    if (input == NULL)
+    {
+        fprintf(stderr, "Ошибка: Не удалось открыть файл '%s'.\n", filename);
+        return -1;
+    }
+
+    previous_subsystem = memory_enter(MEMORY_IO);
+    result = write_sorted_runs(input, &runs, &run_count, &merger->skipped_lines);
+    fclose(input);
+
+    while (result == 0 && run_count > MERGE_FAN_IN)
+    {
+        result = merge_run_groups(merger, runs, &run_count);
+    }
+
+    if (result == 0)
+    {
+        run_merger_open(merger, runs, run_count);
+    }
+    else
+    {
+        fprintf(stderr, "Ошибка: Не удалось отсортировать файл '%s' (временные файлы или память).\n",
+            filename);
+    }
+
+    memory_release(runs);
+    return memory_leave(previous_subsystem, result);
+}
+
+/******************************************************************************
+ * Функция: run_batch_merge
+ *
+ * Описание: Пакетный режим сравнения двух файлов архива. Каждый файл
+ *           упорядочивается внешней сортировкой (память ограничена
+ *           MERGE_RUN_RECORDS записями), затем оба потока сливаются за
+ *           один проход. Одинаковые записи, в том числе повторы внутри
+ *           файла, выводятся один раз. Результат в формате файла архива
+ *           выводится в стандартный поток вывода, сводка - в поток ошибок.
+ *           В режиме разницы, как в diff, строка записи только первого
+ *           файла начинается с "< ", только второго - с "> ".
+ *
+ * Параметры:
+ *   mode_name - "union" (объединение), "intersect" (пересечение) или
+ *               "delta" (записи только одного из файлов с пометкой файла)
+ *   first_filename - первый файл архива
+ *   second_filename - второй файл архива
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int run_batch_merge(const char* mode_name, const char* first_filename,
+    const char* second_filename)
+{
+    static RunMerger first_merger;
+    static RunMerger second_merger;
+    MergeRecord first_record;
+    MergeRecord second_record;
+    int has_first = 0;
+    int has_second = 0;
+    int merge_mode = 0;
+    int only_first = 0;
+    int only_second = 0;
+    int common = 0;
+    int result = 0;
+
+    if (strcmp(mode_name, "union") == 0)
+    {
+        merge_mode = MERGE_MODE_UNION;
+    }
+    else if (strcmp(mode_name, "intersect") == 0)
+    {
+        merge_mode = MERGE_MODE_INTERSECTION;
+    }
+    else if (strcmp(mode_name, "delta") == 0)
+    {
+        merge_mode = MERGE_MODE_DELTA;
+    }
+    else
+    {
+        fprintf(stderr, "Неизвестный режим слияния '%s' (union, intersect, delta).\n", mode_name);
+        fprintf(stderr, "В режиме delta записи только первого файла помечаются '< ', "
+            "только второго - '> '.\n");
+        return -1;
+    }
+
+    /* Локаль нужна для чтения размеров с десятичной запятой */
+    setlocale(LC_ALL, "Russian");
+
+    if (sort_archive_file(first_filename, &first_merger) != 0)
+    {
+        return -1;
+    }
+    if (sort_archive_file(second_filename, &second_merger) != 0)
+    {
+        run_merger_close(&first_merger);
+        return -1;
+    }
+
+    has_first = run_merger_next(&first_merger, &first_record);
+    has_second = run_merger_next(&second_merger, &second_record);
+    while (result == 0 && (has_first || has_second))
+    {
+        int comparison = !has_first ? 1 : !has_second ? -1 :
+            compare_merge_records(&first_record, &second_record);
+
+        if (comparison == 0)
+        {
+            common++;
+            if (merge_mode != MERGE_MODE_DELTA)
+            {
+                result = write_photo_record(stdout, &first_record.photo);
+            }
+            has_first = run_merger_next(&first_merger, &first_record);
+            has_second = run_merger_next(&second_merger, &second_record);
+        }
+        else if (comparison < 0)
+        {
+            only_first++;
+            if (merge_mode == MERGE_MODE_DELTA && fputs("< ", stdout) == EOF)
+            {
+                result = -1;
+            }
+            if (result == 0 && merge_mode != MERGE_MODE_INTERSECTION)
+            {
+                result = write_photo_record(stdout, &first_record.photo);
+            }
+            has_first = run_merger_next(&first_merger, &first_record);
+        }
+        else
+        {
+            only_second++;
+            if (merge_mode == MERGE_MODE_DELTA && fputs("> ", stdout) == EOF)
+            {
+                result = -1;
+            }
+            if (result == 0 && merge_mode != MERGE_MODE_INTERSECTION)
+            {
+                result = write_photo_record(stdout, &second_record.photo);
+            }
+            has_second = run_merger_next(&second_merger, &second_record);
+        }
+    }
+
+    run_merger_close(&first_merger);
+    run_merger_close(&second_merger);
+    if (fflush(stdout) != 0)
+    {
+        result = -1;
+    }
+
+    fprintf(stderr, "Только в '%s': %d, только в '%s': %d, в обоих файлах: %d.\n",
+        first_filename, only_first, second_filename, only_second, common);
+    if (first_merger.duplicates + second_merger.duplicates > 0)
+    {
+        fprintf(stderr, "Повторов внутри файлов отброшено: %d.\n",
+            first_merger.duplicates + second_merger.duplicates);
+    }
+    if (first_merger.skipped_lines + second_merger.skipped_lines > 0)
+    {
+        fprintf(stderr, "Пропущено нераспознанных строк: %d.\n",
+            first_merger.skipped_lines + second_merger.skipped_lines);
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_initialize
+ *
+ * Описание: Инициализирует пустое дерево автодополнения. Корень создается
+ *           при добавлении первого значения.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int completion_trie_initialize(CompletionTrie* trie)
+{
+    if (trie == NULL)
+    {
+        return -1;
+    }
+
+    string_dictionary_initialize(&trie->keys);
+    string_dictionary_initialize(&trie->spellings);
+    trie->spelling_ids = NULL;
+    trie->weights = NULL;
+    trie->value_capacity = 0;
+    trie->nodes = NULL;
+    trie->node_count = 0;
+    trie->node_capacity = 0;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_release
+ *
+ * Описание: Освобождает память дерева автодополнения.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int completion_trie_release(CompletionTrie* trie)
+{
+    if (trie == NULL)
+    {
+        return -1;
+    }
+
+    string_dictionary_release(&trie->keys);
+    string_dictionary_release(&trie->spellings);
+    memory_release(trie->spelling_ids);
+    memory_release(trie->weights);
+    memory_release(trie->nodes);
+    return completion_trie_initialize(trie);
+}
+
+/******************************************************************************
+ * Функция: completion_trie_add_node
+ *
+ * Описание: Добавляет узел без потомков. Массив узлов может быть
+ *           перемещен, поэтому указатели на узлы после вызова недействительны.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   label_value - значение, в ключе которого лежит метка
+ *   label_offset - начало метки в ключе
+ *   label_length - длина метки
+ *   value_id - значение, которое кончается в узле, -1 - нет
+ *
+ * Возвращает: номер узла, -1 при нехватке памяти
+ ******************************************************************************/
+int completion_trie_add_node(CompletionTrie* trie, int label_value, int label_offset,
+    int label_length, int value_id)
+{
+    CompletionNode* node = NULL;
+
+    if (trie->node_count == trie->node_capacity)
+    {
+        int new_capacity = trie->node_capacity > 0 ? trie->node_capacity * 2 : 32;
+        if (grow_array((void**)&trie->nodes, sizeof(CompletionNode), new_capacity) != 0)
+        {
+            return -1;
+        }
+        trie->node_capacity = new_capacity;
+    }
+
+    node = &trie->nodes[trie->node_count];
+    node->label_value = label_value;
+    node->label_offset = label_offset;
+    node->label_length = label_length;
+    node->value_id = value_id;
+    node->best_weight = 0;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    return trie->node_count++;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_find_child
+ *
+ * Описание: Находит потомка узла, метка которого начинается с заданного
+ *           байта. У потомков одного узла первые байты меток различны.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   node - номер узла
+ *   first_byte - первый байт метки
+ *
+ * Возвращает: номер потомка, -1 если его нет
+ ******************************************************************************/
+int completion_trie_find_child(const CompletionTrie* trie, int node, unsigned char first_byte)
+{
+    int child = 0;
+
+    for (child = trie->nodes[node].first_child; child >= 0; child = trie->nodes[child].next_sibling)
+    {
+        const CompletionNode* candidate = &trie->nodes[child];
+        if ((unsigned char)trie->keys.values[candidate->label_value][candidate->label_offset] ==
+            first_byte)
+        {
+            return child;
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_insert_key
+ *
+ * Описание: Прокладывает в дереве путь для ключа нового значения. Ребро,
+ *           метка которого совпадает с ключом лишь частично, делится
+ *           промежуточным узлом; оставшаяся часть ключа становится
+ *           меткой нового листа.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   value_id - номер значения в словаре ключей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int completion_trie_insert_key(CompletionTrie* trie, int value_id)
+{
+    const char* key = trie->keys.values[value_id];
+    int key_length = (int)strlen(key);
+    int position = 0;
+    int node = 0;
+
+    if (trie->node_count == 0 && completion_trie_add_node(trie, 0, 0, 0, -1) < 0)
+    {
+        return -1;
+    }
+
+    while (position < key_length)
+    {
+        int child = completion_trie_find_child(trie, node, (unsigned char)key[position]);
+        const char* label = NULL;
+        int common = 0;
+        int middle = 0;
+        int previous = 0;
+
+        if (child < 0)
+        {
+            child = completion_trie_add_node(trie, value_id, position, key_length - position, value_id);
+            if (child < 0)
+            {
+                return -1;
+            }
+            trie->nodes[child].next_sibling = trie->nodes[node].first_child;
+            trie->nodes[node].first_child = child;
+            return 0;
+        }
+
+        label = trie->keys.values[trie->nodes[child].label_value] + trie->nodes[child].label_offset;
+        while (common < trie->nodes[child].label_length && position + common < key_length &&
+            label[common] == key[position + common])
+        {
+            common++;
+        }
+
+        if (common < trie->nodes[child].label_length)
+        {
+            /* Деление ребра: общая часть метки уходит в промежуточный узел */
+            middle = completion_trie_add_node(trie, trie->nodes[child].label_value,
+                trie->nodes[child].label_offset, common, -1);
+            if (middle < 0)
+            {
+                return -1;
+            }
+
+            trie->nodes[middle].first_child = child;
+            trie->nodes[middle].next_sibling = trie->nodes[child].next_sibling;
+            trie->nodes[middle].best_weight = trie->nodes[child].best_weight;
+            if (trie->nodes[node].first_child == child)
+            {
+                trie->nodes[node].first_child = middle;
+            }
+            else
+            {
+                previous = trie->nodes[node].first_child;
+                while (trie->nodes[previous].next_sibling != child)
+                {
+                    previous = trie->nodes[previous].next_sibling;
+                }
+                trie->nodes[previous].next_sibling = middle;
+            }
+
+            trie->nodes[child].next_sibling = -1;
+            trie->nodes[child].label_offset += common;
+            trie->nodes[child].label_length -= common;
+            child = middle;
+        }
+
+        node = child;
+        position += common;
+    }
+
+    trie->nodes[node].value_id = value_id;
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_refresh_path
+ *
+ * Описание: Пересчитывает наибольшие веса поддеревьев на пути от корня к
+ *           ключу после изменения веса его значения (снизу вверх).
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   key - свернутый ключ значения
+ *
+ * Возвращает: 0 при успехе, -1 если пути нет
+ ******************************************************************************/
+int completion_trie_refresh_path(CompletionTrie* trie, const char* key)
+{
+    int path[MAX_TAGS_LEN + 1];
+    int depth = 0;
+    int key_length = (int)strlen(key);
+    int position = 0;
+
+    if (trie->node_count == 0)
+    {
+        return -1;
+    }
+
+    path[depth++] = 0;
+    while (position < key_length)
+    {
+        int child = completion_trie_find_child(trie, path[depth - 1], (unsigned char)key[position]);
+        if (child < 0 || depth > MAX_TAGS_LEN)
+        {
+            return -1;
+        }
+        path[depth++] = child;
+        position += trie->nodes[child].label_length;
+    }
+
+    while (depth > 0)
+    {
+        CompletionNode* node = &trie->nodes[path[--depth]];
+        int best_weight = node->value_id >= 0 ? trie->weights[node->value_id] : 0;
+        int child = 0;
+
+        for (child = node->first_child; child >= 0; child = trie->nodes[child].next_sibling)
+        {
+            if (trie->nodes[child].best_weight > best_weight)
+            {
+                best_weight = trie->nodes[child].best_weight;
+            }
+        }
+        node->best_weight = best_weight;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: completion_trie_adjust
+ *
+ * Описание: Изменяет количество записей со значением. Новое значение
+ *           добавляется в дерево; значение без записей остается в дереве,
+ *           но в подсказки не попадает.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   text - значение поля (пустое не учитывается)
+ *   delta - изменение количества записей (1 или -1)
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int completion_trie_adjust(CompletionTrie* trie, const char* text, int delta)
+{
+    char normalized[MAX_TAGS_LEN];
+    char key[MAX_TAGS_LEN];
+    int value_id = 0;
+    int spelling_id = 0;
+    int previous_subsystem = 0;
+
+    if (normalize_query_text(text, normalized, sizeof(normalized)) == 0)
+    {
+        return 0;
+    }
+    fold_search_text(normalized, key, sizeof(key));
+
+    value_id = string_dictionary_find(&trie->keys, key);
+    if (value_id < 0 && delta <= 0)
+    {
+        return 0;
+    }
+
+    previous_subsystem = memory_enter(MEMORY_COMPLETIONS);
+    if (value_id < 0)
+    {
+        value_id = string_dictionary_intern(&trie->keys, key);
+        spelling_id = string_dictionary_intern(&trie->spellings, normalized);
+        if (value_id < 0 || spelling_id < 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+
+        if (value_id >= trie->value_capacity)
+        {
+            int new_capacity = trie->value_capacity > 0 ? trie->value_capacity * 2 : 16;
+            if (grow_array((void**)&trie->spelling_ids, sizeof(int), new_capacity) != 0 ||
+                grow_array((void**)&trie->weights, sizeof(int), new_capacity) != 0)
+            {
+                return memory_leave(previous_subsystem, -1);
+            }
+            trie->value_capacity = new_capacity;
+        }
+
+        trie->spelling_ids[value_id] = spelling_id;
+        trie->weights[value_id] = 0;
+        if (completion_trie_insert_key(trie, value_id) != 0)
+        {
+            return memory_leave(previous_subsystem, -1);
+        }
+    }
+
+    trie->weights[value_id] += delta;
+    if (trie->weights[value_id] < 0)
+    {
+        trie->weights[value_id] = 0;
+    }
+    completion_trie_refresh_path(trie, key);
+    return memory_leave(previous_subsystem, 0);
+}
+
+/******************************************************************************
+ * Функция: completion_heap_weight
+ *
+ * Описание: Возвращает приоритет элемента очереди поиска подсказок.
+ *           Неотрицательный элемент - поддерево узла (приоритет - наибольший
+ *           вес в нем), отрицательный -(узел + 1) - значение самого узла.
  *
  * Параметры:
- *   photo - указатель на структуру Photo для вывода
+ *   trie - дерево автодополнения
+ *   entry - элемент очереди
  *
- * Возвращает: 0 при успешном выводе, -1 при ошибке
+ * Возвращает: приоритет элемента
  ******************************************************************************/
-int show_photo_information(const Photo* photo)
+int completion_heap_weight(const CompletionTrie* trie, int entry)
 {
-    if (photo == NULL)
+    if (entry >= 0)
     {
-        return -1;
+        return trie->nodes[entry].best_weight;
     }
 
-    print_horizontal_separator();
-    printf("     ПОДРОБНАЯ ИНФОРМАЦИЯ О ФОТОГРАФИИ     \n");
-    print_horizontal_separator();
-    printf("Название: %s\n", photo->name);
-    printf("Дата съемки: %s\n", photo->date);
-    printf("Место съемки: %s\n", photo->place);
-    printf("Категория: %s\n", photo->category);
-    printf("Теги: %s\n", photo->tags);
-    printf("Размер файла: %.2f МБ\n", photo->size);
-    printf("Разрешение: %d x %d пикселей\n", photo->width, photo->height);
-    printf("Формат файла: %s\n", photo->format);
-    print_horizontal_separator();
+    return trie->weights[trie->nodes[-entry - 1].value_id];
+}
 
-    return 0;
+/******************************************************************************
+ * Функция: completion_heap_before
+ *
+ * Описание: Порядок извлечения из очереди: по приоритету, при равенстве
+ *           значение раньше поддерева, а из двух значений или поддеревьев -
+ *           появившееся раньше. Так подсказки с одинаковым числом записей
+ *           выводятся в постоянном порядке.
+ *
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   first_entry - первый элемент очереди
+ *   second_entry - второй элемент очереди
+ *
+ * Возвращает: 1 если первый элемент извлекается раньше второго, иначе 0
+ ******************************************************************************/
+int completion_heap_before(const CompletionTrie* trie, int first_entry, int second_entry)
+{
+    int first_weight = completion_heap_weight(trie, first_entry);
+    int second_weight = completion_heap_weight(trie, second_entry);
+
+    if (first_weight != second_weight)
+    {
+        return first_weight > second_weight;
+    }
+    if ((first_entry < 0) != (second_entry < 0))
+    {
+        return first_entry < 0;
+    }
+    if (first_entry < 0)
+    {
+        return trie->nodes[-first_entry - 1].value_id < trie->nodes[-second_entry - 1].value_id;
+    }
+
+    return first_entry < second_entry;
 }
 
 /******************************************************************************
- * Функция: prompt_for_enter_key
+ * Функция: completion_heap_push
  *
- * Описание: Ожидает нажатия клавиши Enter для продолжения.
+ * Описание: Добавляет элемент в кучу (порядок - completion_heap_before).
  *
- * Возвращает: 0 при успешном ожидании
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   heap - куча
+ *   heap_size - указатель на размер кучи
+ *   entry - элемент очереди
  ******************************************************************************/
-int prompt_for_enter_key(void)
+void completion_heap_push(const CompletionTrie* trie, int heap[], int* heap_size, int entry)
 {
-    printf("\nДля продолжения нажмите Enter...");
-    clear_stdin_buffer();
-    getchar();
-    return 0;
+    int position = (*heap_size)++;
+
+    while (position > 0 && completion_heap_before(trie, entry, heap[(position - 1) / 2]))
+    {
+        heap[position] = heap[(position - 1) / 2];
+        position = (position - 1) / 2;
+    }
+    heap[position] = entry;
 }
 
 /******************************************************************************
- * Функция: print_horizontal_separator
+ * Функция: completion_heap_pop
  *
- * Описание: Выводит разделительную линию.
+ * Описание: Извлекает из кучи первый по порядку completion_heap_before
+ *           элемент.
  *
- * Возвращает: количество выведенных символов
+ * Параметры:
+ *   trie - дерево автодополнения
+ *   heap - непустая куча
+ *   heap_size - указатель на размер кучи
+ *
+ * Возвращает: извлеченный элемент
  ******************************************************************************/
-int print_horizontal_separator(void)
+int completion_heap_pop(const CompletionTrie* trie, int heap[], int* heap_size)
 {
-    int i = 0;
+    int top = heap[0];
+    int last = heap[--(*heap_size)];
+    int position = 0;
 
-    for (i = 0; i < 50; i++)
+    while (1)
     {
-        printf("=");
+        int child = position * 2 + 1;
+
+        if (child >= *heap_size)
+        {
+            break;
+        }
+        if (child + 1 < *heap_size && completion_heap_before(trie, heap[child + 1], heap[child]))
+        {
+            child++;
+        }
+        if (!completion_heap_before(trie, heap[child], last))
+        {
+            break;
+        }
+        heap[position] = heap[child];
+        position = child;
     }
-    printf("\n");
+    heap[position] = last;
 
-    return i;
+    return top;
 }
 
 /******************************************************************************
- * Функция: validate_date_format
+ * Функция: completion_trie_complete
  *
- * Описание: Проверяет корректность формата даты ГГГГ-ММ-ДД.
+ * Описание: Находит самые частые значения, начинающиеся с заданного
+ *           начала (без учета регистра). Спуск к узлу начала занимает
+ *           O(длины начала); затем узлы обходятся в порядке наибольшего
+ *           веса поддерева, поэтому просматриваются только ветви, из
+ *           которых берутся подсказки, а не все значения с этим началом.
  *
  * Параметры:
- *   date - строка с датой для проверки
+ *   trie - дерево автодополнения
+ *   prefix - начало значения (пустое - самые частые значения поля)
+ *   completions - массив для результата
+ *   limit - размер массива
  *
- * Возвращает: 0 если формат корректен, -1 если некорректен
+ * Возвращает: количество подсказок (по убыванию числа записей),
+ *             -1 при нехватке памяти
  ******************************************************************************/
-int validate_date_format(const char* date)
+int completion_trie_complete(const CompletionTrie* trie, const char* prefix,
+    Completion completions[], int limit)
 {
-    int year = 0;
-    int month = 0;
-    int day = 0;
+    char normalized[MAX_TAGS_LEN];
+    char key[MAX_TAGS_LEN];
+    int* heap = NULL;
+    int heap_size = 0;
+    int heap_capacity = COMPLETION_MAX_LIMIT * 4;
+    int completion_count = 0;
+    int key_length = 0;
+    int position = 0;
+    int node = 0;
 
-    if (date == NULL || strlen(date) != 10)
+    if (trie->node_count == 0 || limit <= 0)
     {
-        return -1;
+        return 0;
     }
 
-    if (date[4] != '-' || date[7] != '-')
+    normalize_query_text(prefix, normalized, sizeof(normalized));
+    key_length = fold_search_text(normalized, key, sizeof(key));
+
+    /* Спуск к узлу, под которым лежат все значения с этим началом */
+    while (position < key_length)
     {
-        return -1;
+        const char* label = NULL;
+        int common = 0;
+
+        node = completion_trie_find_child(trie, node, (unsigned char)key[position]);
+        if (node < 0)
+        {
+            return 0;
+        }
+
+        label = trie->keys.values[trie->nodes[node].label_value] + trie->nodes[node].label_offset;
+        common = trie->nodes[node].label_length < key_length - position ?
+            trie->nodes[node].label_length : key_length - position;
+        if (memcmp(label, key + position, (size_t)common) != 0)
+        {
+            return 0;
+        }
+        position += common;
     }
 
-    if (sscanf(date, "%4d-%2d-%2d", &year, &month, &day) != 3)
+    if (trie->nodes[node].best_weight == 0)
     {
-        return -1;
+        return 0;
     }
 
-    if (year < 1900 || year > 2100)
+    heap = (int*)memory_allocate((size_t)heap_capacity * sizeof(int));
+    if (heap == NULL)
     {
         return -1;
     }
 
-    if (month < 1 || month > 12)
+    completion_heap_push(trie, heap, &heap_size, node);
+    while (heap_size > 0 && completion_count < limit)
     {
-        return -1;
+        int entry = completion_heap_pop(trie, heap, &heap_size);
+        int child = 0;
+        int push_count = 1;
+
+        if (entry < 0)
+        {
+            const CompletionNode* value_node = &trie->nodes[-entry - 1];
+            completions[completion_count].value =
+                trie->spellings.values[trie->spelling_ids[value_node->value_id]];
+            completions[completion_count].weight = trie->weights[value_node->value_id];
+            completion_count++;
+            continue;
+        }
+
+        /* Очередь растет на значение узла и его потомков */
+        for (child = trie->nodes[entry].first_child; child >= 0; child = trie->nodes[child].next_sibling)
+        {
+            push_count++;
+        }
+        if (heap_size + push_count > heap_capacity)
+        {
+            int new_capacity = heap_capacity * 2 > heap_size + push_count ?
+                heap_capacity * 2 : heap_size + push_count;
+            if (grow_array((void**)&heap, sizeof(int), new_capacity) != 0)
+            {
+                memory_release(heap);
+                return -1;
+            }
+            heap_capacity = new_capacity;
+        }
+
+        if (trie->nodes[entry].value_id >= 0 && trie->weights[trie->nodes[entry].value_id] > 0)
+        {
+            completion_heap_push(trie, heap, &heap_size, -entry - 1);
+        }
+        for (child = trie->nodes[entry].first_child; child >= 0; child = trie->nodes[child].next_sibling)
+        {
+            if (trie->nodes[child].best_weight > 0)
+            {
+                completion_heap_push(trie, heap, &heap_size, child);
+            }
+        }
     }
 
-    if (day < 1 || day > 31)
+    memory_release(heap);
+    return completion_count;
+}
+
+/******************************************************************************
+ * Функция: completion_tries_adjust_record
+ *
+ * Описание: Учитывает место съемки, категорию и каждый тег записи в
+ *           деревьях автодополнения.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   photo - запись
+ *   delta - 1 при добавлении записи, -1 при удалении
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int completion_tries_adjust_record(ArchiveIndexes* indexes, const Photo* photo, int delta)
+{
+    char tag[MAX_TAGS_LEN];
+    const char* tags = photo->tags;
+    int result = 0;
+
+    result |= completion_trie_adjust(&indexes->place_completions, photo->place, delta);
+    result |= completion_trie_adjust(&indexes->category_completions, photo->category, delta);
+    while (*tags != '\0')
     {
-        return -1;
+        size_t tag_length = strcspn(tags, TAG_SEPARATORS);
+
+        memcpy(tag, tags, tag_length);
+        tag[tag_length] = '\0';
+        tags += tag_length;
+        if (*tags != '\0')
+        {
+            tags++;
+        }
+
+        result |= completion_trie_adjust(&indexes->tag_completions, tag, delta);
+    }
+
+    return result != 0 ? -1 : 0;
+}
+
+/******************************************************************************
+ * Функция: completion_tries_build
+ *
+ * Описание: Строит деревья автодополнения по существующим записям.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   database - массив структур Photo
+ *   record_count - количество записей
+ *
+ * Возвращает: 0 при успехе, -1 при нехватке памяти
+ ******************************************************************************/
+int completion_tries_build(ArchiveIndexes* indexes, const Photo database[], int record_count)
+{
+    int i = 0;
+
+    completion_trie_release(&indexes->place_completions);
+    completion_trie_release(&indexes->category_completions);
+    completion_trie_release(&indexes->tag_completions);
+    for (i = 0; i < record_count; i++)
+    {
+        if (!database[i].is_deleted && completion_tries_adjust_record(indexes, &database[i], 1) != 0)
+        {
+            return -1;
+        }
     }
 
     return 0;
 }
 
 /******************************************************************************
- * Функция: validate_positive_number
+ * Функция: archive_indexes_complete
  *
- * Описание: Проверяет, является ли число положительным.
+ * Описание: Подсказки для значения поля: самые частые из уже
+ *           встречавшихся значений с заданным началом.
  *
  * Параметры:
- *   number - число для проверки
+ *   indexes - вспомогательные структуры архива
+ *   field - поле схемы: PHOTO_FIELD_place, PHOTO_FIELD_category или
+ *           PHOTO_FIELD_tags (один тег)
+ *   prefix - начало значения
+ *   completions - массив для результата (строки принадлежат индексам)
+ *   limit - размер массива
  *
- * Возвращает: 0 если число положительное, -1 если нет
+ * Возвращает: количество подсказок, -1 при ошибке
  ******************************************************************************/
-int validate_positive_number(double number)
+int archive_indexes_complete(const ArchiveIndexes* indexes, int field, const char* prefix,
+    Completion completions[], int limit)
 {
-    if (number > 0)
+    switch (field)
     {
-        return 0;
+    case PHOTO_FIELD_place:
+        return completion_trie_complete(&indexes->place_completions, prefix, completions, limit);
+    case PHOTO_FIELD_category:
+        return completion_trie_complete(&indexes->category_completions, prefix, completions, limit);
+    case PHOTO_FIELD_tags:
+        return completion_trie_complete(&indexes->tag_completions, prefix, completions, limit);
+    default:
+        return -1;
     }
+}
 
-    return -1;
+/******************************************************************************
+ * Функция: read_text_with_completions
+ *
+ * Описание: Читает значение поля. Если ввод оканчивается знаком "?",
+ *           выводятся подсказки для введенного начала (для тегов - для
+ *           последнего тега), и выбранная подсказка подставляется в
+ *           значение; иначе значение вводится заново. Удвоенный знак "??"
+ *           в конце ввода означает сам знак вопроса: он остается в
+ *           значении одним "?", а подсказки не выводятся.
+ *
+ * Параметры:
+ *   indexes - вспомогательные структуры архива
+ *   field - поле схемы (см. archive_indexes_complete)
+ *   prompt - приглашение к вводу
+ *   text - буфер для значения
+ *   text_size - размер буфера
+ *
+ * Возвращает: 0 при успехе, -1 при конце ввода
+ ******************************************************************************/
+int read_text_with_completions(const ArchiveIndexes* indexes, int field, const char* prompt,
+    char* text, size_t text_size)
+{
+    Completion completions[COMPLETION_DEFAULT_LIMIT];
+    char choice[16];
+    size_t length = 0;
+    size_t prefix_start = 0;
+    int completion_count = 0;
+    int selected = 0;
+    int i = 0;
+
+    while (1)
+    {
+        printf("%s", prompt);
+        if (fgets(text, (int)text_size, stdin) == NULL)
+        {
+            text[0] = '\0';
+            return -1;
+        }
+        text[strcspn(text, "\n")] = '\0';
+
+        length = strlen(text);
+        if (length == 0 || text[length - 1] != COMPLETION_REQUEST_MARK)
+        {
+            return 0;
+        }
+        text[--length] = '\0';
+        if (length > 0 && text[length - 1] == COMPLETION_REQUEST_MARK)
+        {
+            return 0;
+        }
+
+        /* В поле тегов дополняется последний тег */
+        prefix_start = 0;
+        if (field == PHOTO_FIELD_tags)
+        {
+            while (prefix_start + strcspn(text + prefix_start, TAG_SEPARATORS) < length)
+            {
+                prefix_start += strcspn(text + prefix_start, TAG_SEPARATORS) + 1;
+            }
+        }
+        prefix_start += strspn(text + prefix_start, " ");
+
+        completion_count = archive_indexes_complete(indexes, field, text + prefix_start,
+            completions, COMPLETION_DEFAULT_LIMIT);
+        if (completion_count <= 0)
+        {
+            printf("Подсказок нет, введите значение полностью.\n");
+            continue;
+        }
+
+        for (i = 0; i < completion_count; i++)
+        {
+            printf("  %d. %s (записей: %d)\n", i + 1, completions[i].value, completions[i].weight);
+        }
+        printf("Номер подсказки (Enter - ввести заново; ?? в конце ввода - сам знак вопроса): ");
+        if (fgets(choice, sizeof(choice), stdin) == NULL)
+        {
+            text[0] = '\0';
+            return -1;
+        }
+        if (strchr(choice, '\n') == NULL)
+        {
+            clear_stdin_buffer();
+        }
+
+        selected = atoi(choice);
+        if (selected >= 1 && selected <= completion_count)
+        {
+            snprintf(text + prefix_start, text_size - prefix_start, "%s",
+                completions[selected - 1].value);
+            printf("Значение: %s\n", text);
+            return 0;
+        }
+    }
 }
 
 /******************************************************************************
- * Функция: validate_positive_integer
+ * Функция: load_archive_for_batch
  *
- * Описание: Проверяет, является ли целое число положительным.
+ * Описание: Загружает для пакетного режима весь архив, включая записи
+ *           запечатанных годов, и строит вспомогательные структуры.
  *
  * Параметры:
- *   number - целое число для проверки
+ *   database - массив структур Photo
+ *   record_count - указатель для возврата количества записей
+ *   indexes - вспомогательные структуры архива (освобождает вызывающая
+ *             функция при успехе)
  *
- * Возвращает: 0 если число положительное, -1 если нет
+ * Возвращает: 0 при успехе, -1 если архива нет
  ******************************************************************************/
-int validate_positive_integer(int number)
+int load_archive_for_batch(Photo database[], int* record_count, ArchiveIndexes* indexes)
 {
-    if (number > 0)
+    int operation_result = 0;
+
+    /* Локаль нужна для чтения размеров с десятичной запятой */
+    setlocale(LC_ALL, "Russian");
+
+    archive_indexes_initialize(indexes);
+    operation_result = load_database_from_file(database, record_count);
+    if (segment_directory_load(&indexes->segments) <= 0 && operation_result != 0)
     {
-        return 0;
+        archive_indexes_release(indexes);
+        return -1;
     }
 
-    return -1;
+    archive_indexes_build(indexes, database, *record_count);
+    load_sealed_segments(database, record_count, indexes, ALL_YEARS_FIRST, ALL_YEARS_LAST);
+    return 0;
+}
+
+/******************************************************************************
+ * Функция: run_batch_complete
+ *
+ * Описание: Пакетный режим подсказок: выводит самые частые значения поля
+ *           с заданным началом, по одному в строке с числом записей
+ *           через табуляцию.
+ *
+ * Параметры:
+ *   field_name - поле: "place", "category" или "tags"
+ *   prefix - начало значения
+ *
+ * Возвращает: 0 при успехе, -1 при ошибке
+ ******************************************************************************/
+int run_batch_complete(const char* field_name, const char* prefix)
+{
+    static Photo database[MAX_PHOTOS];
+    Completion completions[COMPLETION_MAX_LIMIT];
+    ArchiveIndexes indexes;
+    int record_count = 0;
+    int completion_count = 0;
+    int field = 0;
+    int i = 0;
+
+    if (strcmp(field_name, "place") == 0)
+    {
+        field = PHOTO_FIELD_place;
+    }
+    else if (strcmp(field_name, "category") == 0)
+    {
+        field = PHOTO_FIELD_category;
+    }
+    else if (strcmp(field_name, "tags") == 0)
+    {
+        field = PHOTO_FIELD_tags;
+    }
+    else
+    {
+        fprintf(stderr, "Неизвестное поле '%s' (place, category, tags).\n", field_name);
+        return -1;
+    }
+
+    if (load_archive_for_batch(database, &record_count, &indexes) != 0)
+    {
+        return -1;
+    }
+
+    completion_count = archive_indexes_complete(&indexes, field, prefix, completions,
+        COMPLETION_MAX_LIMIT);
+    for (i = 0; i < completion_count; i++)
+    {
+        printf("%s\t%d\n", completions[i].value, completions[i].weight);
+    }
+
+    archive_indexes_release(&indexes);
+    return completion_count < 0 ? -1 : 0;
 }
\ No newline at end of file